@@ -0,0 +1,37 @@
+; alu.asm - tight loop of register ALU operations
+;
+; 12 passes of a 65536-iteration loop; D counts passes and BC
+; counts iterations. Every arithmetic, logical and rotate
+; instruction on registers and immediates appears in the body.
+
+        ORG     0
+        LXI     SP,0F000H
+        MVI     D,12
+        LXI     H,1234H
+        MVI     E,5AH
+pass:   LXI     B,0
+loop:   ADD     B
+        ADC     C
+        SUB     D
+        SBB     E
+        ANA     H
+        XRA     L
+        ORA     B
+        CMP     C
+        ADI     5
+        ACI     3
+        SUI     7
+        XRI     0A5H
+        RLC
+        RAR
+        INR     E
+        DCR     H
+        INX     H
+        DAD     B
+        DCX     B
+        MOV     A,B
+        ORA     C
+        JNZ     loop
+        DCR     D
+        JNZ     pass
+        HLT
@@ -0,0 +1,36 @@
+; daa.asm - packed BCD arithmetic
+;
+; Keeps an 8-digit packed BCD counter at 'count', least significant
+; byte first, and adds 37 (BCD) to it 400000 times with ADC and
+; DAA, carrying through all four bytes each time. The loop count is
+; 16 passes of 25000, in D and BC.
+
+        ORG     0
+        LXI     SP,0F000H
+        MVI     D,16
+pass:   LXI     B,25000
+loop:   LDA     count
+        ADI     37H
+        DAA
+        STA     count
+        LDA     count+1
+        ACI     0
+        DAA
+        STA     count+1
+        LDA     count+2
+        ACI     0
+        DAA
+        STA     count+2
+        LDA     count+3
+        ACI     0
+        DAA
+        STA     count+3
+        DCX     B
+        MOV     A,B
+        ORA     C
+        JNZ     loop
+        DCR     D
+        JNZ     pass
+        HLT
+
+count:  DB      0,0,0,0
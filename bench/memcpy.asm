@@ -0,0 +1,47 @@
+; memcpy.asm - block copies through memory
+;
+; Copies 8K from 4000H to 8000H a byte at a time with LDAX and
+; MOV M, then copies it back a word at a time, reading with POP. 128 passes; the pass count is kept in memory.
+
+        ORG     0
+        LXI     SP,0F000H
+        MVI     A,128
+        STA     passes
+pass:   LXI     D,4000H         ; source
+        LXI     H,8000H         ; destination
+        LXI     B,2000H         ; byte count
+bytes:  LDAX    D
+        MOV     M,A
+        INX     D
+        INX     H
+        DCX     B
+        MOV     A,B
+        ORA     C
+        JNZ     bytes
+
+        LXI     H,0
+        DAD     SP
+        SHLD    savesp
+        LXI     SP,8000H        ; source
+        LXI     H,4000H         ; destination
+        LXI     B,1000H         ; word count
+words:  POP     D
+        MOV     M,E
+        INX     H
+        MOV     M,D
+        INX     H
+        DCX     B
+        MOV     A,B
+        ORA     C
+        JNZ     words
+        LHLD    savesp
+        SPHL
+
+        LDA     passes
+        DCR     A
+        STA     passes
+        JNZ     pass
+        HLT
+
+passes: DB      0
+savesp: DW      0
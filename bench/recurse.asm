@@ -0,0 +1,38 @@
+; recurse.asm - call-heavy recursion
+;
+; Computes fib(24) by naive recursion 8 times over, adding every
+; leaf into HL: about 150000 calls a time. fib keeps n in C and
+; leaves it as it found it; the registers it clobbers are saved
+; with PUSH/POP as a compiled routine would.
+
+        ORG     0
+        LXI     SP,0F000H
+        MVI     A,8
+        STA     passes
+pass:   LXI     H,0
+        MVI     C,24
+        CALL    fib
+        LDA     passes
+        DCR     A
+        STA     passes
+        JNZ     pass
+        HLT
+
+fib:    MOV     A,C
+        CPI     2
+        JC      leaf
+        PUSH    D
+        DCR     C
+        CALL    fib
+        DCR     C
+        CALL    fib
+        INR     C
+        INR     C
+        POP     D
+        RET
+leaf:   MVI     D,0
+        MOV     E,C
+        DAD     D
+        RET
+
+passes: DB      0
@@ -0,0 +1,348 @@
+; sweep.asm - every documented opcode, exerciser style
+;
+; The loop body runs each 8080 opcode except HLT in opcode order,
+; 40000 times. Anything that addresses memory is first pointed at
+; 'scratch' in page zero, stack changes are undone straight away,
+; jumps go to the next instruction and calls and RSTs go to a RET,
+; so the flags left by one instruction steer only which way the
+; next conditional goes. IN and OUT use an unmapped port.
+
+scratch EQU     0C0H
+stack   EQU     0F000H
+
+        ORG     0
+        JMP     start
+        ORG     08H
+        RET
+        ORG     10H
+        RET
+        ORG     18H
+        RET
+        ORG     20H
+        RET
+        ORG     28H
+        RET
+        ORG     30H
+        RET
+        ORG     38H
+        RET
+
+        ORG     100H
+start:  LXI     SP,stack
+        LXI     H,40000
+        SHLD    count
+loop:
+        NOP
+        LXI     B,1234H
+        LXI     B,scratch
+        STAX    B
+        INX     B
+        INR     B
+        DCR     B
+        MVI     B,5AH
+        RLC
+        DAD     B
+        LXI     B,scratch
+        LDAX    B
+        DCX     B
+        INR     C
+        DCR     C
+        MVI     C,5AH
+        RRC
+        LXI     D,1234H
+        LXI     D,scratch
+        STAX    D
+        INX     D
+        INR     D
+        DCR     D
+        MVI     D,5AH
+        RAL
+        DAD     D
+        LXI     D,scratch
+        LDAX    D
+        DCX     D
+        INR     E
+        DCR     E
+        MVI     E,5AH
+        RAR
+        LXI     H,scratch
+        SHLD    scratch
+        INX     H
+        INR     H
+        DCR     H
+        MVI     H,5AH
+        DAA
+        DAD     H
+        LHLD    scratch
+        DCX     H
+        INR     L
+        DCR     L
+        MVI     L,5AH
+        CMA
+        LXI     SP,stack
+        STA     scratch
+        INX     SP
+        LXI     H,scratch
+        INR     M
+        LXI     H,scratch
+        DCR     M
+        LXI     H,scratch
+        MVI     M,5AH
+        STC
+        DAD     SP
+        LDA     scratch
+        DCX     SP
+        INR     A
+        DCR     A
+        MVI     A,5AH
+        CMC
+        MOV     B,B
+        MOV     B,C
+        MOV     B,D
+        MOV     B,E
+        MOV     B,H
+        MOV     B,L
+        LXI     H,scratch
+        MOV     B,M
+        MOV     B,A
+        MOV     C,B
+        MOV     C,C
+        MOV     C,D
+        MOV     C,E
+        MOV     C,H
+        MOV     C,L
+        LXI     H,scratch
+        MOV     C,M
+        MOV     C,A
+        MOV     D,B
+        MOV     D,C
+        MOV     D,D
+        MOV     D,E
+        MOV     D,H
+        MOV     D,L
+        LXI     H,scratch
+        MOV     D,M
+        MOV     D,A
+        MOV     E,B
+        MOV     E,C
+        MOV     E,D
+        MOV     E,E
+        MOV     E,H
+        MOV     E,L
+        LXI     H,scratch
+        MOV     E,M
+        MOV     E,A
+        MOV     H,B
+        MOV     H,C
+        MOV     H,D
+        MOV     H,E
+        MOV     H,H
+        MOV     H,L
+        LXI     H,scratch
+        MOV     H,M
+        MOV     H,A
+        MOV     L,B
+        MOV     L,C
+        MOV     L,D
+        MOV     L,E
+        MOV     L,H
+        MOV     L,L
+        LXI     H,scratch
+        MOV     L,M
+        MOV     L,A
+        LXI     H,scratch
+        MOV     M,B
+        LXI     H,scratch
+        MOV     M,C
+        LXI     H,scratch
+        MOV     M,D
+        LXI     H,scratch
+        MOV     M,E
+        LXI     H,scratch
+        MOV     M,H
+        LXI     H,scratch
+        MOV     M,L
+        LXI     H,scratch
+        MOV     M,A
+        MOV     A,B
+        MOV     A,C
+        MOV     A,D
+        MOV     A,E
+        MOV     A,H
+        MOV     A,L
+        LXI     H,scratch
+        MOV     A,M
+        MOV     A,A
+        ADD     B
+        ADD     C
+        ADD     D
+        ADD     E
+        ADD     H
+        ADD     L
+        LXI     H,scratch
+        ADD     M
+        ADD     A
+        ADC     B
+        ADC     C
+        ADC     D
+        ADC     E
+        ADC     H
+        ADC     L
+        LXI     H,scratch
+        ADC     M
+        ADC     A
+        SUB     B
+        SUB     C
+        SUB     D
+        SUB     E
+        SUB     H
+        SUB     L
+        LXI     H,scratch
+        SUB     M
+        SUB     A
+        SBB     B
+        SBB     C
+        SBB     D
+        SBB     E
+        SBB     H
+        SBB     L
+        LXI     H,scratch
+        SBB     M
+        SBB     A
+        ANA     B
+        ANA     C
+        ANA     D
+        ANA     E
+        ANA     H
+        ANA     L
+        LXI     H,scratch
+        ANA     M
+        ANA     A
+        XRA     B
+        XRA     C
+        XRA     D
+        XRA     E
+        XRA     H
+        XRA     L
+        LXI     H,scratch
+        XRA     M
+        XRA     A
+        ORA     B
+        ORA     C
+        ORA     D
+        ORA     E
+        ORA     H
+        ORA     L
+        LXI     H,scratch
+        ORA     M
+        ORA     A
+        CMP     B
+        CMP     C
+        CMP     D
+        CMP     E
+        CMP     H
+        CMP     L
+        LXI     H,scratch
+        CMP     M
+        CMP     A
+        CALL    rnz
+        PUSH    B
+        POP     B
+        JNZ     L1
+L1:
+        JMP     L2
+L2:
+        CNZ     sub
+        ADI     5AH
+        CALL    rz
+        CALL    rret
+        JZ      L3
+L3:
+        CZ      sub
+        CALL    sub
+        ACI     5AH
+        RST     1
+        CALL    rnc
+        PUSH    D
+        POP     D
+        JNC     L4
+L4:
+        OUT     10H
+        CNC     sub
+        SUI     5AH
+        RST     2
+        CALL    rc
+        JC      L5
+L5:
+        IN      10H
+        CC      sub
+        SBI     5AH
+        RST     3
+        CALL    rpo
+        PUSH    H
+        POP     H
+        JPO     L6
+L6:
+        PUSH    H
+        XTHL
+        POP     H
+        CPO     sub
+        ANI     5AH
+        RST     4
+        CALL    rpe
+        LXI     H,Lp233
+        PCHL
+Lp233:
+        JPE     L7
+L7:
+        XCHG
+        CPE     sub
+        XRI     5AH
+        RST     5
+        CALL    rp
+        PUSH    PSW
+        POP     PSW
+        JP      L8
+L8:
+        DI
+        CP      sub
+        ORI     5AH
+        RST     6
+        CALL    rm
+        LXI     H,stack
+        SPHL
+        JM      L9
+L9:
+        EI
+        CM      sub
+        CPI     5AH
+        RST     7
+        LHLD    count
+        DCX     H
+        SHLD    count
+        MOV     A,H
+        ORA     L
+        JNZ     loop
+        DI                      ; so the HLT ends the run
+        HLT
+
+sub:
+rret:   RET
+rnz:    RNZ
+        RET
+rz:     RZ
+        RET
+rnc:    RNC
+        RET
+rc:     RC
+        RET
+rpo:    RPO
+        RET
+rpe:    RPE
+        RET
+rp:     RP
+        RET
+rm:     RM
+        RET
+
+count:  DW      0
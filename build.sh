@@ -1,5 +1,20 @@
 #!/bin/sh
 
+# 'sh build.sh release' builds optimized, without debug logging
+# 'sh build.sh bench' builds optimized and runs the bench/ programs
 DEBUG="-D_DEBUG -g" 
+RELEASE="-O2"
 
-cc -D_DEBUG -g -Wall -Wno-missing-braces -o build/main src/log.c src/common.c src/memory.c src/cpu.c src/main.c
+FLAGS=$DEBUG
+if [ "$1" = "release" ] || [ "$1" = "bench" ]; then
+  FLAGS=$RELEASE
+fi
+
+cc $FLAGS -Wall -Wno-missing-braces -pthread -o build/main src/log.c src/common.c src/memory.c src/cpu.c src/breakpoint.c src/expr.c src/history.c src/io.c src/sched.c src/throttle.c src/display.c src/disas.c src/dump.c src/gdbstub.c src/metrics.c src/profile.c src/stats.c src/symbols.c src/trace.c src/main.c
+cc $FLAGS -Wall -Wno-missing-braces -o build/tracedump src/tracefile.c src/tracedump.c
+cc $FLAGS -Wall -Wno-missing-braces -o build/tracequery src/tracefile.c src/traceindex.c src/tracequery.c
+cc $FLAGS -Wall -Wno-missing-braces -pthread -o build/bench src/log.c src/common.c src/memory.c src/cpu.c src/breakpoint.c src/expr.c src/history.c src/io.c src/sched.c src/metrics.c src/profile.c src/symbols.c src/trace.c src/bench.c -lm
+
+if [ "$1" = "bench" ]; then
+  build/bench --json=build/bench.json bench/*.com && cat build/bench.json
+fi
@@ -0,0 +1,292 @@
+/*
+  Name: bench
+  Purpose: Run guest programs headless and report how fast they are
+           emulated
+*/
+
+#include "cpu.h"
+#include "io.h"
+#include "log.h"
+#include "memory.h"
+#include "sched.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+#define MEM_SIZE                0x10000
+#define BENCH_DEFAULT_REPEATS   5
+#define BENCH_DEFAULT_WARMUPS   1
+#define BENCH_MAX_REPEATS       100
+/* A workload that runs longer than this is taken not to halt */
+#define BENCH_MAX_CYCLES        (1ULL << 36)
+#define BENCH_MAX_NAME          64
+
+struct bench_result
+{
+  char   name[BENCH_MAX_NAME];
+  u64    instructions;
+  u64    cycles;
+  u64    runNs[BENCH_MAX_REPEATS];
+  double meanNs;
+  double stddevNs;
+  u64    minNs;
+  u64    maxNs;
+};
+
+internal byte_t* memory;
+
+
+void
+PrintUsage(char* exeName)
+{
+  fprintf(stderr, "%s [options] PROGRAM...\n", exeName);
+  fprintf(stderr, "  --repeat=N   timed runs of each program (default %u)\n",
+          BENCH_DEFAULT_REPEATS);
+  fprintf(stderr, "  --warmup=N   untimed runs first (default %u)\n",
+          BENCH_DEFAULT_WARMUPS);
+  fprintf(stderr, "  --json=FILE  write the results to FILE instead of stdout\n");
+  fprintf(stderr, "Each program is loaded at 0 and run until it halts.\n");
+}
+
+internal u64
+Bench_GetTimeNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+internal byte_t*
+Bench_LoadImage(char* path, u32* size)
+{
+  byte_t* image;
+  FILE*   fp;
+
+  fp = fopen(path, "rb");
+  if (!fp)
+    return 0;
+  image = (byte_t*)malloc(MEM_SIZE);
+  *size = fread(image, 1, MEM_SIZE, fp);
+  fclose(fp);
+  return image;
+}
+
+/*
+  Bench_Run()
+
+  Reset the machine, load 'image' at 0 and run it to the HLT. Returns
+  the host time taken, or 0 if the program did not halt.
+*/
+internal u64
+Bench_Run(const byte_t* image, u32 size, struct bench_result* result)
+{
+  const struct cpu_opcode_counts* counts;
+  struct cpu_state                state;
+  u64                             start;
+  u64                             end;
+  u8                              stopReason;
+  u32                             i;
+
+  memset(memory, 0, MEM_SIZE);
+  memcpy(memory, image, size);
+  Mem_MarkModified(0, MEM_SIZE);
+  Sched_Init();
+  IO_Init();
+
+  memset(&state, 0, sizeof(state));
+  state.regs.F  = 0x02;
+  state.regs.SP = 0x100;
+  CPU_RestoreState(&state);
+  CPU_ResetOpcodeCounts();
+
+  start      = Bench_GetTimeNs();
+  stopReason = CPU_Run(BENCH_MAX_CYCLES);
+  end        = Bench_GetTimeNs();
+  if (stopReason != CPU_STOP_HALTED)
+    return 0;
+
+  counts = CPU_GetOpcodeCounts();
+  result->instructions = 0;
+  for (i = 0; i < 256; ++i)
+    result->instructions += counts[i].executed;
+  result->cycles = CPU_GetCycleCount();
+  return (end > start) ? end - start : 1;
+}
+
+internal void
+Bench_Summarize(struct bench_result* result, u32 repeats)
+{
+  double sum     = 0;
+  double squares = 0;
+  u32    i;
+
+  result->minNs = result->runNs[0];
+  result->maxNs = result->runNs[0];
+  for (i = 0; i < repeats; ++i)
+  {
+    sum += result->runNs[i];
+    if (result->runNs[i] < result->minNs)
+      result->minNs = result->runNs[i];
+    if (result->runNs[i] > result->maxNs)
+      result->maxNs = result->runNs[i];
+  }
+  result->meanNs = sum / repeats;
+  for (i = 0; i < repeats; ++i)
+    squares += (result->runNs[i] - result->meanNs) * (result->runNs[i] - result->meanNs);
+  result->stddevNs = (repeats > 1) ? sqrt(squares / (repeats - 1)) : 0;
+}
+
+/* The program's file name without directory or extension */
+internal void
+Bench_GetName(char* path, char* name)
+{
+  char* base = strrchr(path, '/');
+  char* dot;
+
+  snprintf(name, BENCH_MAX_NAME, "%s", base ? base + 1 : path);
+  dot = strrchr(name, '.');
+  if (dot && dot != name)
+    *dot = '\0';
+}
+
+internal void
+Bench_WriteJson(FILE* out, const struct bench_result* results, u32 resultCount,
+                u32 repeats, u32 warmups)
+{
+  double logMipsSum = 0;
+  u32    i;
+  u32    run;
+
+  fprintf(out, "{\n  \"repeats\": %u,\n  \"warmups\": %u,\n", repeats, warmups);
+#ifdef __VERSION__
+  fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+  fprintf(out, "  \"workloads\": [\n");
+  for (i = 0; i < resultCount; ++i)
+  {
+    const struct bench_result* result = &results[i];
+    double                     mips   = result->instructions * 1e3 / result->meanNs;
+
+    logMipsSum += log(mips);
+    fprintf(out, "    {\"name\": \"%s\", \"instructions\": %llu, \"cycles\": %llu,\n",
+            result->name, (unsigned long long)result->instructions,
+            (unsigned long long)result->cycles);
+    fprintf(out, "     \"instructions_per_sec\": %.0f, \"cycles_per_sec\": %.0f,"
+            " \"ns_per_instruction\": %.3f, \"mips\": %.3f,\n",
+            result->instructions * 1e9 / result->meanNs, result->cycles * 1e9 / result->meanNs,
+            result->meanNs / result->instructions, mips);
+    fprintf(out, "     \"ns\": {\"mean\": %.0f, \"stddev\": %.0f, \"min\": %llu, \"max\": %llu,"
+            " \"cv\": %.4f, \"runs\": [",
+            result->meanNs, result->stddevNs,
+            (unsigned long long)result->minNs, (unsigned long long)result->maxNs,
+            result->stddevNs / result->meanNs);
+    for (run = 0; run < repeats; ++run)
+      fprintf(out, "%s%llu", run ? ", " : "", (unsigned long long)result->runNs[run]);
+    fprintf(out, "]}}%s\n", (i + 1 < resultCount) ? "," : "");
+  }
+  fprintf(out, "  ],\n  \"geomean_mips\": %.3f\n}\n",
+          resultCount ? exp(logMipsSum / resultCount) : 0.0);
+}
+
+int
+main(int argc, char* argv[])
+{
+  struct bench_result* results;
+  u32                  resultCount;
+  u32                  repeats;
+  u32                  warmups;
+  char*                jsonPath;
+  FILE*                out;
+
+  Log_Init();
+  memory = Mem_Init(MEM_SIZE);
+  CPU_Init(memory);
+
+  repeats  = BENCH_DEFAULT_REPEATS;
+  warmups  = BENCH_DEFAULT_WARMUPS;
+  jsonPath = 0;
+  results  = (struct bench_result*)calloc(argc, sizeof(struct bench_result));
+  resultCount = 0;
+  for (int argi = 1; argi < argc; ++argi)
+  {
+    if (strncmp(argv[argi], "--repeat=", 9) == 0)
+      repeats = strtoul(argv[argi] + 9, 0, 0);
+    else if (strncmp(argv[argi], "--warmup=", 9) == 0)
+      warmups = strtoul(argv[argi] + 9, 0, 0);
+    else if (strncmp(argv[argi], "--json=", 7) == 0)
+      jsonPath = argv[argi] + 7;
+    else if (argv[argi][0] == '-')
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (repeats < 1 || repeats > BENCH_MAX_REPEATS)
+  {
+    fprintf(stderr, "--repeat must be 1-%u\n", BENCH_MAX_REPEATS);
+    return 1;
+  }
+
+  for (int argi = 1; argi < argc; ++argi)
+  {
+    struct bench_result* result = &results[resultCount];
+    byte_t*              image;
+    u32                  size;
+    u32                  run;
+
+    if (argv[argi][0] == '-')
+      continue;
+    image = Bench_LoadImage(argv[argi], &size);
+    if (!image)
+    {
+      fprintf(stderr, "cannot read %s\n", argv[argi]);
+      return 1;
+    }
+    Bench_GetName(argv[argi], result->name);
+
+    for (run = 0; run < warmups + repeats; ++run)
+    {
+      u64 ns = Bench_Run(image, size, result);
+
+      if (!ns)
+      {
+        fprintf(stderr, "%s did not halt within %llu cycles\n", argv[argi],
+                (unsigned long long)BENCH_MAX_CYCLES);
+        return 1;
+      }
+      if (run >= warmups)
+        result->runNs[run - warmups] = ns;
+    }
+    free(image);
+
+    Bench_Summarize(result, repeats);
+    fprintf(stderr, "%-12s %10llu instructions  %8.2f MIPS  %6.2f ns/instruction  +/- %.1f%%\n",
+            result->name, (unsigned long long)result->instructions,
+            result->instructions * 1e3 / result->meanNs,
+            result->meanNs / result->instructions,
+            100.0 * result->stddevNs / result->meanNs);
+    ++resultCount;
+  }
+  if (!resultCount)
+  {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  out = jsonPath ? fopen(jsonPath, "w") : stdout;
+  if (!out)
+  {
+    fprintf(stderr, "cannot create %s\n", jsonPath);
+    return 1;
+  }
+  Bench_WriteJson(out, results, resultCount, repeats, warmups);
+  if (out != stdout)
+    fclose(out);
+  free(results);
+  return 0;
+}
@@ -0,0 +1,348 @@
+#include "breakpoint.h"
+#include "cpu.h"
+#include "log.h"
+#include "memory.h"
+
+#include <string.h>
+
+
+
+u64 bpBitmap[BP_BITMAP_WORDS];
+u64 watchBitmap[BP_BITMAP_WORDS];
+
+/* User breakpoints, in the order they were set */
+internal struct breakpoint bpList[MAX_BREAKPOINTS];
+internal u32    bpCount;
+
+/* A single internal breakpoint used by commands such as 'until'. It
+   only fires when SP is at or above tempMinStackPointer, so a
+   breakpoint on a call's return address ignores recursive calls. */
+internal word_t tempAddress;
+internal word_t tempMinStackPointer;
+internal bool   tempActive;
+
+struct watchpoint
+{
+  word_t address;
+  u16    length;
+};
+
+/* The watch bitmap is rebuilt from this list so overlapping
+   watchpoints can be removed independently */
+internal struct watchpoint watchList[MAX_WATCHPOINTS];
+internal u32               watchCount;
+
+
+internal void
+Bp_SetBit(word_t address)
+{
+  bpBitmap[address >> 6] |= (u64)1 << (address & 63);
+}
+
+internal void
+Bp_ClearBit(word_t address)
+{
+  bpBitmap[address >> 6] &= ~((u64)1 << (address & 63));
+}
+
+internal int
+Bp_Find(word_t address)
+{
+  u32 i;
+
+  for (i = 0; i < bpCount; ++i)
+  {
+    if (bpList[i].address == address)
+      return i;
+  }
+  return -1;
+}
+
+void
+Bp_Init()
+{
+  u32 i;
+
+  for (i = 0; i < BP_BITMAP_WORDS; ++i)
+  {
+    bpBitmap[i]    = 0;
+    watchBitmap[i] = 0;
+  }
+  bpCount    = 0;
+  tempActive = false;
+  watchCount = 0;
+  Mem_EnableWriteHook(MEM_HOOK_WATCH, false);
+}
+
+/*
+  Bp_Set()
+
+  Set a breakpoint at 'address'. Returns false if one already exists
+  there or the breakpoint list is full.
+*/
+bool
+Bp_Set(word_t address)
+{
+  if (Bp_Find(address) >= 0 ||
+      bpCount == MAX_BREAKPOINTS)
+    return false;
+
+  memset(&bpList[bpCount], 0, sizeof(struct breakpoint));
+  bpList[bpCount++].address = address;
+  Bp_SetBit(address);
+  return true;
+}
+
+/*
+  Bp_Clear()
+
+  Remove the breakpoint at 'address'. Returns false if there is none.
+*/
+bool
+Bp_Clear(word_t address)
+{
+  int index;
+
+  index = Bp_Find(address);
+  if (index < 0)
+    return false;
+
+  for (; index < bpCount - 1; ++index)
+    bpList[index] = bpList[index+1];
+  --bpCount;
+
+  if (!tempActive || tempAddress != address)
+    Bp_ClearBit(address);
+  return true;
+}
+
+void
+Bp_ClearAll()
+{
+  while (bpCount)
+    Bp_Clear(bpList[0].address);
+}
+
+/*
+  Bp_SetCondition()
+
+  Compile 'source' as the condition for the breakpoint at
+  'address'. An empty or null condition removes it. Returns false,
+  leaving any previous condition in place, if there is no breakpoint
+  at 'address' or the expression does not compile.
+*/
+bool
+Bp_SetCondition(word_t address, char* source, char** errorMessage)
+{
+  struct expr_program condition;
+  struct breakpoint*  breakpoint;
+  int index;
+
+  index = Bp_Find(address);
+  if (index < 0)
+  {
+    if (errorMessage)
+      *errorMessage = "no breakpoint at that address";
+    return false;
+  }
+  breakpoint = &bpList[index];
+
+  if (!source || !*source)
+  {
+    breakpoint->hasCondition = false;
+    breakpoint->conditionText[0] = '\0';
+    return true;
+  }
+
+  if (!Expr_Compile(source, &condition, errorMessage))
+    return false;
+
+  breakpoint->condition    = condition;
+  breakpoint->hasCondition = true;
+  strncpy(breakpoint->conditionText, source, MAX_BP_CONDITION_LENGTH - 1);
+  breakpoint->conditionText[MAX_BP_CONDITION_LENGTH - 1] = '\0';
+  return true;
+}
+
+/*
+  Bp_SetIgnoreCount()
+
+  Let the breakpoint at 'address' pass the next 'count' times its
+  condition holds.
+*/
+bool
+Bp_SetIgnoreCount(word_t address, u64 count)
+{
+  int index;
+
+  index = Bp_Find(address);
+  if (index < 0)
+    return false;
+  bpList[index].ignoreCount = count;
+  return true;
+}
+
+/*
+  Bp_ShouldStop()
+
+  Called by the run loop when it reaches an address whose bit is set
+  in the bitmap. A user breakpoint counts a hit only when its
+  condition (if any) holds, and then stops unless it is still
+  ignoring hits. The temporary breakpoint always stops.
+*/
+bool
+Bp_ShouldStop(word_t address)
+{
+  struct breakpoint* breakpoint;
+  int index;
+
+  if (tempActive && tempAddress == address &&
+      CPU_GetStackPointer() >= tempMinStackPointer)
+    return true;
+
+  index = Bp_Find(address);
+  if (index < 0)
+    return false;
+  breakpoint = &bpList[index];
+
+  if (breakpoint->hasCondition &&
+      !Expr_Evaluate(&breakpoint->condition))
+    return false;
+
+  ++breakpoint->hitCount;
+  if (breakpoint->ignoreCount)
+  {
+    --breakpoint->ignoreCount;
+    return false;
+  }
+  return true;
+}
+
+/*
+  Bp_Matches()
+
+  Like Bp_ShouldStop() but without counting a hit or consuming an
+  ignore count; used when searching backwards through history.
+*/
+bool
+Bp_Matches(word_t address)
+{
+  int index;
+
+  if (tempActive && tempAddress == address &&
+      CPU_GetStackPointer() >= tempMinStackPointer)
+    return true;
+
+  index = Bp_Find(address);
+  if (index < 0)
+    return false;
+  return !bpList[index].hasCondition ||
+         Expr_Evaluate(&bpList[index].condition);
+}
+
+u32
+Bp_GetCount()
+{
+  return bpCount;
+}
+
+const struct breakpoint*
+Bp_Get(u32 index)
+{
+  return &bpList[index];
+}
+
+/*
+  Bp_SetTemporary()
+
+  Set the internal breakpoint, which only fires while SP is at least
+  'minStackPointer' (pass 0 for no limit). It coexists with any user
+  breakpoint at the same address and is removed by
+  Bp_ClearTemporary().
+*/
+void
+Bp_SetTemporary(word_t address, word_t minStackPointer)
+{
+  Bp_ClearTemporary();
+  tempAddress         = address;
+  tempMinStackPointer = minStackPointer;
+  tempActive          = true;
+  Bp_SetBit(address);
+}
+
+void
+Bp_ClearTemporary()
+{
+  if (!tempActive)
+    return;
+
+  tempActive = false;
+  if (Bp_Find(tempAddress) < 0)
+    Bp_ClearBit(tempAddress);
+}
+
+internal void
+Bp_RebuildWatchBitmap()
+{
+  u32 i;
+
+  memset(watchBitmap, 0, sizeof(watchBitmap));
+  for (i = 0; i < watchCount; ++i)
+  {
+    u32 address = watchList[i].address;
+    u32 end     = address + watchList[i].length;
+
+    for (; address < end && address < 0x10000; ++address)
+      watchBitmap[address >> 6] |= (u64)1 << (address & 63);
+  }
+  Mem_EnableWriteHook(MEM_HOOK_WATCH, watchCount != 0);
+}
+
+/*
+  Bp_SetWatch()
+
+  Stop the CPU after any instruction that writes to the 'length'
+  bytes at 'address'.
+*/
+bool
+Bp_SetWatch(word_t address, u16 length)
+{
+  if (watchCount == MAX_WATCHPOINTS || length == 0)
+    return false;
+
+  watchList[watchCount].address  = address;
+  watchList[watchCount].length   = length;
+  ++watchCount;
+  Bp_RebuildWatchBitmap();
+  return true;
+}
+
+bool
+Bp_ClearWatch(word_t address, u16 length)
+{
+  u32 i;
+
+  for (i = 0; i < watchCount; ++i)
+  {
+    if (watchList[i].address == address &&
+        watchList[i].length == length)
+    {
+      watchList[i] = watchList[--watchCount];
+      Bp_RebuildWatchBitmap();
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  Bp_NotifyWrite()
+
+  Called by the memory write hook before a byte is written.
+*/
+void
+Bp_NotifyWrite(word_t address)
+{
+  if (Bp_IsWatched(address))
+    CPU_WatchTriggered(address);
+}
@@ -0,0 +1,98 @@
+#ifndef __BREAKPOINT_H__
+#define __BREAKPOINT_H__
+#pragma once
+
+
+#include "expr.h"
+#include "types.h"
+
+
+/*
+  Breakpoints are kept in a bitmap with one bit per address in the
+  8080's 64K address space, so the run loop can test for one with a
+  single bit test per instruction. Only when the bit is set does it
+  call Bp_ShouldStop() to apply conditions and ignore counts.
+
+  Write watchpoints work the same way with a second bitmap, tested by
+  the memory write hook.
+*/
+
+#define BP_BITMAP_WORDS         (0x10000 / 64)
+#define MAX_BREAKPOINTS         64
+#define MAX_BP_CONDITION_LENGTH 64
+#define MAX_WATCHPOINTS         16
+
+struct breakpoint
+{
+  word_t              address;
+  u64                 hitCount;
+  u64                 ignoreCount;
+  bool                hasCondition;
+  struct expr_program condition;
+  char                conditionText[MAX_BP_CONDITION_LENGTH];
+};
+
+extern u64 bpBitmap[BP_BITMAP_WORDS];
+extern u64 watchBitmap[BP_BITMAP_WORDS];
+
+
+internal inline bool
+Bp_IsSet(word_t address)
+{
+  return (bpBitmap[address >> 6] >> (address & 63)) & 1;
+}
+
+internal inline bool
+Bp_IsWatched(word_t address)
+{
+  return (watchBitmap[address >> 6] >> (address & 63)) & 1;
+}
+
+
+void
+Bp_Init();
+
+bool
+Bp_Set(word_t address);
+
+bool
+Bp_Clear(word_t address);
+
+void
+Bp_ClearAll();
+
+bool
+Bp_SetCondition(word_t address, char* source, char** errorMessage);
+
+bool
+Bp_SetIgnoreCount(word_t address, u64 count);
+
+bool
+Bp_ShouldStop(word_t address);
+
+bool
+Bp_Matches(word_t address);
+
+u32
+Bp_GetCount();
+
+const struct breakpoint*
+Bp_Get(u32 index);
+
+void
+Bp_SetTemporary(word_t address, word_t minStackPointer);
+
+void
+Bp_ClearTemporary();
+
+bool
+Bp_SetWatch(word_t address, u16 length);
+
+bool
+Bp_ClearWatch(word_t address, u16 length);
+
+void
+Bp_NotifyWrite(word_t address);
+
+
+#endif    /* __BREAKPOINT_H__ */
@@ -47,9 +47,7 @@ bit_t GetBit(byte_t data, u8 bitPosition) {
 
 void SetBit(byte_t *data, u8 bitPosition, bit_t value) {
 
-#ifdef _DEBUG
-  Log_Debug("SetBit: bitPosition=%u value=%u", bitPosition, value);
-#endif
+  LOG_TRACE(LOG_CAT_ALU, "SetBit: bitPosition=%u value=%u", bitPosition, value);
 
   if (value == 0)
     *data &= ~(1 << bitPosition);
@@ -1,7 +1,16 @@
+#include "breakpoint.h"
 #include "cpu.h"
+#include "history.h"
 #include "instructions.h"
+#include "io.h"
 #include "log.h"
 #include "memory.h"
+#include "metrics.h"
+#include "profile.h"
+#include "sched.h"
+#include "trace.h"
+
+#include <string.h>
 
 
 internal byte_t *memory;
@@ -9,12 +18,55 @@ internal struct registers regs;
 internal struct instruction* g_currentInstruction = 0;
 internal u64 g_cycleCount = 0;
 
+/* The cycle count at which the current CPU_Run() batch ends; either
+   the next scheduled event or the caller's limit */
+internal volatile u64  g_runDeadline   = 0;
+internal volatile bool g_stopRequested = false;
+/* Set for the duration of CPU_Run(); read by signal handlers */
+internal volatile bool g_running       = false;
+
+/* See CPU_SetHostPoll() */
+internal cpu_host_poll_t g_hostPoll;
+internal u64             g_hostPollCycles;
+
+/* INTE flip-flop and the STOPPED state entered by HLT */
+internal bool g_interruptsEnabled = false;
+internal bool g_halted            = false;
+
+/* A return that leaves SP above this ends the current CPU_Run()
+   (see CPU_SetReturnWatch()) */
+internal u32  g_returnWatchSP    = CPU_NO_RETURNWATCH;
+internal bool g_returnWatchFired = false;
+/* Set by a write to a watched address during CPU_Run() */
+internal bool   g_watchFired   = false;
+internal word_t g_watchAddress = 0;
+
+/* CPU_HOOK_* bits; tested once per instruction */
+internal u32 g_instructionHooks = 0;
+
+/* Indexed by opcode; always counted, as it costs two increments.
+   Poll loop iterations skipped by CPU_SkipPollLoop() and the RSTs of
+   interrupts are included */
+internal struct cpu_opcode_counts g_opcodeCounts[256];
+/* Instructions counted before the last CPU_ResetOpcodeCounts() */
+internal u64 g_retiredBase;
+internal struct cpu_interrupt_counts g_interruptCounts;
+/* Hooks and counts put back by CPU_EndReplay() */
+internal u32 g_replayHooks;
+internal struct cpu_opcode_counts g_replayOpcodeCounts[256];
+internal struct cpu_interrupt_counts g_replayInterruptCounts;
+
 #define FLIPENDIAN_WORD(w) ((w << 8) | (w >>8))
 #define MAKEWORD(a,b)      ((a << 8) | (b))
 
 internal void
 CPU_SetProgramCounter(word_t address);
 
+internal void
+CPU_PushProgramCounter(void);
+
+extern struct instruction instruction_set[256];
+
 
 internal reg8_t*
 CPU_GetRegPointer(u8 reg)
@@ -76,9 +128,7 @@ CPU_SetRegValue(reg8_t reg, byte_t value)
 internal reg16_t*
 CPU_GetRegPairPointer(u8 regPair)
 {
-#ifdef _DEBUG
-  Log_Debug("CPU_GetRegPairPointer: regPair=%u", regPair);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "CPU_GetRegPairPointer: regPair=%u", regPair);
   switch (regPair)
   {
   case REGPAIR_BC:
@@ -119,9 +169,7 @@ CPU_GetRegPairPointer(u8 regPair)
 word_t
 CPU_GetRegPairValue(u8 regPair)
 {
-#ifdef _DEBUG
-  Log_Debug("CPU_GetRegPairValue: regPair=%u", regPair);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "CPU_GetRegPairValue: regPair=%u", regPair);
   return *CPU_GetRegPairPointer(regPair);
 }
 
@@ -200,9 +248,7 @@ ALU_Adder(byte_t* byte, u8 addend, u8 flagsAffected)
   byte_t sum   = 0;
   bit_t  carry = 0;
 
-#ifdef _DEBUG
-      Log_Debug("ALU_Adder: Entering...");
-#endif
+  LOG_TRACE(LOG_CAT_ALU, "ALU_Adder: Entering...");
 
   for (bitIndex = 0;
        bitIndex < 8;
@@ -218,29 +264,21 @@ ALU_Adder(byte_t* byte, u8 addend, u8 flagsAffected)
 
     sum += tempBit << bitIndex;
 
-#ifdef _DEBUG
-      Log_Debug("ALU_Adder: bitIndex=%x", bitIndex);
-#endif
+    LOG_TRACE(LOG_CAT_ALU, "ALU_Adder: bitIndex=%x", bitIndex);
     if (bitIndex == 3 && 
         (flagsAffected & FLG_AUXCRY))
     {
-#ifdef _DEBUG
-      Log_Debug("ALU_Adder: FLG_AUXCRY=%x", carry);
-#endif
+      LOG_TRACE(LOG_CAT_ALU, "ALU_Adder: FLG_AUXCRY=%x", carry);
       CPU_SetFlag(FLG_AUXCRY, carry);
     }
   }
   *byte = sum;
 
-#ifdef _DEBUG
-      Log_Debug("ALU_Adder: FLG_CARRY=%x", carry);
-      Log_Debug("ALU_Adder: FLG_SIGN=%x", IsSigned(*byte));
-#endif
+  LOG_TRACE(LOG_CAT_ALU, "ALU_Adder: FLG_CARRY=%x", carry);
+  LOG_TRACE(LOG_CAT_ALU, "ALU_Adder: FLG_SIGN=%x", IsSigned(*byte));
   if (flagsAffected & FLG_CARRY)
   {
-#ifdef _DEBUG
-      Log_Debug("ALU_Adder: flagsAffected | FLG_CARRY=%x", flagsAffected | FLG_CARRY);
-#endif
+    LOG_TRACE(LOG_CAT_ALU, "ALU_Adder: flagsAffected | FLG_CARRY=%x", flagsAffected | FLG_CARRY);
     CPU_SetFlag(FLG_CARRY, carry);
   }
   if (flagsAffected & FLG_SIGN)
@@ -274,8 +312,8 @@ ALU_LogicalAND(byte_t* byte, byte_t data, byte_t flags)
 {
   *byte &= data;
 
-  if (flags & FLG_ZERO && *byte == 0)
-    CPU_SetFlag(FLG_ZERO, 1);
+  if (flags & FLG_ZERO)
+    CPU_SetFlag(FLG_ZERO, *byte == 0);
   if (flags & FLG_SIGN)
     CPU_SetFlag(FLG_SIGN, (*byte & 0x80) >> 7);
   if (flags & FLG_PARITY)
@@ -449,7 +487,7 @@ Execute_ANI(void)
 internal void
 Execute_CALL(void)
 {
-  Execute_PUSH(CPU_GetProgramCounter());
+  CPU_PushProgramCounter();
   Execute_JMP();
 }
 
@@ -461,11 +499,15 @@ Execute_CALL(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CC(void)
 {
   if (CPU_GetFlag(FLG_CARRY))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -476,11 +518,15 @@ Execute_CC(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CM(void)
 {
   if (CPU_GetFlag(FLG_SIGN))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -543,11 +589,15 @@ Execute_CMP(byte_t data)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CNC(void)
 {
-  if (!CPU_GetFlag(FLG_ZERO))
+  if (!CPU_GetFlag(FLG_CARRY))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -558,11 +608,15 @@ Execute_CNC(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CNZ(void)
 {
   if (!CPU_GetFlag(FLG_ZERO))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -573,11 +627,15 @@ Execute_CNZ(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CP(void)
 {
   if (!CPU_GetFlag(FLG_SIGN))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -588,11 +646,15 @@ Execute_CP(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CPE(void)
 {
   if (CPU_GetFlag(FLG_PARITY))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -612,9 +674,7 @@ Execute_CPI(void)
   temp = regs.A;
   data = Mem_ReadByte(regs.PC - g_currentInstruction->byteCount + 1);
 
-#ifdef _DEBUG
-  Log_Debug("Execute_CPI: temp=0x%02x data=0x%02x", temp, data);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_CPI: temp=0x%02x data=0x%02x", temp, data);
   ALU_Subtract(&temp, data, FLG_CARRY | FLG_ZERO | FLG_SIGN | FLG_PARITY | FLG_AUXCRY);
 }
 
@@ -626,11 +686,15 @@ Execute_CPI(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CPO(void)
 {
   if (!CPU_GetFlag(FLG_PARITY))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -641,11 +705,15 @@ Execute_CPO(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_CZ(void)
 {
   if (CPU_GetFlag(FLG_ZERO))
+  {
     Execute_CALL();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -687,9 +755,7 @@ Execute_DAD(word_t data)
   byte_t *dst;
   byte_t *dstHi, *dstLow;
 
-#ifdef _DEBUG
-  Log_Debug("Execute_DAD: data=0x%04x", data);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_DAD: data=0x%04x", data);
   srcLow = (byte_t)data;
   srcHi  = (byte_t)(data >> 8);
   dst = (byte_t*)CPU_GetRegPairPointer(REGPAIR_HL);
@@ -729,9 +795,7 @@ Execute_DCX(reg16_t reg)
   word_t *dst;
   byte_t *byteHi, *byteLow;
 
-#ifdef _DEBUG
-  Log_Debug("Execute_DCX: reg=0x%02x", reg);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_DCX: reg=0x%02x", reg);
   dst     = CPU_GetRegPairPointer(reg);
   byteHi  = (byte_t*)dst;
   byteLow = byteHi+1;
@@ -761,7 +825,7 @@ Execute_DCX(reg16_t reg)
 internal void
 Execute_DI(void)
 {
-  abort();
+  g_interruptsEnabled = false;
 }
 
 /*
@@ -775,7 +839,7 @@ Execute_DI(void)
 internal void
 Execute_EI(void)
 {
-  abort();
+  g_interruptsEnabled = true;
 }
 
 /*
@@ -789,7 +853,114 @@ Execute_EI(void)
 internal void
 Execute_HLT(void)
 {
-  abort();
+  g_halted = true;
+
+  /* End the current batch; CPU_Run() decides whether to fast-forward
+     or hand control back */
+  g_runDeadline = 0;
+}
+
+/*
+  CPU_SkipPollLoop()
+
+  Busy-wait loops of the form
+
+      loop:  IN   port
+             ANI  mask        (or CPI value)
+             JZ   loop        (or JNZ)
+
+  have no effect other than on A and the flags, which come out the
+  same every iteration while the port's value is unchanged. For a
+  pollable port that value can only change when a scheduled event
+  runs, so every whole iteration that fits before the current run
+  deadline is skipped by advancing the cycle count. The current
+  iteration still executes normally, leaving the registers and cycle
+  count exactly as if every iteration had run.
+
+  Called from Execute_IN() with the address of the IN and the value it
+  read, before the IN's own cycles are counted.
+*/
+internal void
+CPU_SkipPollLoop(word_t loopAddress, byte_t port, byte_t value)
+{
+  byte_t testOpcode;
+  byte_t testOperand;
+  byte_t jumpOpcode;
+  bool   zero;
+  bool   repeats;
+  u64    iterationCycles;
+  u64    iterations;
+
+  if (!IO_IsPollable(port) ||
+      g_runDeadline <= g_cycleCount)
+    return;
+
+  /* Each pass through a breakpoint inside the loop has to stop */
+  if (Bp_IsSet(loopAddress)     ||
+      Bp_IsSet(loopAddress + 2) ||
+      Bp_IsSet(loopAddress + 4))
+    return;
+
+  testOpcode  = Mem_ReadByte(loopAddress + 2);
+  testOperand = Mem_ReadByte(loopAddress + 3);
+  jumpOpcode  = Mem_ReadByte(loopAddress + 4);
+  if (Mem_ReadWord(loopAddress + 5) != loopAddress)
+    return;
+
+  switch (testOpcode)
+  {
+  case 0xe6: /* ANI */
+    {
+      zero = (value & testOperand) == 0;
+      break;
+    }
+  case 0xfe: /* CPI */
+    {
+      zero = (value == testOperand);
+      break;
+    }
+  default:
+    return;
+  }
+
+  switch (jumpOpcode)
+  {
+  case 0xca: /* JZ */
+    {
+      repeats = zero;
+      break;
+    }
+  case 0xc2: /* JNZ */
+    {
+      repeats = !zero;
+      break;
+    }
+  default:
+    return;
+  }
+  if (!repeats)
+    return;
+
+  iterationCycles =
+    instruction_set[0xdb].cycleCount[CYCLE_COUNT_SHORT] +
+    instruction_set[testOpcode].cycleCount[CYCLE_COUNT_SHORT] +
+    instruction_set[jumpOpcode].cycleCount[CYCLE_COUNT_LONG];
+  iterations = (g_runDeadline - g_cycleCount) / iterationCycles;
+  if (iterations > 1)
+  {
+    u64 skipped = iterations - 1;
+
+    LOG_DEBUG(LOG_CAT_CPU, "CPU_SkipPollLoop: loop=0x%04x port=0x%02x skipping %llu iterations",
+              loopAddress, port, (unsigned long long)skipped);
+    g_cycleCount += skipped * iterationCycles;
+
+    /* Counted as if they had run, so statistics add up to the cycle
+       count */
+    g_opcodeCounts[0xdb].executed       += skipped;
+    g_opcodeCounts[testOpcode].executed += skipped;
+    g_opcodeCounts[jumpOpcode].executed += skipped;
+    g_opcodeCounts[jumpOpcode].taken    += skipped;
+  }
 }
 
 /*
@@ -803,7 +974,11 @@ Execute_HLT(void)
 internal void
 Execute_IN(void)
 {
-  abort();
+  byte_t port;
+
+  port   = CPU_GetOperandByte();
+  regs.A = IO_Read(port);
+  CPU_SkipPollLoop(regs.PC - g_currentInstruction->byteCount, port, regs.A);
 }
 
 /*
@@ -834,9 +1009,7 @@ Execute_INX(reg16_t reg)
   word_t *dst;
   byte_t *byteHi, *byteLow;
 
-#ifdef _DEBUG
-  Log_Debug("Execute_INX: reg=0x%02x", reg);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_INX: reg=0x%02x", reg);
   dst     = CPU_GetRegPairPointer(reg);
   byteHi  = (byte_t*)dst;
   byteLow = byteHi+1;
@@ -864,11 +1037,15 @@ Execute_INX(reg16_t reg)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JC(void)
 {
   if (CPU_GetFlag(FLG_CARRY))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -879,11 +1056,15 @@ Execute_JC(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JM(void)
 {
   if (CPU_GetFlag(FLG_SIGN))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -908,11 +1089,15 @@ Execute_JMP()
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JNC(void)
 {
   if (!CPU_GetFlag(FLG_CARRY))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -923,11 +1108,15 @@ Execute_JNC(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JNZ(void)
 {
   if (!CPU_GetFlag(FLG_ZERO))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -938,11 +1127,15 @@ Execute_JNZ(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JP(void)
 {
   if (!CPU_GetFlag(FLG_SIGN))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -953,11 +1146,15 @@ Execute_JP(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JPE(void)
 {
   if (CPU_GetFlag(FLG_PARITY))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -968,11 +1165,15 @@ Execute_JPE(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JPO(void)
 {
   if (!CPU_GetFlag(FLG_PARITY))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -983,11 +1184,15 @@ Execute_JPO(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_JZ(void)
 {
   if (CPU_GetFlag(FLG_ZERO))
+  {
     Execute_JMP();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1034,9 +1239,7 @@ Execute_LHLD(void)
   word_t address;
 
   address = CPU_GetOperandWord();
-#ifdef _DEBUG
-  Log_Debug("Execute_LHLD: address=0x%04x", address);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_LHLD: address=0x%04x", address);
   regs.L = Mem_ReadByte(address);
   regs.H = Mem_ReadByte(address+1);
 }
@@ -1157,7 +1360,7 @@ Execute_ORI(void)
 internal void
 Execute_OUT(void)
 {
-  abort();
+  IO_Write(CPU_GetOperandByte(), regs.A);
 }
 
 /*
@@ -1219,15 +1422,27 @@ Execute_PUSH(reg16_t reg)
   hiByte  = (byte_t*)CPU_GetRegPairPointer(reg);
   lowByte = hiByte + 1;
 
-#ifdef _DEBUG
-  Log_Debug("Execute_PUSH: hiByte=0x%02x lowByte=0x%02x", *hiByte, *lowByte);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_PUSH: hiByte=0x%02x lowByte=0x%02x", *hiByte, *lowByte);
 
   Mem_WriteByte(regs.SP-1, *hiByte);
   Mem_WriteByte(regs.SP-2, *lowByte);
   regs.SP -= 2;
 }
 
+/*
+  Push the program counter as a return address: high byte at SP-1,
+  low byte at SP-2, so it reads back as a word from SP. PC is a host
+  word rather than a pair of 8080 registers, so Execute_PUSH() would
+  store it the wrong way round.
+*/
+internal void
+CPU_PushProgramCounter(void)
+{
+  Mem_WriteByte(regs.SP-1, regs.PC >> 8);
+  Mem_WriteByte(regs.SP-2, regs.PC & 0xff);
+  regs.SP -= 2;
+}
+
 /*
   RAL - Rotate Accumulator Left Through Carry
 
@@ -1243,9 +1458,7 @@ Execute_RAL(void)
   bit_t highBit;
 
   highBit = GetBit(regs.A, 7);
-#ifdef _DEBUG
-  Log_Debug("Execute_RAL: highBit=%u", highBit);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_RAL: highBit=%u", highBit);
 
   regs.A <<=  1;
   SetBit(&regs.A, 7, CPU_GetFlag(FLG_CARRY));
@@ -1267,9 +1480,7 @@ Execute_RAR(void)
   bit_t lowBit;
 
   lowBit = GetBit(regs.A, 0);
-#ifdef _DEBUG
-  Log_Debug("Execute_RAL: lowBit=%u", lowBit);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_RAL: lowBit=%u", lowBit);
 
   regs.A >>=  1;
   SetBit(&regs.A, 7, CPU_GetFlag(FLG_CARRY));
@@ -1283,11 +1494,15 @@ Execute_RAR(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RC(void)
 {
   if (CPU_GetFlag(FLG_CARRY))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1300,10 +1515,14 @@ Execute_RC(void)
 internal void
 Execute_RET(void)
 {
-  word_t retAddress;
-  retAddress = Mem_ReadWord(CPU_GetRegPairValue(REG_SP));
-  CPU_SetProgramCounter(FLIPENDIAN_WORD(retAddress));
+  CPU_SetProgramCounter(Mem_ReadWord(regs.SP));
   regs.SP += 2;
+
+  if (regs.SP > g_returnWatchSP)
+  {
+    g_returnWatchFired = true;
+    g_runDeadline      = 0;
+  }
 }
 
 /*
@@ -1322,9 +1541,7 @@ Execute_RLC(void)
   bit_t highBit;
 
   highBit = GetBit(regs.A, 7);
-#ifdef _DEBUG
-  Log_Debug("Execute_RLC: highBit=%u", highBit);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_RLC: highBit=%u", highBit);
 
   regs.A <<=  1;
   SetBit(&regs.A, 0, highBit);
@@ -1339,11 +1556,15 @@ Execute_RLC(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RM(void)
 {
   if (CPU_GetFlag(FLG_SIGN))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1353,11 +1574,15 @@ Execute_RM(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RNC(void)
 {
   if (!CPU_GetFlag(FLG_CARRY))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1367,11 +1592,15 @@ Execute_RNC(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RNZ()
 {
   if (!CPU_GetFlag(FLG_ZERO))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1382,11 +1611,15 @@ Execute_RNZ()
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RP(void)
 {
   if (!CPU_GetFlag(FLG_SIGN))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 
@@ -1398,11 +1631,15 @@ Execute_RP(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RPE(void)
 {
   if (CPU_GetFlag(FLG_PARITY))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1413,11 +1650,15 @@ Execute_RPE(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RPO(void)
 {
   if (!CPU_GetFlag(FLG_PARITY))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1436,9 +1677,7 @@ Execute_RRC(void)
   bit_t lowBit;
 
   lowBit = GetBit(regs.A, 0);
-#ifdef _DEBUG
-  Log_Debug("Execute_RRC: lowBit=%u", lowBit);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_RRC: lowBit=%u", lowBit);
   regs.A >>=  1;
   SetBit(&regs.A, 7, lowBit);
   CPU_SetFlag(FLG_CARRY, lowBit);
@@ -1448,20 +1687,20 @@ Execute_RRC(void)
   RST - Restart
   
   The contents of the program counter are pushed onto the stack,
-  providing a return address for later use by a RETURN instruction.
+  providing a return address for later use by a RETURN
+  instruction. Program execution continues at eight times the restart
+  number encoded in bits 3-5 of the opcode.
   
   Flags: None
 */
 internal void
 Execute_RST(void)
 {
-  byte_t operand;
-  word_t jumpAddress;
+  byte_t opcode;
   
-  operand = (CPU_GetOperandByte() & (7 << 3)) >> 3;
-  jumpAddress = (operand << 4) | 0x000b;
-  Execute_PUSH(CPU_GetProgramCounter());
-  CPU_SetProgramCounter(jumpAddress);
+  opcode = Mem_ReadByte(CPU_GetProgramCounter() - 1);
+  CPU_PushProgramCounter();
+  CPU_SetProgramCounter(opcode & 0x38);
 }
 
 /*
@@ -1471,11 +1710,15 @@ Execute_RST(void)
   
   Flags: None
 */
-internal void
+internal bool
 Execute_RZ(void)
 {
   if (CPU_GetFlag(FLG_ZERO))
+  {
     Execute_RET();
+    return true;
+  }
+  return false;
 }
 
 /*
@@ -1528,9 +1771,7 @@ Execute_SHLD(void)
   word_t address;
 
   address = CPU_GetOperandWord();
-#ifdef _DEBUG
-  Log_Debug("Execute_SHLD: address=0x%04x", address);
-#endif
+  LOG_TRACE(LOG_CAT_CPU, "Execute_SHLD: address=0x%04x", address);
   Mem_WriteByte(address,   CPU_GetRegValue(REG_L));
   Mem_WriteByte(address+1, CPU_GetRegValue(REG_H));
 }
@@ -2248,6 +2489,11 @@ CPU_Execute(void)
     TODO: My God, this is ugly. Fix it?
   */
   struct execute_params* params = &g_currentInstruction->executeParams;
+
+  /* Conditional instructions set this to whether their action was
+     taken, selecting the matching cycle count without a branch */
+  u8 cycleIndex = CYCLE_COUNT_SHORT;
+
   switch (params->instructionType)
   {
 
@@ -2325,13 +2571,13 @@ CPU_Execute(void)
 
   case INSTR_CC:
     {
-      Execute_CC();
+      cycleIndex = Execute_CC();
       break;
     }
 
   case INSTR_CM:
     {
-      Execute_CM();
+      cycleIndex = Execute_CM();
       break;
     }
 
@@ -2365,25 +2611,25 @@ CPU_Execute(void)
 
   case INSTR_CNC:
     {
-      Execute_CNC();
+      cycleIndex = Execute_CNC();
       break;
     }
 
   case INSTR_CNZ:
     {
-      Execute_CNZ();
+      cycleIndex = Execute_CNZ();
       break;
     }
 
   case INSTR_CP:
     {
-      Execute_CP();
+      cycleIndex = Execute_CP();
       break;
     }
 
   case INSTR_CPE:
     {
-      Execute_CPE();
+      cycleIndex = Execute_CPE();
       break;
     }
 
@@ -2395,13 +2641,13 @@ CPU_Execute(void)
 
   case INSTR_CPO:
     {
-      Execute_CPO();
+      cycleIndex = Execute_CPO();
       break;
     }
 
   case INSTR_CZ:
     {
-      Execute_CZ();
+      cycleIndex = Execute_CZ();
       break;
     }
 
@@ -2492,13 +2738,13 @@ CPU_Execute(void)
 
   case INSTR_JC:
     {
-      Execute_JC();
+      cycleIndex = Execute_JC();
       break;
     }
 
   case INSTR_JM:
     {
-      Execute_JM();
+      cycleIndex = Execute_JM();
       break;
     }
 
@@ -2510,37 +2756,37 @@ CPU_Execute(void)
 
   case INSTR_JNC:
     {
-      Execute_JNC();
+      cycleIndex = Execute_JNC();
       break;
     }
 
   case INSTR_JNZ:
     {
-      Execute_JNZ();
+      cycleIndex = Execute_JNZ();
       break;
     }
 
   case INSTR_JP:
     {
-      Execute_JP();
+      cycleIndex = Execute_JP();
       break;
     }
 
   case INSTR_JPE:
     {
-      Execute_JPE();
+      cycleIndex = Execute_JPE();
       break;
     }
 
   case INSTR_JPO:
     {
-      Execute_JPO();
+      cycleIndex = Execute_JPO();
       break;
     }
 
   case INSTR_JZ:
     {
-      Execute_JZ();
+      cycleIndex = Execute_JZ();
       break;
     }
 
@@ -2635,6 +2881,7 @@ CPU_Execute(void)
   case INSTR_ORI:
     {
       Execute_ORI();
+      break;
     }
 
   case INSTR_OUT:
@@ -2677,7 +2924,7 @@ CPU_Execute(void)
 
   case INSTR_RC:
     {
-      Execute_RC();
+      cycleIndex = Execute_RC();
       break;
     }
 
@@ -2695,37 +2942,37 @@ CPU_Execute(void)
 
   case INSTR_RM:
     {
-      Execute_RM();
+      cycleIndex = Execute_RM();
       break;
     }
 
   case INSTR_RNC:
     {
-      Execute_RNC();
+      cycleIndex = Execute_RNC();
       break;
     }
 
   case INSTR_RNZ:
     {
-      Execute_RNZ();
+      cycleIndex = Execute_RNZ();
       break;
     }
 
   case INSTR_RP:
     {
-      Execute_RP();
+      cycleIndex = Execute_RP();
       break;
     }
 
   case INSTR_RPE:
     {
-      Execute_RPE();
+      cycleIndex = Execute_RPE();
       break;
     }
 
   case INSTR_RPO:
     {
-      Execute_RPO();
+      cycleIndex = Execute_RPO();
       break;
     }
 
@@ -2743,7 +2990,7 @@ CPU_Execute(void)
 
   case INSTR_RZ:
     {
-      Execute_RZ();
+      cycleIndex = Execute_RZ();
       break;
     }
 
@@ -2871,9 +3118,13 @@ CPU_Execute(void)
 
   }
 
-  /* TODO: The CPU should "sleep" long enough to simulate the actual
-     8080 CPU clock */
-  g_cycleCount += g_currentInstruction->cycleCount[CYCLE_COUNT_SHORT];
+  g_cycleCount += g_currentInstruction->cycleCount[cycleIndex];
+
+  {
+    struct cpu_opcode_counts* counts = &g_opcodeCounts[g_currentInstruction - instruction_set];
+    ++counts->executed;
+    counts->taken += cycleIndex;
+  }
 }
 
 void
@@ -2884,16 +3135,449 @@ CPU_Init(byte_t* memoryBlock)
   regs.SP = 0x100;
 }
 
+/*
+  Run whichever per-instruction hooks are enabled. Kept out of line so
+  the common case costs a single test in CPU_DoInstructionCycle().
+*/
+internal void
+CPU_RunInstructionHooks(void)
+{
+  if (g_instructionHooks & CPU_HOOK_HISTORY)
+    Hist_BeginInstruction();
+  if (g_instructionHooks & CPU_HOOK_TRACE)
+    Trace_RecordInstruction();
+  if (g_instructionHooks & CPU_HOOK_PROFILE)
+    Prof_BeginInstruction();
+}
+
 void
 CPU_DoInstructionCycle(void)
 {
   byte_t opcode;
+
+  if (g_instructionHooks)
+    CPU_RunInstructionHooks();
+
   CPU_Fetch(&opcode);
   CPU_Decode(opcode);
   CPU_AdvancePC();
   CPU_Execute();
 }
 
+/*
+  CPU_Step()
+
+  Execute a single instruction, then run any scheduled events that
+  have become due. A halted CPU instead skips ahead to the next
+  scheduled event, provided an interrupt could wake it.
+*/
+void
+CPU_Step(void)
+{
+  if (g_halted)
+  {
+    u64 deadline = Sched_GetNextDeadline();
+    if (!g_interruptsEnabled || deadline == SCHED_NO_EVENT)
+      return;
+    if (g_cycleCount < deadline)
+      g_cycleCount = deadline;
+  }
+  else
+  {
+    CPU_DoInstructionCycle();
+  }
+
+  if (g_cycleCount >= Sched_GetNextDeadline())
+    Sched_RunDue(g_cycleCount);
+}
+
+/*
+  CPU_Run()
+
+  Execute instructions until the cycle count reaches 'cycleLimit' or a
+  stop is requested. The inner loop only compares against the next
+  deadline; scheduled events are run in batches between runs of
+  instructions.
+
+  While the CPU is halted with interrupts enabled, the cycle count
+  jumps straight to the next scheduled event instead of spinning. A
+  halt that nothing can interrupt returns CPU_STOP_HALTED.
+
+  Breakpoints are tested after each instruction, so a run started at a
+  breakpoint's address does not stop there immediately.
+*/
+u8
+CPU_Run(u64 cycleLimit)
+{
+  u8   stopReason;
+  bool exporting;
+  u64  batchCycles;
+
+  /* A watchpoint hit while single stepping is not a reason to stop,
+     and neither is a stop requested while no run was in progress */
+  g_watchFired    = false;
+  g_stopRequested = false;
+  g_running       = true;
+  exporting       = Metrics_IsExporting();
+  Metrics_EnterRun();
+
+  /* Longest batch allowed between host-side checks, or 0 for none */
+  batchCycles = exporting ? METRICS_CHECK_CYCLES : 0;
+  if (g_hostPoll && (!batchCycles || g_hostPollCycles < batchCycles))
+    batchCycles = g_hostPollCycles;
+
+  for (;;)
+  {
+    u64 deadline;
+
+    deadline = Sched_GetNextDeadline();
+    if (deadline > cycleLimit)
+      deadline = cycleLimit;
+    g_runDeadline = deadline;
+    /* Only the batch is shortened for the host-side checks; a halted
+       CPU still skips ahead to the real deadline */
+    if (batchCycles && deadline > g_cycleCount + batchCycles)
+      g_runDeadline = g_cycleCount + batchCycles;
+
+    /* Checked after the deadline is published so a stop requested
+       from a signal handler is never lost */
+    if (g_stopRequested)
+    {
+      g_stopRequested = false;
+      stopReason = CPU_STOP_REQUESTED;
+      break;
+    }
+
+    if (g_halted)
+    {
+      if (!g_interruptsEnabled ||
+          deadline == CPU_NO_CYCLELIMIT)
+      {
+        stopReason = CPU_STOP_HALTED;
+        break;
+      }
+      if (g_cycleCount < deadline)
+        g_cycleCount = deadline;
+    }
+    else
+    {
+      bool breakpointHit = false;
+
+      while (g_cycleCount < g_runDeadline)
+      {
+        CPU_DoInstructionCycle();
+        if (Bp_IsSet(regs.PC) &&
+            Bp_ShouldStop(regs.PC))
+        {
+          breakpointHit = true;
+          break;
+        }
+      }
+
+      /* Any events that came due are left for the next run so the
+         CPU is stopped exactly at the breakpoint or return */
+      if (g_watchFired)
+      {
+        g_watchFired = false;
+        stopReason = CPU_STOP_WATCHPOINT;
+        break;
+      }
+      if (breakpointHit)
+      {
+        stopReason = CPU_STOP_BREAKPOINT;
+        break;
+      }
+      if (g_returnWatchFired)
+      {
+        g_returnWatchFired = false;
+        stopReason = CPU_STOP_RETURNED;
+        break;
+      }
+    }
+
+    Sched_RunDue(g_cycleCount);
+    if (exporting)
+      Metrics_PollExport();
+    if (g_hostPoll)
+      g_hostPoll();
+
+    if (g_cycleCount >= cycleLimit &&
+        !g_stopRequested)
+    {
+      stopReason = CPU_STOP_CYCLELIMIT;
+      break;
+    }
+  }
+
+  /* Outside of CPU_Run() there is no batch for instructions to
+     shorten or fast-forward to */
+  g_runDeadline = 0;
+  g_running     = false;
+  Metrics_LeaveRun();
+  return stopReason;
+}
+
+/*
+  CPU_SetHostPoll()
+
+  Have CPU_Run() call 'poll' between batches of at most
+  'intervalCycles' cycles, for host-side work such as watching a
+  socket. Unlike a scheduled event it is invisible to the guest and
+  never wakes a halted CPU. Pass 0 to remove it.
+*/
+void
+CPU_SetHostPoll(cpu_host_poll_t poll, u64 intervalCycles)
+{
+  g_hostPoll       = poll;
+  g_hostPollCycles = intervalCycles;
+}
+
+/*
+  Ask CPU_Run() to return once the current instruction completes. Safe
+  to call from scheduled events and signal handlers.
+*/
+void
+CPU_RequestStop(void)
+{
+  g_stopRequested = true;
+  g_runDeadline   = 0;
+}
+
+/*
+  Pull the end of the current CPU_Run() batch in to 'cycle' if it is
+  earlier. Used when an event is scheduled mid-batch.
+*/
+void
+CPU_ClampDeadline(u64 cycle)
+{
+  if (cycle < g_runDeadline)
+    g_runDeadline = cycle;
+}
+
+/*
+  CPU_Interrupt()
+
+  Deliver an interrupt from a device. As on the real 8080, the device
+  supplies an RST instruction; it is executed (without advancing the
+  program counter) if interrupts are enabled, which also wakes the CPU
+  from a halt. Accepting an interrupt disables further
+  interrupts. Returns false if the interrupt was ignored.
+*/
+bool
+CPU_Interrupt(byte_t rstOpcode)
+{
+  if (!g_interruptsEnabled)
+  {
+    ++g_interruptCounts.ignored;
+    return false;
+  }
+  ++g_interruptCounts.delivered;
+
+  /* Log the interrupt like an instruction so it can be undone */
+  if (g_instructionHooks & CPU_HOOK_HISTORY)
+    Hist_BeginInstruction();
+  if (g_instructionHooks & CPU_HOOK_TRACE)
+    Trace_RecordInterrupt(rstOpcode);
+  if (g_instructionHooks & CPU_HOOK_PROFILE)
+    Prof_RecordInterrupt(rstOpcode);
+
+  g_interruptsEnabled = false;
+  g_halted            = false;
+  CPU_PushProgramCounter();
+  CPU_SetProgramCounter(rstOpcode & 0x38);
+  g_cycleCount += instruction_set[rstOpcode].cycleCount[CYCLE_COUNT_SHORT];
+  ++g_opcodeCounts[rstOpcode].executed;
+  return true;
+}
+
+bool
+CPU_IsHalted(void)
+{
+  return g_halted;
+}
+
+/*
+  Whether CPU_Run() is in progress, so a signal handler can tell a
+  stop request from an interrupt at the debugger prompt.
+*/
+bool
+CPU_IsRunning(void)
+{
+  return g_running;
+}
+
+/*
+  CPU_SetReturnWatch()
+
+  Make CPU_Run() return CPU_STOP_RETURNED after the first return
+  instruction that leaves SP above 'stackPointer'. Passing the current
+  SP therefore stops when the current subroutine returns, but not when
+  anything it calls does. CPU_NO_RETURNWATCH turns the watch off.
+*/
+void
+CPU_SetReturnWatch(u32 stackPointer)
+{
+  g_returnWatchSP    = stackPointer;
+  g_returnWatchFired = false;
+}
+
+/*
+  CPU_WatchTriggered()
+
+  Called when the current instruction writes to a watched address.
+  CPU_Run() returns CPU_STOP_WATCHPOINT once the instruction completes.
+*/
+void
+CPU_WatchTriggered(word_t address)
+{
+  g_watchFired   = true;
+  g_watchAddress = address;
+  g_runDeadline  = 0;
+}
+
+word_t
+CPU_GetWatchAddress(void)
+{
+  return g_watchAddress;
+}
+
+u8
+CPU_GetInstructionLength(byte_t opcode)
+{
+  return instruction_set[opcode].byteCount;
+}
+
+/*
+  True for instructions that push a return address: CALL, the
+  conditional calls and RST.
+*/
+bool
+CPU_IsCallInstruction(byte_t opcode)
+{
+  switch (instruction_set[opcode].executeParams.instructionType)
+  {
+  case INSTR_CALL:
+  case INSTR_CC:
+  case INSTR_CM:
+  case INSTR_CNC:
+  case INSTR_CNZ:
+  case INSTR_CP:
+  case INSTR_CPE:
+  case INSTR_CPO:
+  case INSTR_CZ:
+  case INSTR_RST:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+const struct registers*
+CPU_GetRegisters(void)
+{
+  return &regs;
+}
+
+void
+CPU_SaveState(struct cpu_state* state)
+{
+  state->regs              = regs;
+  state->interruptsEnabled = g_interruptsEnabled;
+  state->halted            = g_halted;
+  state->cycleCount        = g_cycleCount;
+}
+
+void
+CPU_RestoreState(const struct cpu_state* state)
+{
+  regs                = state->regs;
+  g_interruptsEnabled = state->interruptsEnabled;
+  g_halted            = state->halted;
+  g_cycleCount        = state->cycleCount;
+}
+
+void
+CPU_EnableHook(u32 hook, bool enabled)
+{
+  if (enabled)
+    g_instructionHooks |= hook;
+  else
+    g_instructionHooks &= ~hook;
+}
+
+/*
+  CPU_BeginReplay()
+
+  Called before re-executing instructions that have already run once,
+  as history does when it restores a checkpoint. Until
+  CPU_EndReplay(), only the history hook runs, and the opcode and
+  interrupt counts are put back afterwards so that statistics, metrics,
+  traces and profiles see each instruction only once.
+*/
+void
+CPU_BeginReplay(void)
+{
+  g_replayHooks = g_instructionHooks;
+  g_instructionHooks &= CPU_HOOK_HISTORY;
+  memcpy(g_replayOpcodeCounts, g_opcodeCounts, sizeof(g_opcodeCounts));
+  g_replayInterruptCounts = g_interruptCounts;
+}
+
+void
+CPU_EndReplay(void)
+{
+  g_instructionHooks = g_replayHooks;
+  memcpy(g_opcodeCounts, g_replayOpcodeCounts, sizeof(g_opcodeCounts));
+  g_interruptCounts = g_replayInterruptCounts;
+}
+
+const struct cpu_opcode_counts*
+CPU_GetOpcodeCounts(void)
+{
+  return g_opcodeCounts;
+}
+
+internal u64
+CPU_SumOpcodeCounts(void)
+{
+  u64 total = 0;
+  u32 i;
+
+  for (i = 0; i < 256; ++i)
+    total += g_opcodeCounts[i].executed;
+  return total;
+}
+
+void
+CPU_ResetOpcodeCounts(void)
+{
+  g_retiredBase += CPU_SumOpcodeCounts();
+  memset(g_opcodeCounts, 0, sizeof(g_opcodeCounts));
+}
+
+/*
+  Instructions executed since the emulator started. Unlike the opcode
+  counts, never reset.
+*/
+u64
+CPU_GetRetiredInstructions(void)
+{
+  return g_retiredBase + CPU_SumOpcodeCounts();
+}
+
+const struct cpu_interrupt_counts*
+CPU_GetInterruptCounts(void)
+{
+  return &g_interruptCounts;
+}
+
+u64
+CPU_GetCycleCount(void)
+{
+  return g_cycleCount;
+}
+
 reg16_t
 CPU_GetProgramCounter(void)
 {
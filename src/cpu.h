@@ -81,6 +81,91 @@ struct registers
 };
 
 
+/*
+  Constants for each of the 8080's instruction types
+*/
+enum {
+      INSTR_ACI,
+      INSTR_ADC,
+      INSTR_ADD,
+      INSTR_ADI,
+      INSTR_ANA,
+      INSTR_ANI,
+      INSTR_CALL,
+      INSTR_CC,
+      INSTR_CM,
+      INSTR_CMA,
+      INSTR_CMC,
+      INSTR_CMP,
+      INSTR_CNC,
+      INSTR_CNZ,
+      INSTR_CP,
+      INSTR_CPE,
+      INSTR_CPI,
+      INSTR_CPO,
+      INSTR_CZ,
+      INSTR_DAA,
+      INSTR_DAD,
+      INSTR_DCR,
+      INSTR_DCX,
+      INSTR_DI,
+      INSTR_EI,
+      INSTR_HLT,
+      INSTR_IN,
+      INSTR_INR,
+      INSTR_INX,
+      INSTR_JC,
+      INSTR_JM,
+      INSTR_JMP,
+      INSTR_JNC,
+      INSTR_JNZ,
+      INSTR_JP,
+      INSTR_JPE,
+      INSTR_JPO,
+      INSTR_JZ,
+      INSTR_LDA,
+      INSTR_LDAX,
+      INSTR_LHLD,
+      INSTR_LXI,
+      INSTR_MOV,
+      INSTR_MVI,
+      INSTR_NOP,
+      INSTR_ORA,
+      INSTR_ORI,
+      INSTR_OUT,
+      INSTR_PCHL,
+      INSTR_POP,
+      INSTR_PUSH,
+      INSTR_RAL,
+      INSTR_RAR,
+      INSTR_RC,
+      INSTR_RET,
+      INSTR_RLC,
+      INSTR_RM,
+      INSTR_RNC,
+      INSTR_RNZ,
+      INSTR_RP,
+      INSTR_RPE,
+      INSTR_RPO,
+      INSTR_RRC,
+      INSTR_RST,
+      INSTR_RZ,
+      INSTR_SBB,
+      INSTR_SBI,
+      INSTR_SHLD,
+      INSTR_SPHL,
+      INSTR_STA,
+      INSTR_STAX,
+      INSTR_STC,
+      INSTR_SUB,
+      INSTR_SUI,
+      INSTR_XCHG,
+      INSTR_XRA,
+      INSTR_XRI,
+      INSTR_XTHL
+};
+
+
 struct execute_params
 {
   u8         instructionType;
@@ -93,6 +178,19 @@ struct execute_params
 };
 
 
+/*
+  Everything needed to put the CPU back into an earlier state (memory
+  aside).
+*/
+struct cpu_state
+{
+  struct registers regs;
+  bool             interruptsEnabled;
+  bool             halted;
+  u64              cycleCount;
+};
+
+
 #define CYCLE_COUNT_SHORT 0
 #define CYCLE_COUNT_LONG  1
 
@@ -116,9 +214,95 @@ struct instruction
 };
 
 
+#define CPU_NO_CYCLELIMIT 0xffffffffffffffffULL
+
+/*
+  Executions of one opcode, and how many of them took their action
+  (conditional jumps, calls and returns only). Cycles follow from the
+  opcode's two cycle counts.
+*/
+struct cpu_opcode_counts
+{
+  u64 executed;
+  u64 taken;
+};
+
+/* Interrupts requested by devices, by whether the CPU took them */
+struct cpu_interrupt_counts
+{
+  u64 delivered;
+  u64 ignored;
+};
+
+/*
+  Per-instruction hooks, run before each instruction when enabled.
+*/
+#define CPU_HOOK_HISTORY  0x01
+#define CPU_HOOK_TRACE    0x02
+#define CPU_HOOK_PROFILE  0x04
+
+/*
+  Reasons CPU_Run() hands control back to its caller.
+*/
+enum
+{
+  CPU_STOP_CYCLELIMIT,
+  CPU_STOP_REQUESTED,
+  CPU_STOP_HALTED,
+  CPU_STOP_BREAKPOINT,
+  CPU_STOP_RETURNED,
+  CPU_STOP_WATCHPOINT,
+};
+
+/* Host-side work CPU_Run() does between batches */
+typedef void (*cpu_host_poll_t)(void);
+
+/* CPU_SetReturnWatch() value that never fires */
+#define CPU_NO_RETURNWATCH 0x10000
+
+
 void
 CPU_Init(byte_t* memoryBlock);
 
+u8
+CPU_Run(u64 cycleLimit);
+
+void
+CPU_Step();
+
+void
+CPU_RequestStop();
+
+void
+CPU_SetHostPoll(cpu_host_poll_t poll, u64 intervalCycles);
+
+void
+CPU_ClampDeadline(u64 cycle);
+
+bool
+CPU_Interrupt(byte_t rstOpcode);
+
+bool
+CPU_IsHalted();
+
+bool
+CPU_IsRunning();
+
+void
+CPU_SetReturnWatch(u32 stackPointer);
+
+void
+CPU_WatchTriggered(word_t address);
+
+word_t
+CPU_GetWatchAddress();
+
+u8
+CPU_GetInstructionLength(byte_t opcode);
+
+bool
+CPU_IsCallInstruction(byte_t opcode);
+
 void
 CPU_DoInstructionCycle();
 
@@ -134,6 +318,39 @@ CPU_AdvancePC();
 void
 CPU_Execute();
 
+u64
+CPU_GetCycleCount();
+
+const struct registers*
+CPU_GetRegisters();
+
+void
+CPU_SaveState(struct cpu_state* state);
+
+void
+CPU_RestoreState(const struct cpu_state* state);
+
+void
+CPU_EnableHook(u32 hook, bool enabled);
+
+void
+CPU_BeginReplay();
+
+void
+CPU_EndReplay();
+
+const struct cpu_opcode_counts*
+CPU_GetOpcodeCounts();
+
+void
+CPU_ResetOpcodeCounts();
+
+u64
+CPU_GetRetiredInstructions();
+
+const struct cpu_interrupt_counts*
+CPU_GetInterruptCounts();
+
 reg16_t
 CPU_GetProgramCounter();
 
@@ -0,0 +1,475 @@
+#include "cpu.h"
+#include "disas.h"
+#include "memory.h"
+#include "symbols.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+extern struct instruction instruction_set[256];
+
+
+/* How an instruction's operands are written */
+enum
+{
+  OPERAND_NONE,
+  OPERAND_REG,
+  OPERAND_REG_REG,
+  OPERAND_REG_D8,
+  OPERAND_PAIR,
+  OPERAND_PAIR_D16,
+  OPERAND_D8,
+  OPERAND_A16,
+  OPERAND_RST
+};
+
+struct disas_mnemonic
+{
+  char* name;
+  u8    operands;
+};
+
+internal const struct disas_mnemonic mnemonics[] =
+{
+  [INSTR_ACI]  = { "ACI",  OPERAND_D8       },
+  [INSTR_ADC]  = { "ADC",  OPERAND_REG      },
+  [INSTR_ADD]  = { "ADD",  OPERAND_REG      },
+  [INSTR_ADI]  = { "ADI",  OPERAND_D8       },
+  [INSTR_ANA]  = { "ANA",  OPERAND_REG      },
+  [INSTR_ANI]  = { "ANI",  OPERAND_D8       },
+  [INSTR_CALL] = { "CALL", OPERAND_A16      },
+  [INSTR_CC]   = { "CC",   OPERAND_A16      },
+  [INSTR_CM]   = { "CM",   OPERAND_A16      },
+  [INSTR_CMA]  = { "CMA",  OPERAND_NONE     },
+  [INSTR_CMC]  = { "CMC",  OPERAND_NONE     },
+  [INSTR_CMP]  = { "CMP",  OPERAND_REG      },
+  [INSTR_CNC]  = { "CNC",  OPERAND_A16      },
+  [INSTR_CNZ]  = { "CNZ",  OPERAND_A16      },
+  [INSTR_CP]   = { "CP",   OPERAND_A16      },
+  [INSTR_CPE]  = { "CPE",  OPERAND_A16      },
+  [INSTR_CPI]  = { "CPI",  OPERAND_D8       },
+  [INSTR_CPO]  = { "CPO",  OPERAND_A16      },
+  [INSTR_CZ]   = { "CZ",   OPERAND_A16      },
+  [INSTR_DAA]  = { "DAA",  OPERAND_NONE     },
+  [INSTR_DAD]  = { "DAD",  OPERAND_PAIR     },
+  [INSTR_DCR]  = { "DCR",  OPERAND_REG      },
+  [INSTR_DCX]  = { "DCX",  OPERAND_PAIR     },
+  [INSTR_DI]   = { "DI",   OPERAND_NONE     },
+  [INSTR_EI]   = { "EI",   OPERAND_NONE     },
+  [INSTR_HLT]  = { "HLT",  OPERAND_NONE     },
+  [INSTR_IN]   = { "IN",   OPERAND_D8       },
+  [INSTR_INR]  = { "INR",  OPERAND_REG      },
+  [INSTR_INX]  = { "INX",  OPERAND_PAIR     },
+  [INSTR_JC]   = { "JC",   OPERAND_A16      },
+  [INSTR_JM]   = { "JM",   OPERAND_A16      },
+  [INSTR_JMP]  = { "JMP",  OPERAND_A16      },
+  [INSTR_JNC]  = { "JNC",  OPERAND_A16      },
+  [INSTR_JNZ]  = { "JNZ",  OPERAND_A16      },
+  [INSTR_JP]   = { "JP",   OPERAND_A16      },
+  [INSTR_JPE]  = { "JPE",  OPERAND_A16      },
+  [INSTR_JPO]  = { "JPO",  OPERAND_A16      },
+  [INSTR_JZ]   = { "JZ",   OPERAND_A16      },
+  [INSTR_LDA]  = { "LDA",  OPERAND_A16      },
+  [INSTR_LDAX] = { "LDAX", OPERAND_PAIR     },
+  [INSTR_LHLD] = { "LHLD", OPERAND_A16      },
+  [INSTR_LXI]  = { "LXI",  OPERAND_PAIR_D16 },
+  [INSTR_MOV]  = { "MOV",  OPERAND_REG_REG  },
+  [INSTR_MVI]  = { "MVI",  OPERAND_REG_D8   },
+  [INSTR_NOP]  = { "NOP",  OPERAND_NONE     },
+  [INSTR_ORA]  = { "ORA",  OPERAND_REG      },
+  [INSTR_ORI]  = { "ORI",  OPERAND_D8       },
+  [INSTR_OUT]  = { "OUT",  OPERAND_D8       },
+  [INSTR_PCHL] = { "PCHL", OPERAND_NONE     },
+  [INSTR_POP]  = { "POP",  OPERAND_PAIR     },
+  [INSTR_PUSH] = { "PUSH", OPERAND_PAIR     },
+  [INSTR_RAL]  = { "RAL",  OPERAND_NONE     },
+  [INSTR_RAR]  = { "RAR",  OPERAND_NONE     },
+  [INSTR_RC]   = { "RC",   OPERAND_NONE     },
+  [INSTR_RET]  = { "RET",  OPERAND_NONE     },
+  [INSTR_RLC]  = { "RLC",  OPERAND_NONE     },
+  [INSTR_RM]   = { "RM",   OPERAND_NONE     },
+  [INSTR_RNC]  = { "RNC",  OPERAND_NONE     },
+  [INSTR_RNZ]  = { "RNZ",  OPERAND_NONE     },
+  [INSTR_RP]   = { "RP",   OPERAND_NONE     },
+  [INSTR_RPE]  = { "RPE",  OPERAND_NONE     },
+  [INSTR_RPO]  = { "RPO",  OPERAND_NONE     },
+  [INSTR_RRC]  = { "RRC",  OPERAND_NONE     },
+  [INSTR_RST]  = { "RST",  OPERAND_RST      },
+  [INSTR_RZ]   = { "RZ",   OPERAND_NONE     },
+  [INSTR_SBB]  = { "SBB",  OPERAND_REG      },
+  [INSTR_SBI]  = { "SBI",  OPERAND_D8       },
+  [INSTR_SHLD] = { "SHLD", OPERAND_A16      },
+  [INSTR_SPHL] = { "SPHL", OPERAND_NONE     },
+  [INSTR_STA]  = { "STA",  OPERAND_A16      },
+  [INSTR_STAX] = { "STAX", OPERAND_PAIR     },
+  [INSTR_STC]  = { "STC",  OPERAND_NONE     },
+  [INSTR_SUB]  = { "SUB",  OPERAND_REG      },
+  [INSTR_SUI]  = { "SUI",  OPERAND_D8       },
+  [INSTR_XCHG] = { "XCHG", OPERAND_NONE     },
+  [INSTR_XRA]  = { "XRA",  OPERAND_REG      },
+  [INSTR_XRI]  = { "XRI",  OPERAND_D8       },
+  [INSTR_XTHL] = { "XTHL", OPERAND_NONE     },
+};
+
+/* Indexed by REG_* */
+internal const char* regNames[] = { "B", "C", "D", "E", "H", "L", "M", "A" };
+/* Indexed by REGPAIR_* and REG_SP */
+internal const char* pairNames[] = { "B", "D", "H", "PSW", "SP" };
+
+internal const char hexDigits[] = "0123456789abcdef";
+
+
+struct disas_entry
+{
+  /* Generations of the pages holding the first and last byte */
+  u32  generation[2];
+  bool valid;
+  u8   length;
+  char text[DISAS_MAX_TEXT];
+};
+
+internal struct disas_entry* cache;
+
+
+internal char*
+Disas_AppendString(char* out, const char* string)
+{
+  while (*string)
+    *out++ = *string++;
+  return out;
+}
+
+internal char*
+Disas_AppendHex(char* out, u32 value, u8 digits)
+{
+  *out++ = '0';
+  *out++ = 'x';
+  while (digits--)
+    *out++ = hexDigits[(value >> (digits * 4)) & 0xf];
+  return out;
+}
+
+
+/*
+  Disas_GetTarget()
+
+  If the instruction starting at 'bytes' has an address operand, store
+  it in 'target' and return true. The operand is left as a plain number
+  in the decoded text, so lines stay valid in the cache when symbols
+  are loaded, and the symbol is added when the line is printed.
+*/
+internal bool
+Disas_GetTarget(const byte_t* bytes, word_t* target)
+{
+  const struct execute_params* params = &instruction_set[bytes[0]].executeParams;
+
+  if (mnemonics[params->instructionType].operands != OPERAND_A16)
+    return false;
+  *target = bytes[1] | (bytes[2] << 8);
+  return true;
+}
+
+
+/*
+  Disas_Decode()
+
+  Write the instruction starting at 'bytes' as text, NUL terminated,
+  and return its length in bytes. 'bytes' must hold at least three
+  bytes.
+*/
+u8
+Disas_Decode(const byte_t* bytes, char* text)
+{
+  const struct instruction*    instruction = &instruction_set[bytes[0]];
+  const struct execute_params* params      = &instruction->executeParams;
+  const struct disas_mnemonic* mnemonic    = &mnemonics[params->instructionType];
+  char*                        out         = text;
+  word_t                       operand     = bytes[1] | (bytes[2] << 8);
+
+  out = Disas_AppendString(out, mnemonic->name);
+  if (mnemonic->operands != OPERAND_NONE)
+  {
+    /* Pad the mnemonic to line up the operands */
+    while (out - text < 5)
+      *out++ = ' ';
+  }
+
+  switch (mnemonic->operands)
+  {
+  case OPERAND_REG:
+    {
+      out = Disas_AppendString(out, regNames[params->regs[0]]);
+      break;
+    }
+
+  case OPERAND_REG_REG:
+    {
+      out = Disas_AppendString(out, regNames[params->regs[0]]);
+      *out++ = ',';
+      out = Disas_AppendString(out, regNames[params->regs[1]]);
+      break;
+    }
+
+  case OPERAND_REG_D8:
+    {
+      out = Disas_AppendString(out, regNames[params->regs[0]]);
+      *out++ = ',';
+      out = Disas_AppendHex(out, bytes[1], 2);
+      break;
+    }
+
+  case OPERAND_PAIR:
+    {
+      out = Disas_AppendString(out, pairNames[params->regs[0]]);
+      break;
+    }
+
+  case OPERAND_PAIR_D16:
+    {
+      out = Disas_AppendString(out, pairNames[params->regs[0]]);
+      *out++ = ',';
+      out = Disas_AppendHex(out, operand, 4);
+      break;
+    }
+
+  case OPERAND_D8:
+    {
+      out = Disas_AppendHex(out, bytes[1], 2);
+      break;
+    }
+
+  case OPERAND_A16:
+    {
+      out = Disas_AppendHex(out, operand, 4);
+      break;
+    }
+
+  case OPERAND_RST:
+    {
+      /* The restart number is encoded in the opcode itself */
+      *out++ = '0' + ((bytes[0] >> 3) & 7);
+      break;
+    }
+
+  default:
+    {
+      break;
+    }
+  }
+
+  *out = '\0';
+  return instruction->byteCount;
+}
+
+const char*
+Disas_GetMnemonic(u8 instructionType)
+{
+  return mnemonics[instructionType].name;
+}
+
+/*
+  Disas_GetOpcodeName()
+
+  Write the general form of an opcode, with d8, d16 and a16 standing
+  for its immediate operands, e.g. "MVI B,d8".
+*/
+void
+Disas_GetOpcodeName(byte_t opcode, char* text)
+{
+  const struct execute_params* params   = &instruction_set[opcode].executeParams;
+  const struct disas_mnemonic* mnemonic = &mnemonics[params->instructionType];
+  const char*                  regName  = regNames[params->regs[0] & 7];
+  const char*                  pairName = pairNames[params->regs[0] % 5];
+
+  switch (mnemonic->operands)
+  {
+  case OPERAND_REG:      { sprintf(text, "%s %s", mnemonic->name, regName); break; }
+  case OPERAND_REG_REG:  { sprintf(text, "%s %s,%s", mnemonic->name, regName, regNames[params->regs[1] & 7]); break; }
+  case OPERAND_REG_D8:   { sprintf(text, "%s %s,d8", mnemonic->name, regName); break; }
+  case OPERAND_PAIR:     { sprintf(text, "%s %s", mnemonic->name, pairName); break; }
+  case OPERAND_PAIR_D16: { sprintf(text, "%s %s,d16", mnemonic->name, pairName); break; }
+  case OPERAND_D8:       { sprintf(text, "%s d8", mnemonic->name); break; }
+  case OPERAND_A16:      { sprintf(text, "%s a16", mnemonic->name); break; }
+  case OPERAND_RST:      { sprintf(text, "%s %u", mnemonic->name, (opcode >> 3) & 7); break; }
+  default:               { sprintf(text, "%s", mnemonic->name); break; }
+  }
+}
+
+/*
+  Disas_GetLine()
+
+  Return the cached text of the instruction at 'address', decoding it
+  first if its bytes may have changed since it was last decoded.
+*/
+const char*
+Disas_GetLine(word_t address, u8* length)
+{
+  struct disas_entry* entry;
+  u32                 firstGeneration;
+  u32                 lastGeneration;
+
+  if (!cache)
+  {
+    cache = (struct disas_entry*)calloc(0x10000, sizeof(struct disas_entry));
+    Mem_EnableWriteHook(MEM_HOOK_GENERATION, true);
+  }
+
+  entry           = &cache[address];
+  firstGeneration = Mem_GetPageGeneration(address);
+  lastGeneration  = Mem_GetPageGeneration(address + 2);
+  if (!entry->valid ||
+      entry->generation[0] != firstGeneration ||
+      entry->generation[1] != lastGeneration)
+  {
+    byte_t bytes[3];
+
+    bytes[0] = Mem_ReadByte(address);
+    bytes[1] = Mem_ReadByte(address + 1);
+    bytes[2] = Mem_ReadByte(address + 2);
+    entry->length        = Disas_Decode(bytes, entry->text);
+    entry->generation[0] = firstGeneration;
+    entry->generation[1] = lastGeneration;
+    entry->valid         = true;
+  }
+
+  *length = entry->length;
+  return entry->text;
+}
+
+/*
+  Disas_Print()
+
+  Print 'count' instructions starting at 'address', marking the one at
+  the program counter. Returns the address after the last one.
+*/
+u32
+Disas_Print(FILE* out, word_t address, u32 count)
+{
+  u32 next = address;
+
+  for (; count && next < 0x10000; --count)
+  {
+    const char* text;
+    const char* label;
+    byte_t      bytes[3];
+    word_t      offset;
+    word_t      target;
+    char        symbol[SYM_MAX_NAME + 16];
+    u8          length;
+    u8          i;
+
+    label = Sym_Lookup(next, &offset);
+    if (label && offset == 0)
+      fprintf(out, "%s:\n", label);
+
+    text = Disas_GetLine(next, &length);
+    fprintf(out, "%s0x%04x: ", (next == CPU_GetProgramCounter()) ? "=> " : "   ", next);
+    for (i = 0; i < 3; ++i)
+    {
+      bytes[i] = Mem_ReadByte(next + i);
+      if (i < length)
+        fprintf(out, " %02x", bytes[i]);
+      else
+        fprintf(out, "   ");
+    }
+    if (Disas_GetTarget(bytes, &target) && Sym_Format(target, symbol, sizeof(symbol)))
+      fprintf(out, "   %s <%s>\n", text, symbol);
+    else
+      fprintf(out, "   %s\n", text);
+    next += length;
+  }
+  return next;
+}
+
+/*
+  Disas_WriteImage()
+
+  Disassemble the whole 64K address space in one linear sweep, to
+  'path' or to stdout if it is "-". This bypasses the cache and formats
+  straight into a large output buffer.
+*/
+bool
+Disas_WriteImage(char* path)
+{
+  const byte_t* memory  = Mem_GetBase();
+  u32           memSize = Mem_GetSize();
+  FILE*         fp;
+  char*         buffer;
+  u32           used;
+  u32           address;
+
+  fp = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+  if (!fp)
+    return false;
+  buffer = (char*)malloc(DISAS_BULK_BUFFER);
+
+  used    = 0;
+  address = 0;
+  while (address < 0x10000)
+  {
+    byte_t      bytes[3];
+    char*       out;
+    const char* label;
+    word_t      offset;
+    word_t      target;
+    u8          length;
+    u8          i;
+
+    for (i = 0; i < 3; ++i)
+      bytes[i] = (address + i < memSize) ? memory[address + i] : 0;
+
+    /* Room for the longest line, with a label line and a symbol */
+    if (used + 64 + 2 * (SYM_MAX_NAME + 16) > DISAS_BULK_BUFFER)
+    {
+      fwrite(buffer, 1, used, fp);
+      used = 0;
+    }
+
+    out   = buffer + used;
+    label = Sym_Lookup(address, &offset);
+    if (label && offset == 0)
+    {
+      out = Disas_AppendString(out, label);
+      *out++ = ':';
+      *out++ = '\n';
+    }
+    for (i = 0; i < 4; ++i)
+      *out++ = hexDigits[(address >> ((3 - i) * 4)) & 0xf];
+    *out++ = ':';
+
+    length = instruction_set[bytes[0]].byteCount;
+    if (address + length > 0x10000)
+      length = 0x10000 - address;
+    for (i = 0; i < 3; ++i)
+    {
+      *out++ = ' ';
+      *out++ = (i < length) ? hexDigits[bytes[i] >> 4]  : ' ';
+      *out++ = (i < length) ? hexDigits[bytes[i] & 0xf] : ' ';
+    }
+    *out++ = ' ';
+    *out++ = ' ';
+    Disas_Decode(bytes, out);
+    out += strlen(out);
+    if (Disas_GetTarget(bytes, &target) && Sym_Lookup(target, &offset))
+    {
+      *out++ = ' ';
+      *out++ = '<';
+      out += Sym_Format(target, out, SYM_MAX_NAME + 16);
+      *out++ = '>';
+    }
+    *out++ = '\n';
+
+    used     = out - buffer;
+    address += length;
+  }
+
+  fwrite(buffer, 1, used, fp);
+  free(buffer);
+  if (fp != stdout)
+    fclose(fp);
+  else
+    fflush(fp);
+  return true;
+}
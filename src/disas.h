@@ -0,0 +1,45 @@
+#ifndef __DISAS_H__
+#define __DISAS_H__
+#pragma once
+
+
+#include "types.h"
+
+#include <stdio.h>
+
+
+/*
+  Disassembler.
+
+  Instructions are decoded from the CPU's own instruction_set table,
+  which gives each opcode's length, type and register operands; only
+  the mnemonics live here. Decoded lines are cached per address and
+  stamped with the generation of the memory page(s) they were read
+  from, so a line is only decoded again after its bytes may have
+  changed.
+*/
+
+#define DISAS_MAX_TEXT    20
+#define DISAS_BULK_BUFFER (1 << 16)
+
+
+u8
+Disas_Decode(const byte_t* bytes, char* text);
+
+const char*
+Disas_GetLine(word_t address, u8* length);
+
+const char*
+Disas_GetMnemonic(u8 instructionType);
+
+void
+Disas_GetOpcodeName(byte_t opcode, char* text);
+
+u32
+Disas_Print(FILE* out, word_t address, u32 count);
+
+bool
+Disas_WriteImage(char* path);
+
+
+#endif    /* __DISAS_H__ */
@@ -0,0 +1,279 @@
+#include "cpu.h"
+#include "display.h"
+#include "memory.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+#define HIGHLIGHT_ON   "\033[7m"
+#define HIGHLIGHT_OFF  "\033[0m"
+
+
+struct disp_model
+{
+  bool             valid;
+  struct registers regs;
+  byte_t           memory[DISP_MEM_WINDOW];
+};
+
+internal struct disp_model model;
+internal word_t            windowAddress;
+internal u16               windowLength;
+internal bool              useHighlight;
+
+internal char              buffer[DISP_BUFFER_SIZE];
+internal u32               bufferLength;
+
+
+internal void
+Disp_Append(const char* format, ...)
+{
+  va_list args;
+  int     written;
+
+  if (bufferLength >= DISP_BUFFER_SIZE - 1)
+    return;
+
+  va_start(args, format);
+  written = vsnprintf(buffer + bufferLength, DISP_BUFFER_SIZE - bufferLength, format, args);
+  va_end(args);
+
+  if (written > 0)
+  {
+    bufferLength += written;
+    if (bufferLength > DISP_BUFFER_SIZE - 1)
+      bufferLength = DISP_BUFFER_SIZE - 1;
+  }
+}
+
+/*
+  Disp_AppendValue()
+
+  Append a value, highlighted if it differs from what was last shown.
+*/
+internal void
+Disp_AppendValue(const char* format, u32 value, bool changed)
+{
+  if (changed && useHighlight)
+    Disp_Append(HIGHLIGHT_ON);
+  Disp_Append(format, value);
+  if (changed && useHighlight)
+    Disp_Append(HIGHLIGHT_OFF);
+}
+
+internal void
+Disp_Flush()
+{
+  u32 offset;
+
+  /* Anything already queued through stdio has to come out first */
+  fflush(stdout);
+  offset = 0;
+  while (offset < bufferLength)
+  {
+    ssize_t written = write(STDOUT_FILENO, buffer + offset, bufferLength - offset);
+    if (written <= 0)
+      break;
+    offset += written;
+  }
+  bufferLength = 0;
+}
+
+internal void
+Disp_AppendFlags(const struct registers* regs, bool full)
+{
+  internal const struct
+  {
+    byte_t mask;
+    char*  set;
+    char*  clear;
+  } flagNames[] =
+  {
+    { FLG_SIGN,   "S",  "s"  },
+    { FLG_ZERO,   "Z",  "z"  },
+    { FLG_AUXCRY, "AC", "ac" },
+    { FLG_PARITY, "P",  "p"  },
+    { FLG_CARRY,  "C",  "c"  },
+  };
+
+  Disp_Append("Flags:");
+  for (u32 i = 0; i < sizeof(flagNames) / sizeof(flagNames[0]); ++i)
+  {
+    bool set     = (regs->F & flagNames[i].mask) != 0;
+    bool changed = !full && ((regs->F ^ model.regs.F) & flagNames[i].mask);
+
+    Disp_Append(" ");
+    if (changed && useHighlight)
+      Disp_Append(HIGHLIGHT_ON);
+    Disp_Append("%s", set ? flagNames[i].set : flagNames[i].clear);
+    if (changed && useHighlight)
+      Disp_Append(HIGHLIGHT_OFF);
+  }
+  Disp_Append("\n");
+}
+
+/*
+  Disp_AppendRegs()
+
+  On a full redraw every register is listed one per line. Otherwise
+  only the registers that changed are listed, on a single line.
+*/
+internal void
+Disp_AppendRegs(const struct registers* regs, bool full)
+{
+  internal const struct
+  {
+    char* name;
+    u8    reg;
+  } regNames[] =
+  {
+    { " A", REG_A }, { " B", REG_B }, { " C", REG_C }, { " D", REG_D },
+    { " E", REG_E }, { " H", REG_H }, { " L", REG_L },
+  };
+  const reg8_t* current  = (const reg8_t*)regs;
+  const reg8_t* previous = (const reg8_t*)&model.regs;
+  bool          any      = false;
+
+  if (full)
+    Disp_Append("\n");
+
+  for (u32 i = 0; i < sizeof(regNames) / sizeof(regNames[0]); ++i)
+  {
+    /* REG_A is out of order relative to the struct; REG_M has no slot */
+    u8   offset  = (regNames[i].reg == REG_A) ? 6 : regNames[i].reg;
+    bool changed = current[offset] != previous[offset];
+
+    if (!full && !changed)
+      continue;
+
+    if (full)
+    {
+      Disp_Append("%s: 0x%02x\n", regNames[i].name, current[offset]);
+      continue;
+    }
+
+    /* Names are padded for the full listing; drop that on one line */
+    Disp_Append(any ? " %s: " : "%s: ", regNames[i].name + 1);
+    Disp_AppendValue("0x%02x", current[offset], true);
+    any = true;
+  }
+
+  if (full)
+  {
+    Disp_Append("\n");
+    Disp_Append("SP: 0x%04x\n", regs->SP);
+    Disp_Append("PC: 0x%04x\n", regs->PC);
+    Disp_Append("\n");
+    Disp_AppendFlags(regs, true);
+    Disp_Append("\n");
+    return;
+  }
+
+  if (regs->SP != model.regs.SP)
+  {
+    Disp_Append(any ? " SP: " : "SP: ");
+    Disp_AppendValue("0x%04x", regs->SP, true);
+    any = true;
+  }
+  /* The PC is always shown so every refresh says where execution is */
+  Disp_Append(any ? " PC: " : "PC: ");
+  Disp_AppendValue("0x%04x", regs->PC, false);
+  Disp_Append("\n");
+
+  if (regs->F != model.regs.F)
+    Disp_AppendFlags(regs, false);
+}
+
+/*
+  Disp_AppendMemory()
+
+  Append the rows of the memory window. Unless this is a full redraw,
+  rows whose bytes are all unchanged are skipped.
+*/
+internal void
+Disp_AppendMemory(const byte_t* current, bool full)
+{
+  bool any = false;
+
+  for (u16 row = 0; row < windowLength; row += DISP_BYTES_PER_ROW)
+  {
+    u16 rowLength = windowLength - row;
+    if (rowLength > DISP_BYTES_PER_ROW)
+      rowLength = DISP_BYTES_PER_ROW;
+
+    if (!full && memcmp(current + row, model.memory + row, rowLength) == 0)
+      continue;
+
+    if (!any)
+      Disp_Append("\n");
+    any = true;
+
+    Disp_Append("0x%04x: ", (word_t)(windowAddress + row));
+    for (u16 col = 0; col < rowLength; ++col)
+    {
+      Disp_Append(" ");
+      Disp_AppendValue("%02x", current[row + col],
+                       !full && current[row + col] != model.memory[row + col]);
+    }
+    Disp_Append("\n");
+  }
+
+  if (any)
+    Disp_Append("\n");
+}
+
+
+void
+Disp_Init(word_t address, u16 length)
+{
+  if (length > DISP_MEM_WINDOW)
+    length = DISP_MEM_WINDOW;
+
+  windowAddress = address;
+  windowLength  = length;
+  useHighlight  = isatty(STDOUT_FILENO);
+  bufferLength  = 0;
+  model.valid   = false;
+}
+
+/*
+  Disp_Invalidate()
+
+  Forget the last shown state so the next refresh redraws everything.
+*/
+void
+Disp_Invalidate()
+{
+  model.valid = false;
+}
+
+void
+Disp_Refresh()
+{
+  const struct registers* regs = CPU_GetRegisters();
+  byte_t                  current[DISP_MEM_WINDOW];
+  u32                     memSize = Mem_GetSize();
+  bool                    full    = !model.valid;
+
+  /* Bytes past the end of memory read as zero, as with Mem_ReadByte */
+  memset(current, 0, sizeof(current));
+  if (windowAddress < memSize)
+  {
+    u32 copyLength = memSize - windowAddress;
+    if (copyLength > windowLength)
+      copyLength = windowLength;
+    memcpy(current, Mem_GetBase() + windowAddress, copyLength);
+  }
+
+  Disp_AppendRegs(regs, full);
+  Disp_AppendMemory(current, full);
+  Disp_Flush();
+
+  model.regs  = *regs;
+  memcpy(model.memory, current, sizeof(current));
+  model.valid = true;
+}
@@ -0,0 +1,34 @@
+#ifndef __DISPLAY_H__
+#define __DISPLAY_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  Debugger display.
+
+  The display remembers the registers, flags and memory window it last
+  showed. Each refresh compares the current machine state against that
+  model and only prints what changed, highlighting the new values when
+  stdout is a terminal. The whole refresh is formatted into one buffer
+  and written with a single write call.
+*/
+
+#define DISP_MEM_WINDOW        0x100
+#define DISP_BYTES_PER_ROW     16
+#define DISP_BUFFER_SIZE       (1 << 14)
+
+
+void
+Disp_Init(word_t windowAddress, u16 windowLength);
+
+void
+Disp_Invalidate();
+
+void
+Disp_Refresh();
+
+
+#endif    /* __DISPLAY_H__ */
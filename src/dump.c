@@ -0,0 +1,443 @@
+#include "dump.h"
+#include "memory.h"
+#include "symbols.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+
+/* Enough for the widest row: sixteen quoted, escaped characters */
+#define DUMP_MAX_ROW   256
+
+/* Dumps stop at the top of the 16-bit address space */
+#define ADDRESS_SPACE  0x10000
+
+
+typedef char* (*dump_encoder_t)(char* out, u32 value, u8 unitSize);
+
+struct dump_format
+{
+  char           type;
+  u8             bytesPerRow;
+  /* Field width for byte and word units */
+  u8             width[2];
+  bool           gutter;
+  dump_encoder_t encode;
+};
+
+
+internal const char hexDigits[] = "0123456789abcdef";
+
+internal char   buffer[DUMP_BUFFER_SIZE];
+internal u32    bufferLength;
+internal FILE*  output;
+
+
+internal void
+Dump_Flush()
+{
+  if (bufferLength)
+    fwrite(buffer, 1, bufferLength, output);
+  bufferLength = 0;
+}
+
+/*
+  Dump_Reserve()
+
+  Make sure a full row fits in the buffer and return where it starts.
+*/
+internal char*
+Dump_Reserve()
+{
+  if (bufferLength + DUMP_MAX_ROW > DUMP_BUFFER_SIZE)
+    Dump_Flush();
+  return buffer + bufferLength;
+}
+
+internal void
+Dump_Commit(char* end)
+{
+  bufferLength = end - buffer;
+}
+
+internal char*
+Dump_RightAlign(char* out, char* digits, u8 length, u8 width)
+{
+  while (width-- > length)
+    *out++ = ' ';
+  memcpy(out, digits, length);
+  return out + length;
+}
+
+internal char*
+Dump_EncodeHex(char* out, u32 value, u8 unitSize)
+{
+  for (int shift = unitSize * 8 - 4; shift >= 0; shift -= 4)
+    *out++ = hexDigits[(value >> shift) & 0xf];
+  return out;
+}
+
+internal char*
+Dump_EncodeOctal(char* out, u32 value, u8 unitSize)
+{
+  for (int shift = (unitSize == 1) ? 6 : 15; shift >= 0; shift -= 3)
+    *out++ = '0' + ((value >> shift) & 07);
+  return out;
+}
+
+internal char*
+Dump_EncodeBinary(char* out, u32 value, u8 unitSize)
+{
+  for (int bit = unitSize * 8 - 1; bit >= 0; --bit)
+    *out++ = '0' + ((value >> bit) & 1);
+  return out;
+}
+
+internal char*
+Dump_EncodeUnsigned(char* out, u32 value, u8 unitSize)
+{
+  char digits[8];
+  u8   length = sizeof(digits);
+
+  do
+  {
+    digits[--length] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  return Dump_RightAlign(out, digits + length, sizeof(digits) - length,
+                         (unitSize == 1) ? 3 : 5);
+}
+
+internal char*
+Dump_EncodeSigned(char* out, u32 value, u8 unitSize)
+{
+  char digits[8];
+  u8   length = sizeof(digits);
+  i32  signedValue;
+
+  signedValue = (unitSize == 1) ? (i8)value : (i16)value;
+  value = (signedValue < 0) ? -signedValue : signedValue;
+  do
+  {
+    digits[--length] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  if (signedValue < 0)
+    digits[--length] = '-';
+
+  return Dump_RightAlign(out, digits + length, sizeof(digits) - length,
+                         (unitSize == 1) ? 4 : 6);
+}
+
+/*
+  Dump_EncodeAddress()
+
+  Write a word as an address, followed by the symbol it falls in.
+*/
+internal char*
+Dump_EncodeAddress(char* out, u32 value, u8 unitSize)
+{
+  char* symbol;
+  u32   length;
+
+  *out++ = '0';
+  *out++ = 'x';
+  out = Dump_EncodeHex(out, value, 2);
+
+  symbol = out + 2;
+  length = Sym_Format(value, symbol, SYM_MAX_NAME + 16);
+  if (length)
+  {
+    *out++ = ' ';
+    *out++ = '<';
+    out   += length;
+    *out++ = '>';
+  }
+  return out;
+}
+
+/*
+  Dump_EscapeChar()
+
+  Write a byte the way it would appear in a C literal.
+*/
+internal char*
+Dump_EscapeChar(char* out, byte_t c, char quote)
+{
+  switch (c)
+  {
+  case '\n': { *out++ = '\\'; *out++ = 'n'; return out; }
+  case '\r': { *out++ = '\\'; *out++ = 'r'; return out; }
+  case '\t': { *out++ = '\\'; *out++ = 't'; return out; }
+  case '\0': { *out++ = '\\'; *out++ = '0'; return out; }
+  case '\\': { *out++ = '\\'; *out++ = '\\'; return out; }
+  default:
+    {
+      if (c == quote)
+      {
+        *out++ = '\\';
+        *out++ = c;
+      }
+      else if (c >= 0x20 && c < 0x7f)
+        *out++ = c;
+      else
+      {
+        *out++ = '\\';
+        *out++ = 'x';
+        *out++ = hexDigits[c >> 4];
+        *out++ = hexDigits[c & 0xf];
+      }
+      return out;
+    }
+  }
+}
+
+internal char*
+Dump_EncodeChar(char* out, u32 value, u8 unitSize)
+{
+  char quoted[8];
+  char* end;
+
+  quoted[0] = '\'';
+  end = Dump_EscapeChar(quoted + 1, (byte_t)value, '\'');
+  *end++ = '\'';
+  return Dump_RightAlign(out, quoted, end - quoted, 6);
+}
+
+
+internal const struct dump_format formats[] =
+{
+  { 'x', 16, {  2,  4 }, true,  Dump_EncodeHex      },
+  { 'o', 16, {  3,  6 }, true,  Dump_EncodeOctal    },
+  { 't',  8, {  8, 16 }, true,  Dump_EncodeBinary   },
+  { 'u', 16, {  3,  5 }, true,  Dump_EncodeUnsigned },
+  { 'd', 16, {  4,  6 }, true,  Dump_EncodeSigned   },
+  { 'f', 16, {  4,  6 }, true,  Dump_EncodeSigned   },
+  { 'a',  4, {  6,  6 }, false, Dump_EncodeAddress  },
+  { 'c',  8, {  6,  6 }, false, Dump_EncodeChar     },
+};
+
+
+/*
+  Dump_HexPairs()
+
+  Encode sixteen bytes as 32 hex digits, two per byte.
+*/
+internal void
+Dump_HexPairs(const byte_t* bytes, char* pairs)
+{
+#ifdef __SSE2__
+  __m128i in      = _mm_loadu_si128((const __m128i*)bytes);
+  __m128i mask    = _mm_set1_epi8(0x0f);
+  __m128i nine    = _mm_set1_epi8(9);
+  __m128i zero    = _mm_set1_epi8('0');
+  __m128i letters = _mm_set1_epi8('a' - '0' - 10);
+  __m128i high    = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+  __m128i low     = _mm_and_si128(in, mask);
+
+  high = _mm_add_epi8(_mm_add_epi8(high, zero),
+                      _mm_and_si128(_mm_cmpgt_epi8(high, nine), letters));
+  low  = _mm_add_epi8(_mm_add_epi8(low, zero),
+                      _mm_and_si128(_mm_cmpgt_epi8(low, nine), letters));
+
+  _mm_storeu_si128((__m128i*)pairs,        _mm_unpacklo_epi8(high, low));
+  _mm_storeu_si128((__m128i*)(pairs + 16), _mm_unpackhi_epi8(high, low));
+#else
+  for (u32 i = 0; i < 16; ++i)
+  {
+    pairs[i*2]     = hexDigits[bytes[i] >> 4];
+    pairs[i*2 + 1] = hexDigits[bytes[i] & 0xf];
+  }
+#endif
+}
+
+/*
+  Dump_HexRow()
+
+  The common case gets its own path: the whole row is hex encoded in
+  one go and the digit pairs are then laid out as bytes or words.
+*/
+internal char*
+Dump_HexRow(char* out, const byte_t* bytes, u32 rowLength, u8 unitSize)
+{
+  char pairs[32];
+
+  Dump_HexPairs(bytes, pairs);
+  for (u32 i = 0; i < rowLength; i += unitSize)
+  {
+    *out++ = ' ';
+    if (unitSize == 2)
+    {
+      /* Words are little endian: high byte first */
+      memcpy(out, pairs + (i + 1) * 2, 2);
+      out += 2;
+    }
+    memcpy(out, pairs + i * 2, 2);
+    out += 2;
+  }
+  return out;
+}
+
+internal char*
+Dump_Gutter(char* out, const byte_t* bytes, u32 rowLength, u32 missingUnits, u8 width)
+{
+  u32 padding = missingUnits * (width + 1);
+
+  memset(out, ' ', padding);
+  out += padding;
+  *out++ = ' ';
+  *out++ = ' ';
+  *out++ = '|';
+  for (u32 i = 0; i < rowLength; ++i)
+    *out++ = (bytes[i] >= 0x20 && bytes[i] < 0x7f) ? bytes[i] : '.';
+  *out++ = '|';
+  return out;
+}
+
+/*
+  Dump_Strings()
+
+  Print numStrings NUL-terminated strings, one per line, starting at
+  address.
+*/
+internal void
+Dump_Strings(u32 address, u32 numStrings)
+{
+  const byte_t* memory  = Mem_GetBase();
+  u32           memSize = Mem_GetSize();
+
+  for (u32 n = 0; n < numStrings && address < ADDRESS_SPACE; ++n)
+  {
+    char* out = Dump_Reserve();
+    u32   length;
+
+    *out++ = '0';
+    *out++ = 'x';
+    out = Dump_EncodeHex(out, address, 2);
+    *out++ = ':';
+    *out++ = ' ';
+    *out++ = ' ';
+    *out++ = '"';
+    for (length = 0;
+         address < ADDRESS_SPACE && length < DUMP_MAX_STRING_LENGTH;
+         ++address, ++length)
+    {
+      byte_t c = (address < memSize) ? memory[address] : 0;
+      if (!c)
+        break;
+      if (out - (buffer + bufferLength) > DUMP_MAX_ROW - 8)
+      {
+        Dump_Commit(out);
+        out = Dump_Reserve();
+      }
+      out = Dump_EscapeChar(out, c, '"');
+    }
+    *out++ = '"';
+    if (length == DUMP_MAX_STRING_LENGTH)
+    {
+      memcpy(out, "...", 3);
+      out += 3;
+    }
+    else
+      ++address;
+    *out++ = '\n';
+    Dump_Commit(out);
+  }
+}
+
+
+void
+Dump_Memory(FILE* out, word_t address, u32 numUnits, char formatType, char unitType)
+{
+  const struct dump_format* format;
+  const byte_t*             memory;
+  u32                       memSize;
+  u8                        unitSize;
+  u32                       start;
+  u32                       end;
+
+  output       = out;
+  bufferLength = 0;
+  buffer[bufferLength++] = '\n';
+
+  if (formatType == 's')
+  {
+    Dump_Strings(address, numUnits);
+    buffer[bufferLength++] = '\n';
+    Dump_Flush();
+    return;
+  }
+
+  format = 0;
+  for (u32 i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+  {
+    if (formats[i].type == formatType)
+      format = &formats[i];
+  }
+  if (!format)
+    return;
+
+  /* Characters are always shown a byte at a time, addresses a word */
+  unitSize = (unitType == 'w' && formatType != 'c') ? 2 : 1;
+  if (formatType == 'a')
+    unitSize = 2;
+  memory   = Mem_GetBase();
+  memSize  = Mem_GetSize();
+  start    = address;
+  end      = start + numUnits * unitSize;
+  if (end > ADDRESS_SPACE)
+    end = ADDRESS_SPACE;
+
+  for (u32 row = start; row < end; row += format->bytesPerRow)
+  {
+    byte_t bytes[16];
+    u32    rowLength;
+    char*  line;
+
+    rowLength = end - row;
+    if (rowLength > format->bytesPerRow)
+      rowLength = format->bytesPerRow;
+
+    /* Bytes past the end of memory read as zero, as with Mem_ReadByte */
+    memset(bytes, 0, sizeof(bytes));
+    if (row < memSize)
+      memcpy(bytes, memory + row, (row + rowLength <= memSize) ? rowLength : memSize - row);
+
+    line = Dump_Reserve();
+    *line++ = '0';
+    *line++ = 'x';
+    line = Dump_EncodeHex(line, row, 2);
+    *line++ = ':';
+    *line++ = ' ';
+
+    if (format->type == 'x')
+      line = Dump_HexRow(line, bytes, rowLength, unitSize);
+    else
+    {
+      for (u32 i = 0; i < rowLength; i += unitSize)
+      {
+        u32 value = bytes[i];
+        if (unitSize == 2)
+          value |= bytes[i + 1] << 8;
+        *line++ = ' ';
+        line = format->encode(line, value, unitSize);
+      }
+    }
+
+    if (format->gutter)
+    {
+      u32 missingUnits = (format->bytesPerRow - rowLength) / unitSize;
+      line = Dump_Gutter(line, bytes, rowLength, missingUnits, format->width[unitSize - 1]);
+    }
+    *line++ = '\n';
+    Dump_Commit(line);
+  }
+
+  buffer[bufferLength++] = '\n';
+  Dump_Flush();
+}
@@ -0,0 +1,33 @@
+#ifndef __DUMP_H__
+#define __DUMP_H__
+#pragma once
+
+
+#include "types.h"
+
+#include <stdio.h>
+
+
+/*
+  Memory dump formatter for the debugger's x command.
+
+  Memory is formatted a row at a time from a table of per-format
+  encoders into a large buffer, which is only handed to stdio when it
+  fills up. Formats follow gdb's x command:
+
+    a  address        o  octal          u  unsigned decimal
+    c  character      s  string         x  hex
+    d  signed decimal t  binary
+    f  float; the 8080 has no floating point type, so this is the
+       same as d
+*/
+
+#define DUMP_BUFFER_SIZE        (1 << 16)
+#define DUMP_MAX_STRING_LENGTH  200
+
+
+void
+Dump_Memory(FILE* out, word_t address, u32 numUnits, char formatType, char unitType);
+
+
+#endif    /* __DUMP_H__ */
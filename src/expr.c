@@ -0,0 +1,403 @@
+#include "cpu.h"
+#include "expr.h"
+#include "memory.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+
+/*
+  Opcodes. Operands follow the opcode byte inline.
+*/
+enum
+{
+  EXPROP_CONST,      /* u16 operand, low byte first */
+  EXPROP_REG8,       /* u8 operand: offset into struct registers */
+  EXPROP_REGPAIR,    /* u8 operand: offset of the pair's high byte */
+  EXPROP_SP,
+  EXPROP_PC,
+  EXPROP_FLAG,       /* u8 operand: flag bit */
+  EXPROP_LOAD,
+
+  EXPROP_NOT,
+  EXPROP_COMPLEMENT,
+  EXPROP_NEGATE,
+
+  EXPROP_ADD,
+  EXPROP_SUB,
+  EXPROP_AND,
+  EXPROP_XOR,
+  EXPROP_OR,
+  EXPROP_EQ,
+  EXPROP_NE,
+  EXPROP_LT,
+  EXPROP_LE,
+  EXPROP_GT,
+  EXPROP_GE,
+  EXPROP_LOGICALAND,
+  EXPROP_LOGICALOR,
+
+  EXPROP_END
+};
+
+struct expr_operand_name
+{
+  char* name;
+  u8    opcode;
+  u8    operand;
+};
+
+internal struct expr_operand_name operandNames[] =
+{
+  { "A",  EXPROP_REG8,    offsetof(struct registers, A) },
+  { "B",  EXPROP_REG8,    offsetof(struct registers, B) },
+  { "C",  EXPROP_REG8,    offsetof(struct registers, C) },
+  { "D",  EXPROP_REG8,    offsetof(struct registers, D) },
+  { "E",  EXPROP_REG8,    offsetof(struct registers, E) },
+  { "H",  EXPROP_REG8,    offsetof(struct registers, H) },
+  { "L",  EXPROP_REG8,    offsetof(struct registers, L) },
+  { "BC", EXPROP_REGPAIR, offsetof(struct registers, B) },
+  { "DE", EXPROP_REGPAIR, offsetof(struct registers, D) },
+  { "HL", EXPROP_REGPAIR, offsetof(struct registers, H) },
+  { "SP", EXPROP_SP,      0 },
+  { "PC", EXPROP_PC,      0 },
+  { "CY", EXPROP_FLAG,    FLG_CARRY },
+  { "Z",  EXPROP_FLAG,    FLG_ZERO },
+  { "S",  EXPROP_FLAG,    FLG_SIGN },
+  { "P",  EXPROP_FLAG,    FLG_PARITY },
+  { "AC", EXPROP_FLAG,    FLG_AUXCRY },
+};
+
+
+/*
+  ---------------------------------------------------------------------
+                              Compiler
+  ---------------------------------------------------------------------
+ */
+
+struct expr_compiler
+{
+  char*                cursor;
+  struct expr_program* program;
+  u8                   depth;
+  char*                error;
+};
+
+internal bool
+Expr_ParseBinary(struct expr_compiler* compiler, u8 level);
+
+internal void
+Expr_SkipSpace(struct expr_compiler* compiler)
+{
+  while (*compiler->cursor == ' ' ||
+         *compiler->cursor == '\t')
+    ++compiler->cursor;
+}
+
+internal bool
+Expr_Fail(struct expr_compiler* compiler, char* message)
+{
+  if (!compiler->error)
+    compiler->error = message;
+  return false;
+}
+
+internal bool
+Expr_Emit(struct expr_compiler* compiler, u8 byte)
+{
+  struct expr_program* program = compiler->program;
+
+  if (program->length == EXPR_MAX_CODE)
+    return Expr_Fail(compiler, "expression too long");
+  program->code[program->length++] = byte;
+  return true;
+}
+
+/*
+  Track the evaluation stack depth the emitted code will need so the
+  evaluator never has to check for overflow.
+*/
+internal bool
+Expr_Push(struct expr_compiler* compiler)
+{
+  if (++compiler->depth > EXPR_MAX_STACK)
+    return Expr_Fail(compiler, "expression too complex");
+  return true;
+}
+
+internal bool
+Expr_ParseOperand(struct expr_compiler* compiler)
+{
+  char* start;
+  u32   length;
+  u32   i;
+
+  Expr_SkipSpace(compiler);
+  start = compiler->cursor;
+
+  if (*start == '(')
+  {
+    ++compiler->cursor;
+    if (!Expr_ParseBinary(compiler, 0))
+      return false;
+    Expr_SkipSpace(compiler);
+    if (*compiler->cursor != ')')
+      return Expr_Fail(compiler, "expected ')'");
+    ++compiler->cursor;
+    return true;
+  }
+
+  if (*start == '[')
+  {
+    ++compiler->cursor;
+    if (!Expr_ParseBinary(compiler, 0))
+      return false;
+    Expr_SkipSpace(compiler);
+    if (*compiler->cursor != ']')
+      return Expr_Fail(compiler, "expected ']'");
+    ++compiler->cursor;
+    return Expr_Emit(compiler, EXPROP_LOAD);
+  }
+
+  if (*start == '!' || *start == '~' || *start == '-')
+  {
+    u8 opcode = (*start == '!') ? EXPROP_NOT :
+                (*start == '~') ? EXPROP_COMPLEMENT : EXPROP_NEGATE;
+    ++compiler->cursor;
+    if (!Expr_ParseOperand(compiler))
+      return false;
+    return Expr_Emit(compiler, opcode);
+  }
+
+  if (isdigit(*start))
+  {
+    unsigned long value = strtoul(start, &compiler->cursor, 0);
+    if (value > 0xffff)
+      return Expr_Fail(compiler, "number out of range");
+    return Expr_Push(compiler) &&
+           Expr_Emit(compiler, EXPROP_CONST) &&
+           Expr_Emit(compiler, (u8)value) &&
+           Expr_Emit(compiler, (u8)(value >> 8));
+  }
+
+  while (isalpha(*compiler->cursor))
+    ++compiler->cursor;
+  length = compiler->cursor - start;
+  if (!length)
+    return Expr_Fail(compiler, "expected an operand");
+
+  for (i = 0; i < sizeof(operandNames) / sizeof(operandNames[0]); ++i)
+  {
+    struct expr_operand_name* name = &operandNames[i];
+    if (strlen(name->name) == length &&
+        strncasecmp(name->name, start, length) == 0)
+    {
+      if (!Expr_Push(compiler) ||
+          !Expr_Emit(compiler, name->opcode))
+        return false;
+      if (name->opcode == EXPROP_REG8    ||
+          name->opcode == EXPROP_REGPAIR ||
+          name->opcode == EXPROP_FLAG)
+        return Expr_Emit(compiler, name->operand);
+      return true;
+    }
+  }
+  return Expr_Fail(compiler, "unknown register or flag");
+}
+
+struct expr_operator
+{
+  char* token;
+  u8    level;
+  u8    opcode;
+};
+
+/* Longer tokens come first so "<=" is not read as "<" */
+internal struct expr_operator operators[] =
+{
+  { "||", 0, EXPROP_LOGICALOR },
+  { "&&", 1, EXPROP_LOGICALAND },
+  { "==", 5, EXPROP_EQ },
+  { "!=", 5, EXPROP_NE },
+  { "<=", 6, EXPROP_LE },
+  { ">=", 6, EXPROP_GE },
+  { "|",  2, EXPROP_OR },
+  { "^",  3, EXPROP_XOR },
+  { "&",  4, EXPROP_AND },
+  { "<",  6, EXPROP_LT },
+  { ">",  6, EXPROP_GT },
+  { "+",  7, EXPROP_ADD },
+  { "-",  7, EXPROP_SUB },
+};
+
+#define EXPR_NUM_LEVELS 8
+
+internal struct expr_operator*
+Expr_MatchOperator(struct expr_compiler* compiler, u8 level)
+{
+  u32 i;
+
+  Expr_SkipSpace(compiler);
+  for (i = 0; i < sizeof(operators) / sizeof(operators[0]); ++i)
+  {
+    struct expr_operator* op = &operators[i];
+    if (strncmp(compiler->cursor, op->token, strlen(op->token)) == 0)
+      return (op->level == level) ? op : 0;
+  }
+  return 0;
+}
+
+/*
+  Precedence climbing: parse a chain of operators at 'level', with
+  operands made of anything binding more tightly.
+*/
+internal bool
+Expr_ParseBinary(struct expr_compiler* compiler, u8 level)
+{
+  struct expr_operator* op;
+
+  if (level == EXPR_NUM_LEVELS)
+    return Expr_ParseOperand(compiler);
+
+  if (!Expr_ParseBinary(compiler, level + 1))
+    return false;
+
+  while ((op = Expr_MatchOperator(compiler, level)))
+  {
+    compiler->cursor += strlen(op->token);
+    if (!Expr_ParseBinary(compiler, level + 1) ||
+        !Expr_Emit(compiler, op->opcode))
+      return false;
+    --compiler->depth;
+  }
+  return true;
+}
+
+/*
+  Expr_Compile()
+
+  Compile 'source' into 'program'. On failure returns false and points
+  'errorMessage' at a description of the problem.
+*/
+bool
+Expr_Compile(char* source, struct expr_program* program, char** errorMessage)
+{
+  struct expr_compiler compiler;
+
+  compiler.cursor  = source;
+  compiler.program = program;
+  compiler.depth   = 0;
+  compiler.error   = 0;
+  program->length  = 0;
+
+  if (Expr_ParseBinary(&compiler, 0))
+  {
+    Expr_SkipSpace(&compiler);
+    if (*compiler.cursor)
+      Expr_Fail(&compiler, "unexpected text after expression");
+    else
+      Expr_Emit(&compiler, EXPROP_END);
+  }
+
+  if (compiler.error)
+  {
+    if (errorMessage)
+      *errorMessage = compiler.error;
+    return false;
+  }
+  return true;
+}
+
+
+/*
+  ---------------------------------------------------------------------
+                              Evaluator
+  ---------------------------------------------------------------------
+ */
+
+u32
+Expr_Evaluate(struct expr_program* program)
+{
+  const struct registers* cpuRegs;
+  const byte_t*           regBytes;
+  u32  stack[EXPR_MAX_STACK];
+  u32* top;
+  u8*  pc;
+
+  cpuRegs  = CPU_GetRegisters();
+  regBytes = (const byte_t*)cpuRegs;
+  top      = stack - 1;
+  pc       = program->code;
+
+  for (;;)
+  {
+    switch (*pc++)
+    {
+    case EXPROP_CONST:
+      {
+        *++top = pc[0] | (pc[1] << 8);
+        pc += 2;
+        break;
+      }
+    case EXPROP_REG8:
+      {
+        *++top = regBytes[*pc++];
+        break;
+      }
+    case EXPROP_REGPAIR:
+      {
+        *++top = (regBytes[pc[0]] << 8) | regBytes[pc[0] + 1];
+        ++pc;
+        break;
+      }
+    case EXPROP_SP:
+      {
+        *++top = cpuRegs->SP;
+        break;
+      }
+    case EXPROP_PC:
+      {
+        *++top = cpuRegs->PC;
+        break;
+      }
+    case EXPROP_FLAG:
+      {
+        *++top = (cpuRegs->F & *pc++) != 0;
+        break;
+      }
+    case EXPROP_LOAD:
+      {
+        *top = Mem_ReadByte((word_t)*top);
+        break;
+      }
+
+    case EXPROP_NOT:        { *top = !*top;           break; }
+    case EXPROP_COMPLEMENT: { *top = ~*top & 0xffff;  break; }
+    case EXPROP_NEGATE:     { *top = -*top & 0xffff;  break; }
+
+    case EXPROP_ADD:        { --top; top[0] = (top[0] + top[1]) & 0xffff; break; }
+    case EXPROP_SUB:        { --top; top[0] = (top[0] - top[1]) & 0xffff; break; }
+    case EXPROP_AND:        { --top; top[0] &= top[1];                    break; }
+    case EXPROP_XOR:        { --top; top[0] ^= top[1];                    break; }
+    case EXPROP_OR:         { --top; top[0] |= top[1];                    break; }
+    case EXPROP_EQ:         { --top; top[0] = top[0] == top[1];           break; }
+    case EXPROP_NE:         { --top; top[0] = top[0] != top[1];           break; }
+    case EXPROP_LT:         { --top; top[0] = top[0] <  top[1];           break; }
+    case EXPROP_LE:         { --top; top[0] = top[0] <= top[1];           break; }
+    case EXPROP_GT:         { --top; top[0] = top[0] >  top[1];           break; }
+    case EXPROP_GE:         { --top; top[0] = top[0] >= top[1];           break; }
+    case EXPROP_LOGICALAND: { --top; top[0] = top[0] && top[1];           break; }
+    case EXPROP_LOGICALOR:  { --top; top[0] = top[0] || top[1];           break; }
+
+    case EXPROP_END:
+    default:
+      {
+        return *top;
+      }
+    }
+  }
+}
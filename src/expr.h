@@ -0,0 +1,41 @@
+#ifndef __EXPR_H__
+#define __EXPR_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  Debugger expressions, e.g. "A==0x20 && [HL]>5".
+
+  Expressions are compiled once into a small stack bytecode which is
+  evaluated directly against the CPU state, so conditions tested on
+  every breakpoint hit never touch the source text again.
+
+  Operands: numbers (C notation), registers A B C D E H L, register
+  pairs BC DE HL SP PC, flags CY Z S P AC (0 or 1), and [expr] for the
+  memory byte at an address.
+
+  Operators, lowest precedence first:
+      ||   &&   |   ^   &   == !=   < <= > >=   + -   unary ! ~ -
+*/
+
+#define EXPR_MAX_CODE    64
+#define EXPR_MAX_STACK   16
+
+struct expr_program
+{
+  u8 code[EXPR_MAX_CODE];
+  u8 length;
+};
+
+
+bool
+Expr_Compile(char* source, struct expr_program* program, char** errorMessage);
+
+u32
+Expr_Evaluate(struct expr_program* program);
+
+
+#endif    /* __EXPR_H__ */
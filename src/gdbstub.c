@@ -0,0 +1,690 @@
+#include "breakpoint.h"
+#include "cpu.h"
+#include "gdbstub.h"
+#include "log.h"
+#include "memory.h"
+#include "throttle.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+
+#define GDB_NUM_REGS   13
+
+/* GDB's z80 register numbers that the 8080 has */
+enum
+{
+  GDB_REG_AF,
+  GDB_REG_BC,
+  GDB_REG_DE,
+  GDB_REG_HL,
+  GDB_REG_SP,
+  GDB_REG_PC
+};
+
+/* Signals reported in stop replies */
+#define GDB_SIGINT    2
+#define GDB_SIGTRAP   5
+
+
+internal const char hexDigits[] = "0123456789abcdef";
+
+internal int    connection = -1;
+internal byte_t readBuffer[GDB_MAX_PACKET];
+internal u32    readStart;
+internal u32    readEnd;
+
+internal char   packet[GDB_MAX_PACKET + 1];
+/* Room for the framing around a full packet */
+internal char   reply[GDB_MAX_PACKET + 4];
+
+internal u8     lastStopReason;
+
+
+internal int
+Gdb_ReadByte()
+{
+  if (readStart == readEnd)
+  {
+    ssize_t received = recv(connection, readBuffer, sizeof(readBuffer), 0);
+    if (received <= 0)
+      return -1;
+    readStart = 0;
+    readEnd   = received;
+  }
+  return readBuffer[readStart++];
+}
+
+internal bool
+Gdb_WriteAll(const char* data, u32 length)
+{
+  while (length)
+  {
+    ssize_t sent = send(connection, data, length, 0);
+    if (sent <= 0)
+      return false;
+    data   += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+internal int
+Gdb_HexValue(int c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/*
+  Gdb_ParseHex()
+
+  Parse a hex number at *text and leave *text just past it.
+*/
+internal u32
+Gdb_ParseHex(char** text)
+{
+  u32 value = 0;
+  int digit;
+
+  while ((digit = Gdb_HexValue(**text)) >= 0)
+  {
+    value = (value << 4) | digit;
+    ++*text;
+  }
+  return value;
+}
+
+/*
+  Gdb_ReceivePacket()
+
+  Wait for the next packet and acknowledge it. Returns its length, or
+  -1 once the connection closes.
+*/
+internal int
+Gdb_ReceivePacket()
+{
+  for (;;)
+  {
+    int c;
+    u32 length;
+    u8  checksum;
+    int high;
+    int low;
+
+    do
+    {
+      c = Gdb_ReadByte();
+      if (c < 0)
+        return -1;
+    } while (c != '$');
+
+    length   = 0;
+    checksum = 0;
+    while ((c = Gdb_ReadByte()) != '#')
+    {
+      if (c < 0)
+        return -1;
+      if (length < GDB_MAX_PACKET)
+        packet[length++] = c;
+      checksum += c;
+    }
+    packet[length] = '\0';
+
+    high = Gdb_HexValue(Gdb_ReadByte());
+    low  = Gdb_HexValue(Gdb_ReadByte());
+    if (high >= 0 && low >= 0 &&
+        ((high << 4) | low) == checksum)
+    {
+      Gdb_WriteAll("+", 1);
+      return length;
+    }
+    Gdb_WriteAll("-", 1);
+  }
+}
+
+/*
+  Gdb_SendPacket()
+
+  Frame 'length' bytes already placed at reply + 1 and send them,
+  resending until the debugger acknowledges the packet.
+*/
+internal bool
+Gdb_SendPacket(u32 length)
+{
+  u8 checksum = 0;
+  u32 i;
+
+  reply[0] = '$';
+  for (i = 1; i <= length; ++i)
+    checksum += reply[i];
+  reply[length + 1] = '#';
+  reply[length + 2] = hexDigits[checksum >> 4];
+  reply[length + 3] = hexDigits[checksum & 0xf];
+
+  for (;;)
+  {
+    int c;
+
+    if (!Gdb_WriteAll(reply, length + 4))
+      return false;
+    do
+    {
+      c = Gdb_ReadByte();
+      if (c < 0)
+        return false;
+    } while (c != '+' && c != '-');
+    if (c == '+')
+      return true;
+  }
+}
+
+internal bool
+Gdb_SendString(const char* string)
+{
+  u32 length = strlen(string);
+
+  memcpy(reply + 1, string, length);
+  return Gdb_SendPacket(length);
+}
+
+internal char*
+Gdb_EncodeByte(char* out, byte_t value)
+{
+  *out++ = hexDigits[value >> 4];
+  *out++ = hexDigits[value & 0xf];
+  return out;
+}
+
+internal word_t
+Gdb_GetRegister(u32 number)
+{
+  const struct registers* regs = CPU_GetRegisters();
+
+  switch (number)
+  {
+  case GDB_REG_AF: { return (regs->A << 8) | regs->F; }
+  case GDB_REG_BC: { return (regs->B << 8) | regs->C; }
+  case GDB_REG_DE: { return (regs->D << 8) | regs->E; }
+  case GDB_REG_HL: { return (regs->H << 8) | regs->L; }
+  case GDB_REG_SP: { return regs->SP; }
+  case GDB_REG_PC: { return regs->PC; }
+  default:         { return 0; }
+  }
+}
+
+internal void
+Gdb_SetRegister(u32 number, word_t value)
+{
+  struct cpu_state state;
+
+  CPU_SaveState(&state);
+  switch (number)
+  {
+  case GDB_REG_AF: { state.regs.A = value >> 8; state.regs.F = (byte_t)value; break; }
+  case GDB_REG_BC: { state.regs.B = value >> 8; state.regs.C = (byte_t)value; break; }
+  case GDB_REG_DE: { state.regs.D = value >> 8; state.regs.E = (byte_t)value; break; }
+  case GDB_REG_HL: { state.regs.H = value >> 8; state.regs.L = (byte_t)value; break; }
+  case GDB_REG_SP: { state.regs.SP = value; break; }
+  case GDB_REG_PC: { state.regs.PC = value; break; }
+  default:         { return; }
+  }
+  CPU_RestoreState(&state);
+}
+
+/* Registers travel as little endian hex */
+internal char*
+Gdb_EncodeRegister(char* out, u32 number)
+{
+  word_t value = Gdb_GetRegister(number);
+
+  out = Gdb_EncodeByte(out, (byte_t)value);
+  return Gdb_EncodeByte(out, value >> 8);
+}
+
+internal bool
+Gdb_DecodeRegister(char** text, word_t* value)
+{
+  int digits[4];
+  u32 i;
+
+  for (i = 0; i < 4; ++i)
+  {
+    digits[i] = Gdb_HexValue((*text)[i]);
+    if (digits[i] < 0)
+      return false;
+  }
+  *value = (digits[2] << 12) | (digits[3] << 8) | (digits[0] << 4) | digits[1];
+  *text += 4;
+  return true;
+}
+
+internal bool
+Gdb_SendStopReply()
+{
+  char text[32];
+
+  switch (lastStopReason)
+  {
+  case CPU_STOP_REQUESTED:
+    {
+      sprintf(text, "S%02x", GDB_SIGINT);
+      break;
+    }
+
+  case CPU_STOP_WATCHPOINT:
+    {
+      sprintf(text, "T%02xwatch:%04x;", GDB_SIGTRAP, CPU_GetWatchAddress());
+      break;
+    }
+
+  default:
+    {
+      sprintf(text, "S%02x", GDB_SIGTRAP);
+      break;
+    }
+  }
+  return Gdb_SendString(text);
+}
+
+/*
+  Gdb_PollForInterrupt()
+
+  Called by CPU_Run() at least every GDB_POLL_CYCLES cycles while the
+  guest runs, to see whether the debugger has sent a ^C. Every byte
+  already buffered or waiting on the connection is looked at; anything
+  else the debugger sends while the guest runs, such as a stray ack, is
+  discarded.
+*/
+internal void
+Gdb_PollForInterrupt(void)
+{
+  struct pollfd fd;
+
+  fd.fd     = connection;
+  fd.events = POLLIN;
+  while (readStart != readEnd ||
+         poll(&fd, 1, 0) > 0)
+  {
+    int c = Gdb_ReadByte();
+    if (c < 0 || c == 0x03)
+    {
+      CPU_RequestStop();
+      break;
+    }
+  }
+}
+
+internal void
+Gdb_Continue()
+{
+  struct cpu_state state;
+
+  CPU_SetHostPoll(Gdb_PollForInterrupt, GDB_POLL_CYCLES);
+  lastStopReason = Throttle_Run(CPU_NO_CYCLELIMIT);
+  CPU_SetHostPoll(0, 0);
+
+  /* Halted with interrupts enabled and nothing scheduled to raise one:
+     a real 8080 would wait forever, so block until the debugger sends
+     a ^C or hangs up */
+  CPU_SaveState(&state);
+  if (lastStopReason == CPU_STOP_HALTED && state.interruptsEnabled)
+  {
+    int c;
+
+    do
+      c = Gdb_ReadByte();
+    while (c >= 0 && c != 0x03);
+    lastStopReason = CPU_STOP_REQUESTED;
+  }
+}
+
+/*
+  Gdb_ReadMemory()
+
+  'm addr,length': hex encoded straight out of guest memory. Bytes
+  beyond the end of memory read as zero.
+*/
+internal bool
+Gdb_ReadMemory(char* args)
+{
+  const byte_t* memory  = Mem_GetBase();
+  u32           memSize = Mem_GetSize();
+  u32           address;
+  u32           length;
+  char*         out;
+
+  address = Gdb_ParseHex(&args);
+  if (*args++ != ',')
+    return Gdb_SendString("E01");
+  length = Gdb_ParseHex(&args);
+  if (length > GDB_MAX_PACKET / 2)
+    length = GDB_MAX_PACKET / 2;
+
+  out = reply + 1;
+  for (; length; --length, ++address)
+    out = Gdb_EncodeByte(out, (address < memSize) ? memory[address] : 0);
+  return Gdb_SendPacket(out - (reply + 1));
+}
+
+/*
+  Gdb_WriteMemory()
+
+  'M addr,length:data'. Debugger writes go straight into guest memory
+  and do not trigger watchpoints or history.
+*/
+internal bool
+Gdb_WriteMemory(char* args)
+{
+  byte_t* memory  = Mem_GetBase();
+  u32     memSize = Mem_GetSize();
+  u32     address;
+  u32     length;
+
+  address = Gdb_ParseHex(&args);
+  if (*args++ != ',')
+    return Gdb_SendString("E01");
+  length = Gdb_ParseHex(&args);
+  if (*args++ != ':' ||
+      strlen(args) < length * 2 ||
+      address + length > memSize)
+    return Gdb_SendString("E01");
+
+  Mem_MarkModified(address, length);
+  for (; length; --length, ++address, args += 2)
+  {
+    int high = Gdb_HexValue(args[0]);
+    int low  = Gdb_HexValue(args[1]);
+    if (high < 0 || low < 0)
+      return Gdb_SendString("E01");
+    memory[address] = (high << 4) | low;
+  }
+  return Gdb_SendString("OK");
+}
+
+/*
+  Gdb_Breakpoint()
+
+  'Z type,addr,kind' and 'z type,addr,kind'. Software and hardware
+  breakpoints are the same thing here; only write watchpoints are
+  supported.
+*/
+internal bool
+Gdb_Breakpoint(char* args, bool insert)
+{
+  u32 type;
+  u32 address;
+  u32 length;
+  bool ok;
+
+  type = Gdb_ParseHex(&args);
+  if (*args++ != ',')
+    return Gdb_SendString("E01");
+  address = Gdb_ParseHex(&args);
+  if (*args++ != ',')
+    return Gdb_SendString("E01");
+  length = Gdb_ParseHex(&args);
+  if (address > 0xffff)
+    return Gdb_SendString("E01");
+
+  switch (type)
+  {
+  case 0:
+  case 1:
+    {
+      if (insert)
+        ok = Bp_Set(address) || Bp_IsSet(address);
+      else
+        ok = Bp_Clear(address);
+      break;
+    }
+
+  case 2:
+    {
+      if (insert)
+        ok = Bp_SetWatch(address, length);
+      else
+        ok = Bp_ClearWatch(address, length);
+      break;
+    }
+
+  default:
+    {
+      return Gdb_SendString("");
+    }
+  }
+  return Gdb_SendString(ok ? "OK" : "E01");
+}
+
+/*
+  Gdb_HandlePacket()
+
+  Returns false once the session is over.
+*/
+internal bool
+Gdb_HandlePacket(char* text)
+{
+  char* args = text + 1;
+
+  switch (text[0])
+  {
+  case '?':
+    {
+      return Gdb_SendStopReply();
+    }
+
+  case 'g':
+    {
+      char* out = reply + 1;
+      u32   i;
+
+      for (i = 0; i < GDB_NUM_REGS; ++i)
+        out = Gdb_EncodeRegister(out, i);
+      return Gdb_SendPacket(out - (reply + 1));
+    }
+
+  case 'G':
+    {
+      word_t value;
+      u32    i;
+
+      for (i = 0; i < GDB_NUM_REGS && Gdb_DecodeRegister(&args, &value); ++i)
+        Gdb_SetRegister(i, value);
+      return Gdb_SendString("OK");
+    }
+
+  case 'p':
+    {
+      u32 number = Gdb_ParseHex(&args);
+
+      if (number >= GDB_NUM_REGS)
+        return Gdb_SendString("E01");
+      return Gdb_SendPacket(Gdb_EncodeRegister(reply + 1, number) - (reply + 1));
+    }
+
+  case 'P':
+    {
+      u32    number = Gdb_ParseHex(&args);
+      word_t value;
+
+      if (number >= GDB_NUM_REGS || *args++ != '=' ||
+          !Gdb_DecodeRegister(&args, &value))
+        return Gdb_SendString("E01");
+      Gdb_SetRegister(number, value);
+      return Gdb_SendString("OK");
+    }
+
+  case 'm':
+    {
+      return Gdb_ReadMemory(args);
+    }
+
+  case 'M':
+    {
+      return Gdb_WriteMemory(args);
+    }
+
+  case 'Z':
+  case 'z':
+    {
+      return Gdb_Breakpoint(args, text[0] == 'Z');
+    }
+
+  case 'c':
+  case 's':
+    {
+      if (*args)
+        Gdb_SetRegister(GDB_REG_PC, Gdb_ParseHex(&args));
+      if (text[0] == 'c')
+        Gdb_Continue();
+      else
+      {
+        CPU_Step();
+        lastStopReason = CPU_STOP_BREAKPOINT;
+      }
+      return Gdb_SendStopReply();
+    }
+
+  case 'k':
+    {
+      return false;
+    }
+
+  case 'D':
+    {
+      Gdb_SendString("OK");
+      return false;
+    }
+
+  case 'H':
+    {
+      return Gdb_SendString("OK");
+    }
+
+  case 'q':
+    {
+      char features[32];
+
+      if (strncmp(args, "Supported", 9) == 0)
+      {
+        sprintf(features, "PacketSize=%x", GDB_MAX_PACKET);
+        return Gdb_SendString(features);
+      }
+      if (strcmp(args, "Attached") == 0)
+        return Gdb_SendString("1");
+      if (strncmp(args, "Symbol", 6) == 0)
+        return Gdb_SendString("OK");
+      return Gdb_SendString("");
+    }
+
+  default:
+    {
+      /* An empty reply tells the debugger the packet is unsupported */
+      return Gdb_SendString("");
+    }
+  }
+}
+
+internal int
+Gdb_Listen(char* address)
+{
+  int listener;
+
+  if (strchr(address, '/'))
+  {
+    struct sockaddr_un local;
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+      return -1;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strncpy(local.sun_path, address, sizeof(local.sun_path) - 1);
+    unlink(local.sun_path);
+    if (bind(listener, (struct sockaddr*)&local, sizeof(local)) < 0)
+    {
+      close(listener);
+      return -1;
+    }
+  }
+  else
+  {
+    struct sockaddr_in local;
+    int                reuse = 1;
+
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+      return -1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    memset(&local, 0, sizeof(local));
+    local.sin_family      = AF_INET;
+    local.sin_port        = htons(strtoul(address, 0, 10));
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr*)&local, sizeof(local)) < 0)
+    {
+      close(listener);
+      return -1;
+    }
+  }
+
+  if (listen(listener, 1) < 0)
+  {
+    close(listener);
+    return -1;
+  }
+  return listener;
+}
+
+
+/*
+  Gdb_Serve()
+
+  Wait for a debugger to connect on 'address' and serve it until it
+  kills the program or detaches.
+*/
+bool
+Gdb_Serve(char* address)
+{
+  int listener;
+  int noDelay = 1;
+
+  listener = Gdb_Listen(address);
+  if (listener < 0)
+  {
+    fprintf(stderr, "gdb: cannot listen on %s\n", address);
+    return false;
+  }
+
+  fprintf(stderr, "Waiting for gdb on %s\n", address);
+  connection = accept(listener, 0, 0);
+  close(listener);
+  if (connection < 0)
+  {
+    fprintf(stderr, "gdb: accept failed\n");
+    return false;
+  }
+  setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+  readStart      = 0;
+  readEnd        = 0;
+  lastStopReason = CPU_STOP_BREAKPOINT;
+  while (Gdb_ReceivePacket() >= 0)
+  {
+    if (!Gdb_HandlePacket(packet))
+      break;
+  }
+
+  close(connection);
+  connection = -1;
+  return true;
+}
@@ -0,0 +1,34 @@
+#ifndef __GDBSTUB_H__
+#define __GDBSTUB_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  GDB remote serial protocol stub.
+
+  Listens on a localhost TCP port, or on a Unix socket if the address
+  contains a '/', and serves a single debugger connection. Supported
+  packets are ?, g, G, p, P, m, M, c, s, k, D, Z0/z0 and Z1/z1
+  breakpoints, and Z2/z2 write watchpoints. The guest runs at full
+  speed between stops; CPU_Run() polls the socket for a ^C from the
+  debugger every GDB_POLL_CYCLES cycles, and a guest halted with
+  nothing to wake it waits in a blocking read instead.
+
+  GDB has no 8080 target, so registers follow its z80 layout: AF, BC,
+  DE, HL, SP, PC, IX, IY, AF', BC', DE', HL', IR, each 16 bits and
+  little endian. Registers the 8080 lacks read as zero and ignore
+  writes.
+*/
+
+#define GDB_MAX_PACKET    4096
+#define GDB_POLL_CYCLES   100000
+
+
+bool
+Gdb_Serve(char* address);
+
+
+#endif    /* __GDBSTUB_H__ */
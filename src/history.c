@@ -0,0 +1,302 @@
+#include "cpu.h"
+#include "history.h"
+#include "log.h"
+#include "memory.h"
+#include "sched.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+struct hist_record
+{
+  struct cpu_state state;
+  /* Position of this instruction's first entry in the write ring */
+  u64              firstWrite;
+};
+
+struct hist_write
+{
+  word_t address;
+  byte_t oldValue;
+};
+
+struct hist_checkpoint
+{
+  struct cpu_state   state;
+  struct sched_state sched;
+  u64                instructionIndex;
+  byte_t*            memory;
+};
+
+/*
+  Ring positions are kept as ever-increasing counts and reduced modulo
+  the ring size on access, which makes it easy to tell which entries
+  have been overwritten.
+*/
+internal struct hist_record*     records;
+internal struct hist_write*      writes;
+internal struct hist_checkpoint  checkpoints[HIST_MAX_CHECKPOINTS];
+
+internal bool histEnabled;
+/* Index of the next instruction to be recorded */
+internal u64  instructionIndex;
+/* Oldest instruction that can still be undone */
+internal u64  oldestRecord;
+internal u64  writeHead;
+internal u32  checkpointCount;
+internal u32  newestCheckpoint;
+
+
+void
+Hist_Init()
+{
+  u32 i;
+
+  if (!records)
+  {
+    records = (struct hist_record*)malloc(HIST_MAX_RECORDS * sizeof(struct hist_record));
+    writes  = (struct hist_write*)malloc(HIST_MAX_WRITES * sizeof(struct hist_write));
+  }
+  for (i = 0; i < HIST_MAX_CHECKPOINTS; ++i)
+  {
+    free(checkpoints[i].memory);
+    checkpoints[i].memory = 0;
+  }
+
+  histEnabled      = false;
+  instructionIndex = 0;
+  oldestRecord     = 0;
+  writeHead        = 0;
+  checkpointCount  = 0;
+  newestCheckpoint = 0;
+}
+
+/*
+  Hist_SetEnabled()
+
+  Turn recording on or off. History from before recording was last
+  turned off is discarded, since it has a gap.
+*/
+void
+Hist_SetEnabled(bool enabled)
+{
+  if (enabled && !histEnabled)
+  {
+    instructionIndex = 0;
+    oldestRecord     = 0;
+    checkpointCount  = 0;
+    newestCheckpoint = 0;
+  }
+  histEnabled = enabled;
+  CPU_EnableHook(CPU_HOOK_HISTORY, enabled);
+  Mem_EnableWriteHook(MEM_HOOK_HISTORY, enabled);
+}
+
+bool
+Hist_IsEnabled()
+{
+  return histEnabled;
+}
+
+internal void
+Hist_TakeCheckpoint()
+{
+  struct hist_checkpoint* checkpoint;
+  u32 memSize;
+
+  memSize = Mem_GetSize();
+  if (checkpointCount)
+    newestCheckpoint = (newestCheckpoint + 1) % HIST_MAX_CHECKPOINTS;
+  if (checkpointCount < HIST_MAX_CHECKPOINTS)
+    ++checkpointCount;
+
+  checkpoint = &checkpoints[newestCheckpoint];
+  if (!checkpoint->memory)
+    checkpoint->memory = (byte_t*)malloc(memSize);
+  memcpy(checkpoint->memory, Mem_GetBase(), memSize);
+  CPU_SaveState(&checkpoint->state);
+  Sched_SaveState(&checkpoint->sched);
+  checkpoint->instructionIndex = instructionIndex;
+}
+
+/*
+  Hist_BeginInstruction()
+
+  Called by the CPU before it executes an instruction (or accepts an
+  interrupt) while history is enabled.
+*/
+void
+Hist_BeginInstruction()
+{
+  struct hist_record* record;
+
+  if (instructionIndex % HIST_CHECKPOINT_INTERVAL == 0)
+    Hist_TakeCheckpoint();
+
+  if (instructionIndex - oldestRecord == HIST_MAX_RECORDS)
+    ++oldestRecord;
+
+  record = &records[instructionIndex % HIST_MAX_RECORDS];
+  CPU_SaveState(&record->state);
+  record->firstWrite = writeHead;
+  ++instructionIndex;
+}
+
+void
+Hist_RecordWrite(word_t address, byte_t oldValue)
+{
+  struct hist_write* write;
+
+  write = &writes[writeHead % HIST_MAX_WRITES];
+  write->address  = address;
+  write->oldValue = oldValue;
+  ++writeHead;
+
+  /* Drop undo records whose writes have just been overwritten */
+  while (oldestRecord < instructionIndex &&
+         records[oldestRecord % HIST_MAX_RECORDS].firstWrite + HIST_MAX_WRITES < writeHead)
+    ++oldestRecord;
+}
+
+/*
+  Number of instructions that can be undone from the undo ring alone.
+*/
+u64
+Hist_GetUndoDepth()
+{
+  return instructionIndex - oldestRecord;
+}
+
+/*
+  Number of instructions that can be gone back over, including by
+  re-executing from the oldest checkpoint.
+*/
+u64
+Hist_GetReachableDepth()
+{
+  u32 oldestCheckpoint;
+
+  if (!checkpointCount)
+    return Hist_GetUndoDepth();
+
+  oldestCheckpoint = (newestCheckpoint + HIST_MAX_CHECKPOINTS + 1 - checkpointCount) %
+                     HIST_MAX_CHECKPOINTS;
+  return instructionIndex - checkpoints[oldestCheckpoint].instructionIndex;
+}
+
+/*
+  Hist_StepBack()
+
+  Undo the most recent instruction. Returns false if the undo ring is
+  exhausted.
+*/
+bool
+Hist_StepBack()
+{
+  struct hist_record* record;
+  byte_t* memory;
+  u64     write;
+
+  if (instructionIndex == oldestRecord)
+    return false;
+
+  --instructionIndex;
+  record = &records[instructionIndex % HIST_MAX_RECORDS];
+  memory = Mem_GetBase();
+
+  /* Undo in reverse so a byte written twice ends up with its
+     original value */
+  for (write = writeHead; write > record->firstWrite; --write)
+  {
+    struct hist_write* entry = &writes[(write - 1) % HIST_MAX_WRITES];
+    memory[entry->address] = entry->oldValue;
+    Mem_MarkModified(entry->address, 1);
+  }
+  writeHead = record->firstWrite;
+  CPU_RestoreState(&record->state);
+
+  /* A checkpoint taken at the start of this instruction is taken
+     again when it is re-executed */
+  if (checkpointCount &&
+      checkpoints[newestCheckpoint].instructionIndex >= instructionIndex)
+  {
+    newestCheckpoint = (newestCheckpoint + HIST_MAX_CHECKPOINTS - 1) % HIST_MAX_CHECKPOINTS;
+    --checkpointCount;
+  }
+  return true;
+}
+
+/*
+  Hist_GoBack()
+
+  Return to the state 'instructionCount' instructions ago. Uses the
+  undo ring when it reaches that far; otherwise restores the newest
+  checkpoint at or before the target and re-executes forward to
+  it. Returns false, changing nothing, if the target is out of reach.
+
+  Re-execution also returns false if the CPU stops making progress,
+  such as at a halt nothing will interrupt, leaving it where it
+  stopped.
+*/
+bool
+Hist_GoBack(u64 instructionCount)
+{
+  struct hist_checkpoint* checkpoint;
+  u64 target;
+  u32 i;
+
+  if (instructionCount <= Hist_GetUndoDepth())
+  {
+    while (instructionCount--)
+      Hist_StepBack();
+    return true;
+  }
+  if (instructionCount > Hist_GetReachableDepth())
+    return false;
+
+  target = instructionIndex - instructionCount;
+  checkpoint = 0;
+  for (i = 0; i < checkpointCount; ++i)
+  {
+    checkpoint = &checkpoints[(newestCheckpoint + HIST_MAX_CHECKPOINTS - i) % HIST_MAX_CHECKPOINTS];
+    if (checkpoint->instructionIndex <= target)
+      break;
+  }
+
+#ifdef _DEBUG
+  Log_Debug("Hist_GoBack: replaying %llu instructions from checkpoint at %llu",
+            (unsigned long long)(target - checkpoint->instructionIndex),
+            (unsigned long long)checkpoint->instructionIndex);
+#endif
+
+  /* Rewind to the checkpoint; everything recorded after it is
+     discarded and recorded again as it re-executes */
+  memcpy(Mem_GetBase(), checkpoint->memory, Mem_GetSize());
+  Mem_MarkModified(0, Mem_GetSize());
+  CPU_RestoreState(&checkpoint->state);
+  Sched_RestoreState(&checkpoint->sched);
+  instructionIndex = checkpoint->instructionIndex;
+  oldestRecord     = instructionIndex;
+  checkpointCount -= i + 1;
+  newestCheckpoint = (newestCheckpoint + HIST_MAX_CHECKPOINTS - i - 1) % HIST_MAX_CHECKPOINTS;
+  if (!checkpointCount)
+    newestCheckpoint = 0;
+
+  CPU_BeginReplay();
+  while (instructionIndex < target)
+  {
+    u64 index = instructionIndex;
+    u64 cycle = CPU_GetCycleCount();
+
+    CPU_Step();
+    if (instructionIndex == index && CPU_GetCycleCount() == cycle)
+    {
+      CPU_EndReplay();
+      return false;
+    }
+  }
+  CPU_EndReplay();
+  return true;
+}
@@ -0,0 +1,60 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  Execution history for reverse debugging.
+
+  Before each instruction the CPU state is appended to a ring of undo
+  records, and every byte the instruction overwrites is logged with
+  its old value in a second ring. Undoing an instruction restores
+  those bytes and the saved state. Every HIST_CHECKPOINT_INTERVAL
+  instructions a full snapshot of memory and the CPU is also taken, so
+  stepping back further than the undo ring reaches is done by
+  restoring a checkpoint and re-executing forward.
+
+  Checkpoints also hold the scheduler queue, so events fire again at
+  the same cycles when re-executing. Device state is not part of the
+  history; re-execution assumes devices respond as they did the first
+  time. Undo records hold neither.
+*/
+
+#define HIST_MAX_RECORDS            (1 << 16)
+#define HIST_MAX_WRITES             (1 << 17)
+#define HIST_CHECKPOINT_INTERVAL    (1 << 16)
+#define HIST_MAX_CHECKPOINTS        16
+
+
+void
+Hist_Init();
+
+void
+Hist_SetEnabled(bool enabled);
+
+bool
+Hist_IsEnabled();
+
+void
+Hist_BeginInstruction();
+
+void
+Hist_RecordWrite(word_t address, byte_t oldValue);
+
+u64
+Hist_GetUndoDepth();
+
+u64
+Hist_GetReachableDepth();
+
+bool
+Hist_StepBack();
+
+bool
+Hist_GoBack(u64 instructionCount);
+
+
+#endif    /* __HISTORY_H__ */
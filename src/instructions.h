@@ -3,89 +3,6 @@
 
 #include "types.h"
 
-/*
-  Constants for each of the 8080's instruction types
-*/
-enum {
-      INSTR_ACI,
-      INSTR_ADC,
-      INSTR_ADD,
-      INSTR_ADI,
-      INSTR_ANA,
-      INSTR_ANI,
-      INSTR_CALL,
-      INSTR_CC,
-      INSTR_CM,
-      INSTR_CMA,
-      INSTR_CMC,
-      INSTR_CMP,
-      INSTR_CNC,
-      INSTR_CNZ,
-      INSTR_CP,
-      INSTR_CPE,
-      INSTR_CPI,
-      INSTR_CPO,
-      INSTR_CZ,
-      INSTR_DAA,
-      INSTR_DAD,
-      INSTR_DCR,
-      INSTR_DCX,
-      INSTR_DI,
-      INSTR_EI,
-      INSTR_HLT,
-      INSTR_IN,
-      INSTR_INR,
-      INSTR_INX,
-      INSTR_JC,
-      INSTR_JM,
-      INSTR_JMP,
-      INSTR_JNC,
-      INSTR_JNZ,
-      INSTR_JP,
-      INSTR_JPE,
-      INSTR_JPO,
-      INSTR_JZ,
-      INSTR_LDA,
-      INSTR_LDAX,
-      INSTR_LHLD,
-      INSTR_LXI,
-      INSTR_MOV,
-      INSTR_MVI,
-      INSTR_NOP,
-      INSTR_ORA,
-      INSTR_ORI,
-      INSTR_OUT,
-      INSTR_PCHL,
-      INSTR_POP,
-      INSTR_PUSH,
-      INSTR_RAL,
-      INSTR_RAR,
-      INSTR_RC,
-      INSTR_RET,
-      INSTR_RLC,
-      INSTR_RM,
-      INSTR_RNC,
-      INSTR_RNZ,
-      INSTR_RP,
-      INSTR_RPE,
-      INSTR_RPO,
-      INSTR_RRC,
-      INSTR_RST,
-      INSTR_RZ,
-      INSTR_SBB,
-      INSTR_SBI,
-      INSTR_SHLD,
-      INSTR_SPHL,
-      INSTR_STA,
-      INSTR_STAX,
-      INSTR_STC,
-      INSTR_SUB,
-      INSTR_SUI,
-      INSTR_XCHG,
-      INSTR_XRA,
-      INSTR_XRI,
-      INSTR_XTHL
-};
 
 
 
@@ -110,10 +27,10 @@ Execute_ANI();
 internal void
 Execute_CALL();
 
-internal void
+internal bool
 Execute_CC();
 
-internal void
+internal bool
 Execute_CM();
 
 internal void
@@ -125,25 +42,25 @@ Execute_CMC(void);
 internal void
 Execute_CMP(byte_t data);
 
-internal void
+internal bool
 Execute_CNC();
 
-internal void
+internal bool
 Execute_CNZ();
 
-internal void
+internal bool
 Execute_CP();
 
-internal void
+internal bool
 Execute_CPE();
 
 internal void
 Execute_CPI();
 
-internal void
+internal bool
 Execute_CPO();
 
-internal void
+internal bool
 Execute_CZ();
 
 internal void
@@ -176,31 +93,31 @@ Execute_INR(byte_t* byte);
 internal void
 Execute_INX(reg16_t reg);
 
-internal void
+internal bool
 Execute_JC();
 
-internal void
+internal bool
 Execute_JM();
 
 internal void
 Execute_JMP();
 
-internal void
+internal bool
 Execute_JNC();
 
-internal void
+internal bool
 Execute_JNZ();
 
-internal void
+internal bool
 Execute_JP();
 
-internal void
+internal bool
 Execute_JPE();
 
-internal void
+internal bool
 Execute_JPO();
 
-internal void
+internal bool
 Execute_JZ();
 
 internal void
@@ -248,7 +165,7 @@ Execute_RAL();
 internal void
 Execute_RAR();
 
-internal void
+internal bool
 Execute_RC();
 
 internal void
@@ -257,19 +174,22 @@ Execute_RET();
 internal void
 Execute_RLC();
 
-internal void
+internal bool
 Execute_RM();
 
-internal void
+internal bool
 Execute_RNC();
 
-internal void
+internal bool
+Execute_RNZ();
+
+internal bool
 Execute_RP();
 
-internal void
+internal bool
 Execute_RPE();
 
-internal void
+internal bool
 Execute_RPO();
 
 internal void
@@ -278,7 +198,7 @@ Execute_RRC();
 internal void
 Execute_RST();
 
-internal void
+internal bool
 Execute_RZ();
 
 internal void
@@ -0,0 +1,89 @@
+#include "io.h"
+#include "log.h"
+
+
+
+struct io_port
+{
+  io_read_t  read;
+  io_write_t write;
+  void*      userData;
+  u8         flags;
+};
+
+internal struct io_port ports[IO_NUM_PORTS];
+/* IN and OUT instructions executed, mapped or not */
+internal u64            readCount;
+internal u64            writeCount;
+
+
+void
+IO_Init()
+{
+  u32 i;
+
+  for (i = 0; i < IO_NUM_PORTS; ++i)
+  {
+    ports[i].read     = 0;
+    ports[i].write    = 0;
+    ports[i].userData = 0;
+    ports[i].flags    = 0;
+  }
+}
+
+/*
+  IO_RegisterPort()
+
+  Attach a device to a port. Either handler may be null if the device
+  is read- or write-only.
+*/
+void
+IO_RegisterPort(byte_t port, io_read_t read, io_write_t write,
+                void* userData, u8 flags)
+{
+  ports[port].read     = read;
+  ports[port].write    = write;
+  ports[port].userData = userData;
+  ports[port].flags    = flags;
+}
+
+byte_t
+IO_Read(byte_t port)
+{
+  struct io_port* ioPort = &ports[port];
+
+  ++readCount;
+  if (!ioPort->read)
+  {
+    LOG_DEBUG(LOG_CAT_IO, "IO_Read: unmapped port 0x%02x", port);
+    return IO_UNMAPPED_VALUE;
+  }
+  return ioPort->read(ioPort->userData, port);
+}
+
+void
+IO_Write(byte_t port, byte_t data)
+{
+  struct io_port* ioPort = &ports[port];
+
+  ++writeCount;
+  if (!ioPort->write)
+  {
+    LOG_DEBUG(LOG_CAT_IO, "IO_Write: unmapped port 0x%02x data=0x%02x", port, data);
+    return;
+  }
+  ioPort->write(ioPort->userData, port, data);
+}
+
+void
+IO_GetCallCounts(u64* reads, u64* writes)
+{
+  *reads  = readCount;
+  *writes = writeCount;
+}
+
+bool
+IO_IsPollable(byte_t port)
+{
+  return (ports[port].flags & IO_PORT_POLLABLE) != 0;
+}
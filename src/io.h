@@ -0,0 +1,52 @@
+#ifndef __IO_H__
+#define __IO_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  I/O port dispatch for the IN and OUT instructions.
+*/
+
+#define IO_NUM_PORTS        256
+
+/* Unmapped ports float high */
+#define IO_UNMAPPED_VALUE   0xff
+
+/*
+  Port flags.
+
+  IO_PORT_POLLABLE: The value read from the port only changes when the
+  device's state is changed by a scheduled event or an OUT; reading it
+  has no side effects. Busy-wait loops polling such a port can be
+  fast-forwarded to the next scheduled event.
+*/
+#define IO_PORT_POLLABLE    0x01
+
+typedef byte_t (*io_read_t)(void* userData, byte_t port);
+typedef void   (*io_write_t)(void* userData, byte_t port, byte_t data);
+
+
+void
+IO_Init();
+
+void
+IO_RegisterPort(byte_t port, io_read_t read, io_write_t write,
+                void* userData, u8 flags);
+
+byte_t
+IO_Read(byte_t port);
+
+void
+IO_Write(byte_t port, byte_t data);
+
+void
+IO_GetCallCounts(u64* reads, u64* writes);
+
+bool
+IO_IsPollable(byte_t port);
+
+
+#endif    /* __IO_H__ */
@@ -1,23 +1,518 @@
 #include "types.h"
 #include "log.h"
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+/* Longest formatted message and conversion specification */
+#define LOG_MAX_MESSAGE   512
+#define LOG_MAX_SPEC      32
+/* Formatted text the logging thread collects before writing it */
+#define LOG_BATCH_SIZE    (1 << 16)
+/* Longest the logging thread sleeps between looks at the rings when
+   nothing wakes it */
+#define LOG_IDLE_NS       1000000
+#define LOG_MIN_RING_ENTRIES  64
+
+/* A message as queued by Log_Write(), formatted later */
+struct log_entry
+{
+  const char* fmt;
+  u64         time;
+  u32         category;
+  u8          level;
+  u8          argCount;
+  u64         args[LOG_MAX_ARGS];
+};
+
+/*
+  One thread's queue. Only the owning thread advances 'head' and only
+  the logging thread advances 'tail'; both count up forever and are
+  masked to index 'entries'. 'writing' is set while the owner is
+  queueing, so Log_StopAsync() can wait for it to finish.
+*/
+struct log_ring
+{
+  _Atomic u32       head;
+  _Atomic u32       tail;
+  _Atomic u64       dropped;
+  atomic_bool       writing;
+  u32               mask;
+  u32               highWater;
+  struct log_ring*  next;
+  struct log_entry* entries;
+};
 
 internal FILE* dbgStream;
-internal u8    logVerbosity;
+internal u64   startTime;
+
+u8  g_logLevel;
+u32 g_logCategories;
+
+internal const char* levelNames[] = { "error", "warn", "info", "debug", "trace" };
+
+internal const char* categoryNames[] = { "cpu", "alu", "mem", "io", "dbg", "misc" };
+
+/* Every ring ever created; rings are pushed on the front and never
+   removed, so the logging thread can walk the list without a lock */
+internal struct log_ring* _Atomic  rings;
+internal _Thread_local struct log_ring* threadRing;
+
+internal atomic_bool asyncRunning;
+internal atomic_bool asyncStopping;
+internal pthread_t   logThread;
+/* Size of rings created from now on; a power of two */
+internal u32         ringEntries = LOG_DEFAULT_RING_ENTRIES;
+
+/* The logging thread waits on 'wake' while 'idle' is set; a producer
+   whose ring passes its high-water mark signals it */
+internal atomic_bool     idle;
+internal pthread_mutex_t wakeLock = PTHREAD_MUTEX_INITIALIZER;
+internal pthread_cond_t  wake     = PTHREAD_COND_INITIALIZER;
+
+
+internal u64
+Log_GetTimeNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
 
 void
 Log_Init()
 {
-  dbgStream    = stderr;
-  logVerbosity = 0;
+  dbgStream       = stderr;
+  startTime       = Log_GetTimeNs();
+  g_logLevel      = LOG_LEVEL_ERROR;
+  g_logCategories = LOG_CAT_ALL;
+}
+
+internal const char*
+Log_GetCategoryName(u32 category)
+{
+  u32 i;
+
+  for (i = 0; i < sizeof(categoryNames) / sizeof(categoryNames[0]); ++i)
+  {
+    if (category & (1 << i))
+      return categoryNames[i];
+  }
+  return "?";
+}
+
+/*
+  Log_FormatArgs()
+
+  printf() for arguments that have all been widened to u64. Each
+  conversion is narrowed back to the type its length modifier names
+  and handed to snprintf() on its own. Returns the length written.
+*/
+internal u32
+Log_FormatArgs(char* out, u32 size, const char* fmt, const u64* args, u32 argCount)
+{
+  u32 length = 0;
+  u32 argIndex = 0;
+
+  while (*fmt && length + 1 < size)
+  {
+    char        spec[LOG_MAX_SPEC];
+    u32         specLength;
+    u32         longs;
+    u32         shorts;
+    u64         arg;
+    int         written;
+
+    if (*fmt != '%' || fmt[1] == '%')
+    {
+      out[length++] = *fmt;
+      fmt += (*fmt == '%') ? 2 : 1;
+      continue;
+    }
+
+    /* Flags, width and precision are passed through; length
+       modifiers are replaced with 'll' */
+    specLength = 0;
+    spec[specLength++] = *fmt++;
+    while (*fmt && strchr("-+ #0123456789.", *fmt) && specLength < LOG_MAX_SPEC - 4)
+      spec[specLength++] = *fmt++;
+    longs  = 0;
+    shorts = 0;
+    while (*fmt && strchr("hljzt", *fmt))
+    {
+      if (*fmt == 'h')
+        ++shorts;
+      else
+        longs = 2;
+      ++fmt;
+    }
+    if (!*fmt)
+      break;
+
+    arg = (argIndex < argCount) ? args[argIndex++] : 0;
+    switch (*fmt)
+    {
+    case 'd':
+    case 'i':
+      {
+        long long value = longs  ? (long long)arg :
+                          shorts == 2 ? (signed char)arg :
+                          shorts ? (short)arg : (int)arg;
+
+        memcpy(spec + specLength, "ll", 2);
+        spec[specLength + 2] = *fmt;
+        spec[specLength + 3] = '\0';
+        written = snprintf(out + length, size - length, spec, value);
+        break;
+      }
+
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      {
+        unsigned long long value = longs  ? arg :
+                                   shorts == 2 ? (unsigned char)arg :
+                                   shorts ? (unsigned short)arg : (unsigned)arg;
+
+        memcpy(spec + specLength, "ll", 2);
+        spec[specLength + 2] = *fmt;
+        spec[specLength + 3] = '\0';
+        written = snprintf(out + length, size - length, spec, value);
+        break;
+      }
+
+    case 'c':
+      {
+        spec[specLength++] = 'c';
+        spec[specLength]   = '\0';
+        written = snprintf(out + length, size - length, spec, (int)arg);
+        break;
+      }
+
+    case 's':
+      {
+        spec[specLength++] = 's';
+        spec[specLength]   = '\0';
+        written = snprintf(out + length, size - length, spec, (const char*)(uintptr_t)arg);
+        break;
+      }
+
+    case 'p':
+      {
+        written = snprintf(out + length, size - length, "%p", (void*)(uintptr_t)arg);
+        break;
+      }
+
+    default:
+      {
+        /* Not something an integer argument can be printed with */
+        written = snprintf(out + length, size - length, "%%%c", *fmt);
+        break;
+      }
+    }
+    ++fmt;
+
+    if (written > 0)
+      length += ((u32)written < size - length) ? (u32)written : size - length - 1;
+  }
+
+  out[length] = '\0';
+  return length;
+}
+
+/* One whole line: time since Log_Init(), level, category, message */
+internal u32
+Log_FormatEntry(char* out, u32 size, const struct log_entry* entry)
+{
+  u64 elapsed = (entry->time > startTime) ? entry->time - startTime : 0;
+  u32 length;
+  int prefix;
+
+  prefix = snprintf(out, size, "%llu.%06llu %s %s: ",
+                    (unsigned long long)(elapsed / 1000000000ULL),
+                    (unsigned long long)(elapsed / 1000 % 1000000),
+                    levelNames[entry->level], Log_GetCategoryName(entry->category));
+  length = ((u32)prefix < size - 2) ? (u32)prefix : size - 2;
+  length += Log_FormatArgs(out + length, size - length - 1, entry->fmt,
+                           entry->args, entry->argCount);
+  out[length++] = '\n';
+  out[length]   = '\0';
+  return length;
+}
+
+internal struct log_ring*
+Log_CreateRing()
+{
+  struct log_ring* ring = (struct log_ring*)calloc(1, sizeof(struct log_ring));
+
+  if (!ring)
+    return 0;
+  ring->entries = (struct log_entry*)malloc(ringEntries * sizeof(struct log_entry));
+  if (!ring->entries)
+  {
+    free(ring);
+    return 0;
+  }
+  ring->mask      = ringEntries - 1;
+  ring->highWater = ringEntries / 4;
+
+  ring->next = atomic_load(&rings);
+  while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+    ;
+  threadRing = ring;
+  return ring;
+}
+
+internal void
+Log_WakeThread()
+{
+  pthread_mutex_lock(&wakeLock);
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&wakeLock);
+}
+
+/*
+  Queue an entry on this thread's ring. Never blocks; if the logging
+  thread has fallen a whole ring behind, the message is counted and
+  dropped. Returns false if logging is no longer asynchronous, in
+  which case the caller writes the message itself.
+*/
+internal bool
+Log_Enqueue(const struct log_entry* entry)
+{
+  struct log_ring* ring = threadRing ? threadRing : Log_CreateRing();
+  u32              head;
+  u32              used;
+
+  if (!ring)
+    return false;
+
+  /* Announce the write before checking that the logging thread is
+     still there; Log_StopAsync() makes the same two steps the other
+     way round, so one of them sees the other */
+  atomic_store(&ring->writing, true);
+  if (!atomic_load(&asyncRunning))
+  {
+    atomic_store_explicit(&ring->writing, false, memory_order_release);
+    return false;
+  }
+
+  head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  used = head - atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (used > ring->mask)
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+  else
+  {
+    ring->entries[head & ring->mask] = *entry;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  }
+  atomic_store_explicit(&ring->writing, false, memory_order_release);
+
+  /* Ordered after the head update, to pair with the logging thread
+     setting 'idle' before its last look at the rings */
+  if (used + 1 >= ring->highWater)
+  {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&idle, memory_order_relaxed))
+      Log_WakeThread();
+  }
+  return true;
+}
+
+/*
+  Log_Write()
+
+  Write or queue a message; the LOG_* macros have already checked its
+  level and category. The 'argCount' arguments after 'fmt' are all
+  u64.
+*/
+void
+Log_Write(u8 level, u32 category, u32 argCount, const char* fmt, ...)
+{
+  struct log_entry entry;
+  va_list          args;
+  u32              i;
+
+  entry.fmt      = fmt;
+  entry.time     = Log_GetTimeNs();
+  entry.category = category;
+  entry.level    = level;
+  entry.argCount = (argCount < LOG_MAX_ARGS) ? argCount : LOG_MAX_ARGS;
+  va_start(args, fmt);
+  for (i = 0; i < entry.argCount; ++i)
+    entry.args[i] = va_arg(args, u64);
+  va_end(args);
+
+  if (!atomic_load_explicit(&asyncRunning, memory_order_relaxed) ||
+      !Log_Enqueue(&entry))
+  {
+    char line[LOG_MAX_MESSAGE];
+
+    Log_FormatEntry(line, sizeof(line), &entry);
+    fputs(line, dbgStream);
+  }
+}
+
+/*
+  Format everything queued on every ring into 'batch', writing it out
+  whenever it fills. Returns the number of entries taken.
+*/
+internal u32
+Log_Drain(char* batch)
+{
+  struct log_ring* ring;
+  u32              batchLength = 0;
+  u32              taken       = 0;
+
+  for (ring = atomic_load(&rings); ring; ring = ring->next)
+  {
+    u32 tail    = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    u32 head    = atomic_load_explicit(&ring->head, memory_order_acquire);
+    u64 dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+
+    for (; tail != head || dropped; ++taken)
+    {
+      if (batchLength + LOG_MAX_MESSAGE > LOG_BATCH_SIZE)
+      {
+        fwrite(batch, 1, batchLength, dbgStream);
+        batchLength = 0;
+      }
+      if (tail == head)
+      {
+        batchLength += snprintf(batch + batchLength, LOG_MAX_MESSAGE,
+                                "log: %llu messages dropped\n", (unsigned long long)dropped);
+        dropped = 0;
+        continue;
+      }
+      batchLength += Log_FormatEntry(batch + batchLength, LOG_MAX_MESSAGE,
+                                     &ring->entries[tail & ring->mask]);
+      ++tail;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+
+  if (batchLength)
+  {
+    fwrite(batch, 1, batchLength, dbgStream);
+    fflush(dbgStream);
+  }
+  return taken;
+}
+
+/*
+  Sleep until a ring passes its high-water mark, a stop is requested
+  or LOG_IDLE_NS passes, unless something was queued meanwhile.
+*/
+internal void
+Log_WaitForWork(char* batch)
+{
+  struct timespec deadline;
+  u64             ns;
+
+  atomic_store(&idle, true);
+  if (!Log_Drain(batch))
+  {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    ns = deadline.tv_nsec + LOG_IDLE_NS;
+    deadline.tv_sec  += ns / 1000000000ULL;
+    deadline.tv_nsec  = ns % 1000000000ULL;
+    pthread_mutex_lock(&wakeLock);
+    if (!atomic_load(&asyncStopping))
+      pthread_cond_timedwait(&wake, &wakeLock, &deadline);
+    pthread_mutex_unlock(&wakeLock);
+  }
+  atomic_store(&idle, false);
+}
+
+internal void*
+Log_ThreadMain(void* unused)
+{
+  char* batch = (char*)malloc(LOG_BATCH_SIZE);
+
+  for (;;)
+  {
+    /* Read before draining, so entries queued before a stop request
+       are always written */
+    bool stopping = atomic_load(&asyncStopping);
+
+    if (!Log_Drain(batch))
+    {
+      if (stopping)
+        break;
+      Log_WaitForWork(batch);
+    }
+  }
+  free(batch);
+  return 0;
+}
+
+/*
+  Log_StartAsync()
+
+  Hand formatting and writing of LOG_* messages over to a background
+  thread, with rings of at least 'entries' messages per thread (0 for
+  LOG_DEFAULT_RING_ENTRIES). Stopped at exit.
+*/
+bool
+Log_StartAsync(u32 entries)
+{
+  if (atomic_load(&asyncRunning))
+    return true;
+
+  if (!entries)
+    entries = LOG_DEFAULT_RING_ENTRIES;
+  ringEntries = LOG_MIN_RING_ENTRIES;
+  while (ringEntries < entries && ringEntries < (1u << 31))
+    ringEntries <<= 1;
+
+  atomic_store(&asyncStopping, false);
+  if (pthread_create(&logThread, 0, Log_ThreadMain, 0) != 0)
+    return false;
+  atomic_store(&asyncRunning, true);
+  atexit(Log_StopAsync);
+  return true;
+}
+
+/*
+  Write everything still queued and go back to writing messages as
+  they are logged.
+*/
+void
+Log_StopAsync()
+{
+  struct log_ring* ring;
+
+  if (!atomic_load(&asyncRunning))
+    return;
+
+  /* Producers that saw asyncRunning still set finish queueing before
+     the logging thread is told to make its last pass */
+  atomic_store(&asyncRunning, false);
+  for (ring = atomic_load(&rings); ring; ring = ring->next)
+  {
+    while (atomic_load(&ring->writing))
+      sched_yield();
+  }
+
+  atomic_store(&asyncStopping, true);
+  Log_WakeThread();
+  pthread_join(logThread, 0);
 }
 
 void
 Log_Debug(char* fmt, ...)
 {
-  if (logVerbosity < 3) return;
+  if (g_logLevel < LOG_LEVEL_DEBUG) return;
   va_list args;
   va_start(args, fmt);
   fprintf(dbgStream, "DEBUG: ");
@@ -29,5 +524,79 @@ Log_Debug(char* fmt, ...)
 void
 Log_SetVerbosity(u8 verbosity)
 {
-  logVerbosity = verbosity;
+  g_logLevel = verbosity;
+}
+
+void
+Log_SetCategories(u32 categories)
+{
+  g_logCategories = categories;
+}
+
+bool
+Log_SetFile(char* path)
+{
+  FILE* fp = fopen(path, "w");
+
+  if (!fp)
+    return false;
+  dbgStream = fp;
+  return true;
+}
+
+/*
+  Accept a level by name ('debug') or number (3).
+*/
+bool
+Log_ParseLevel(const char* name, u8* level)
+{
+  u8 i;
+
+  for (i = 0; i <= LOG_LEVEL_TRACE; ++i)
+  {
+    if (strcmp(name, levelNames[i]) == 0 ||
+        (name[0] == '0' + i && !name[1]))
+    {
+      *level = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+  Accept a comma separated list of category names, or 'all'.
+*/
+bool
+Log_ParseCategories(const char* names, u32* categories)
+{
+  u32 result = 0;
+
+  while (*names)
+  {
+    u32 length = strcspn(names, ",");
+    u32 i;
+
+    if (length == 3 && strncmp(names, "all", 3) == 0)
+      result |= LOG_CAT_ALL;
+    else
+    {
+      for (i = 0; i < sizeof(categoryNames) / sizeof(categoryNames[0]); ++i)
+      {
+        if (strlen(categoryNames[i]) == length &&
+            strncmp(names, categoryNames[i], length) == 0)
+          break;
+      }
+      if (i == sizeof(categoryNames) / sizeof(categoryNames[0]))
+        return false;
+      result |= 1 << i;
+    }
+
+    names += length;
+    if (*names == ',')
+      ++names;
+  }
+
+  *categories = result;
+  return result != 0;
 }
@@ -4,13 +4,140 @@
 #include "types.h"
 
 
+/*
+  Leveled, categorized logging.
+
+  LOG_ERROR() through LOG_TRACE() take a LOG_CAT_* category and a
+  printf-style message. A message is written if its level is at or
+  below the current level and its category is enabled. The test is
+  made inline, before any argument is evaluated, and is marked
+  unlikely, so a disabled message costs a load and a predicted branch.
+
+  Messages above LOG_COMPILED_LEVEL are removed at compile time,
+  arguments and all. It defaults to LOG_LEVEL_TRACE in _DEBUG builds
+  and LOG_LEVEL_INFO otherwise, and can be set with
+  -DLOG_COMPILED_LEVEL=N. Code run for every instruction logs at
+  LOG_LEVEL_TRACE so release builds keep none of it.
+
+  Log_Debug() is the older interface; it writes at LOG_LEVEL_DEBUG in
+  any category.
+
+  After Log_StartAsync() the macros no longer format anything on the
+  calling thread. Each thread gets its own ring of binary entries
+  (format string pointer, timestamp and up to LOG_MAX_ARGS arguments
+  widened to 64 bits), which only it writes and only the logging
+  thread reads, so logging needs no lock. Rings hold
+  LOG_DEFAULT_RING_ENTRIES entries unless Log_StartAsync() is given
+  another size. The logging thread formats whatever the rings hold in
+  batches. It sleeps while the rings are quiet and is woken as soon as
+  one is a quarter full. A full ring drops the message rather than
+  wait, and the drops are reported. Log_StopAsync() waits for messages
+  being queued and writes everything before returning.
+
+  Since formatting happens later, %s arguments must point to strings
+  that are never freed or changed, and floating point arguments are
+  not supported. Log_Debug() always writes directly.
+*/
+
+#define LOG_LEVEL_ERROR   0
+#define LOG_LEVEL_WARN    1
+#define LOG_LEVEL_INFO    2
+#define LOG_LEVEL_DEBUG   3
+#define LOG_LEVEL_TRACE   4
+
+#define LOG_CAT_CPU       0x01
+#define LOG_CAT_ALU       0x02
+#define LOG_CAT_MEM       0x04
+#define LOG_CAT_IO        0x08
+#define LOG_CAT_DBG       0x10
+#define LOG_CAT_MISC      0x20
+#define LOG_CAT_ALL       0x3f
+
+#define LOG_MAX_ARGS      6
+#define LOG_DEFAULT_RING_ENTRIES  (1 << 16)
+
+#ifndef LOG_COMPILED_LEVEL
+#ifdef _DEBUG
+#define LOG_COMPILED_LEVEL  LOG_LEVEL_TRACE
+#else
+#define LOG_COMPILED_LEVEL  LOG_LEVEL_INFO
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define LOG_UNLIKELY(x)   __builtin_expect(!!(x), 0)
+#else
+#define LOG_UNLIKELY(x)   (x)
+#endif
+
+/* Read by the macros below; set with Log_SetVerbosity() and
+   Log_SetCategories() */
+extern u8  g_logLevel;
+extern u32 g_logCategories;
+
+#define LOG_IS_ENABLED(level, category)                           \
+  ((level) <= LOG_COMPILED_LEVEL &&                               \
+   LOG_UNLIKELY((level) <= g_logLevel &&                          \
+                (g_logCategories & (category))))
+
+/* Number of arguments, format string included, and the arguments
+   after the format string each cast to u64 */
+#define LOG_COUNT(...)    LOG_COUNT_(__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_COUNT_(_1, _2, _3, _4, _5, _6, _7, n, ...)  n
+#define LOG_PASTE(a, b)   LOG_PASTE_(a, b)
+#define LOG_PASTE_(a, b)  a##b
+#define LOG_WIDEN(...)    LOG_PASTE(LOG_WIDEN_, LOG_COUNT(__VA_ARGS__))(__VA_ARGS__)
+#define LOG_WIDEN_1(f)                    f
+#define LOG_WIDEN_2(f, a)                 f, (u64)(a)
+#define LOG_WIDEN_3(f, a, b)              LOG_WIDEN_2(f, a), (u64)(b)
+#define LOG_WIDEN_4(f, a, b, c)           LOG_WIDEN_3(f, a, b), (u64)(c)
+#define LOG_WIDEN_5(f, a, b, c, d)        LOG_WIDEN_4(f, a, b, c), (u64)(d)
+#define LOG_WIDEN_6(f, a, b, c, d, e)     LOG_WIDEN_5(f, a, b, c, d), (u64)(e)
+#define LOG_WIDEN_7(f, a, b, c, d, e, g)  LOG_WIDEN_6(f, a, b, c, d, e), (u64)(g)
+
+#define LOG(level, category, ...)                                 \
+  do                                                              \
+  {                                                               \
+    if (LOG_IS_ENABLED(level, category))                          \
+      Log_Write(level, category, LOG_COUNT(__VA_ARGS__) - 1,      \
+                LOG_WIDEN(__VA_ARGS__));                          \
+  } while (0)
+
+#define LOG_ERROR(category, ...)  LOG(LOG_LEVEL_ERROR, category, __VA_ARGS__)
+#define LOG_WARN(category, ...)   LOG(LOG_LEVEL_WARN,  category, __VA_ARGS__)
+#define LOG_INFO(category, ...)   LOG(LOG_LEVEL_INFO,  category, __VA_ARGS__)
+#define LOG_DEBUG(category, ...)  LOG(LOG_LEVEL_DEBUG, category, __VA_ARGS__)
+#define LOG_TRACE(category, ...)  LOG(LOG_LEVEL_TRACE, category, __VA_ARGS__)
+
+
 void
 Log_Init();
 
+void
+Log_Write(u8 level, u32 category, u32 argCount, const char* fmt, ...);
+
 void
 Log_Debug(char* fmt, ...);
 
 void
 Log_SetVerbosity(u8 verbosity);
 
+void
+Log_SetCategories(u32 categories);
+
+bool
+Log_ParseLevel(const char* name, u8* level);
+
+bool
+Log_ParseCategories(const char* names, u32* categories);
+
+bool
+Log_SetFile(char* path);
+
+bool
+Log_StartAsync(u32 entries);
+
+void
+Log_StopAsync();
+
 #endif    /* __LOG_H__ */
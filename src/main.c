@@ -3,21 +3,70 @@
   Puprose: An Intel 8080 CPU emulator
 */
 
+#include "breakpoint.h"
 #include "common.h"
 #include "cpu.h"
+#include "disas.h"
+#include "display.h"
+#include "dump.h"
+#include "expr.h"
+#include "gdbstub.h"
+#include "history.h"
+#include "io.h"
 #include "log.h"
 #include "memory.h"
+#include "metrics.h"
+#include "profile.h"
+#include "sched.h"
+#include "stats.h"
+#include "symbols.h"
+#include "throttle.h"
+#include "trace.h"
 
 #include <ctype.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 
 void
 PrintUsage(char* exeName)
 {
-  fprintf(stderr, "%s program\n", exeName);
+  fprintf(stderr, "%s [options] program\n", exeName);
+  fprintf(stderr, "  -r, --run             run without the debugger\n");
+  fprintf(stderr, "  -t, --throttle[=HZ]   run at real speed (default %u Hz)\n",
+          THROTTLE_DEFAULT_CLOCK_HZ);
+  fprintf(stderr, "      --turbo=FACTOR    scale the throttled clock rate\n");
+  fprintf(stderr, "  -x, --script=FILE     run debugger commands from FILE\n");
+  fprintf(stderr, "  -g, --gdb=PORT|PATH   serve gdb on a localhost port or Unix socket\n");
+  fprintf(stderr, "  -s, --symbols=FILE    load symbols from a .sym, .lst or address/name file\n");
+  fprintf(stderr, "      --disassemble=FILE  disassemble all 64K to FILE and exit\n");
+  fprintf(stderr, "      --stats=FILE      write instruction statistics to FILE as JSON at exit\n");
+  fprintf(stderr, "      --metrics=FILE    export metrics to FILE in Prometheus text format\n");
+  fprintf(stderr, "      --metrics-interval=SECONDS\n");
+  fprintf(stderr, "                        how often to export metrics (default %u)\n",
+          METRICS_DEFAULT_INTERVAL);
+  fprintf(stderr, "      --profile=FILE    profile the program and write collapsed stacks to FILE\n");
+  fprintf(stderr, "                        at exit\n");
+  fprintf(stderr, "      --profile-top=N   profile the program and print the N busiest functions\n");
+  fprintf(stderr, "                        and addresses at exit\n");
+  fprintf(stderr, "      --trace=FILE      write a binary instruction trace to FILE\n");
+  fprintf(stderr, "      --trace-format=ring|delta\n");
+  fprintf(stderr, "                        ring keeps the last instructions in a fixed file,\n");
+  fprintf(stderr, "                        delta compresses the whole run\n");
+  fprintf(stderr, "      --trace-records=N keep the last N instructions (default %u)\n",
+          TRACE_DEFAULT_RECORDS);
+  fprintf(stderr, "  -d, --verbose-debug   enable debug logging\n");
+  fprintf(stderr, "      --log-level=LEVEL log at error, warn, info, debug or trace (0-4)\n");
+  fprintf(stderr, "      --log-categories=LIST\n");
+  fprintf(stderr, "                        log only cpu, alu, mem, io, dbg and/or misc\n");
+  fprintf(stderr, "      --log-file=FILE   write the log to FILE instead of stderr\n");
+  fprintf(stderr, "      --log-async[=ENTRIES]\n");
+  fprintf(stderr, "                        format and write the log on a background thread,\n");
+  fprintf(stderr, "                        queueing up to ENTRIES messages per thread\n");
+  fprintf(stderr, "Commands piped to stdin are run as a script.\n");
 }
 
 bool
@@ -88,62 +137,30 @@ StripWhiteSpace(char* cmdString)
   cmdString[dstIndex] = '\0';
 }
 
-bool
-FuzzyCompare(char* s1, char* s2)
-{
-  u32 testIndex, targetIndex;
-  char* target;
-  char* test;
-
-  if (strlen(s2) > strlen(s1))
-  {
-    test   = s1;
-    target = s2;
-  }
-  else
-  {
-    test   = s2;
-    target = s1;
-  }
-
-  if (strlen(test) > strlen(target))
-  {
-    /* Log("FuzzyCompare: Too Long"); */
-    return false;
-  }
-  else if (strlen(test) == strlen(target))
-  {  
-    /* Log("FuzzyCompare: Same Length"); */
-    return !strcmp(test, target);
-  }
-
-  testIndex = targetIndex = 0;
-  for (testIndex = 0;
-       testIndex < strlen(test);
-       ++testIndex)
-  {
-    while (test[testIndex] != target[targetIndex++])
-    {
-      if (!target[targetIndex])
-        return false;
-    }
-  }
-
-  return true;
-}
-
-
-
-
 #define ERRDBG_LOADPROGRAMFAILED   0xdeadbabe
 
 
 enum
 {
+  DBGCMD_BREAK,
+  DBGCMD_CONDITION,
+  DBGCMD_CONTINUE,
+  DBGCMD_DELETE,
+  DBGCMD_DISAS,
+  DBGCMD_DISPLAY,
+  DBGCMD_FINISH,
   DBGCMD_HELP,
+  DBGCMD_IGNORE,
+  DBGCMD_METRICS,
   DBGCMD_NEXT,
+  DBGCMD_PROFILE,
   DBGCMD_QUIT,
+  DBGCMD_REVERSECONTINUE,
+  DBGCMD_REVERSESTEP,
+  DBGCMD_STATS,
   DBGCMD_STEP,
+  DBGCMD_SYMBOLS,
+  DBGCMD_UNTIL,
   DBGCMD_X,
 
   DBGCMD_NOCMD,
@@ -153,6 +170,7 @@ enum
 
 #define MAX_PARM_LENGTH       64
 #define MAX_DBGCMD_PARMS       4
+#define MAX_ARGS_LENGTH      256
 
 #define DBGCMD_FLG_HASPARMS    1
 #define DBGCMD_FLG_HASEXPARMS  2
@@ -162,6 +180,8 @@ struct dbg_cmd
   char*     cmdName; 
   word_t    cmdID;
   char      parms[MAX_DBGCMD_PARMS][MAX_PARM_LENGTH];
+  /* Everything after the command name, untokenized */
+  char      args[MAX_ARGS_LENGTH];
   word_t    flags;
 };
 
@@ -171,8 +191,25 @@ struct dbg_cmd DebuggerCommands[DBGCMD_NUMCMDS] =
 
   { "next",           DBGCMD_NEXT,             {}, 0 },
   { "step",           DBGCMD_STEP,             {}, 0 },
+  { "finish",         DBGCMD_FINISH,           {}, 0 },
+  { "continue",       DBGCMD_CONTINUE,         {}, 0 },
+  { "until",          DBGCMD_UNTIL,            {}, 0 },
+
+  { "reverse-step",     DBGCMD_REVERSESTEP,     {}, 0 },
+  { "reverse-continue", DBGCMD_REVERSECONTINUE, {}, 0 },
+
+  { "break",          DBGCMD_BREAK,            {}, 0 },
+  { "delete",         DBGCMD_DELETE,           {}, 0 },
+  { "condition",      DBGCMD_CONDITION,        {}, 0 },
+  { "ignore",         DBGCMD_IGNORE,           {}, 0 },
 
   { "x",              DBGCMD_X,                {}, 0 },
+  { "disas",          DBGCMD_DISAS,            {}, 0 },
+  { "display",        DBGCMD_DISPLAY,          {}, 0 },
+  { "symbols",        DBGCMD_SYMBOLS,          {}, 0 },
+  { "stats",          DBGCMD_STATS,            {}, 0 },
+  { "profile",        DBGCMD_PROFILE,          {}, 0 },
+  { "metrics",        DBGCMD_METRICS,          {}, 0 },
 
   { "quit",           DBGCMD_QUIT,             {}, 0 },
 
@@ -180,10 +217,57 @@ struct dbg_cmd DebuggerCommands[DBGCMD_NUMCMDS] =
 };
 internal struct dbg_cmd dbgCmd;
 
+/* Short names that resolve to a command even where they are also a
+   prefix of others */
+struct dbg_alias
+{
+  char*  name;
+  word_t cmdID;
+};
+
+internal struct dbg_alias DebuggerAliases[] =
+{
+  { "b",  DBGCMD_BREAK           },
+  { "c",  DBGCMD_CONTINUE        },
+  { "d",  DBGCMD_DELETE          },
+  { "h",  DBGCMD_HELP            },
+  { "n",  DBGCMD_NEXT            },
+  { "q",  DBGCMD_QUIT            },
+  { "rc", DBGCMD_REVERSECONTINUE },
+  { "rs", DBGCMD_REVERSESTEP     },
+  { "s",  DBGCMD_STEP            },
+  { "u",  DBGCMD_UNTIL           },
+};
+
+/*
+  Command names and aliases are kept in a prefix trie built at
+  Dbg_Init(). Each node records the command spelled exactly by the
+  path to it, if any, and the one command reachable below it, as
+  indices into DebuggerCommands. A
+  lookup is a single walk over the typed name: an exact name wins,
+  otherwise a prefix resolves if only one command lies beneath it.
+*/
+#define DBG_TRIE_MAX_NODES   512
+#define DBG_TRIE_FIRST_CHAR  0x20
+#define DBG_TRIE_ALPHABET    (0x80 - DBG_TRIE_FIRST_CHAR)
+#define DBG_TRIE_NONE        -1
+#define DBG_TRIE_AMBIGUOUS   -2
+
+struct dbg_trie_node
+{
+  /* Node indices; 0 (the root) means no child */
+  u16 children[DBG_TRIE_ALPHABET];
+  i16 exactCmd;
+  i16 prefixCmd;
+};
+
+internal struct dbg_trie_node cmdTrie[DBG_TRIE_MAX_NODES];
+internal u32                  cmdTrieSize;
+
 void
 Dbg_Init();
 
-void
+bool
 Dbg_Prompt(char* cmdString);
 
 bool
@@ -196,32 +280,164 @@ int
 Dbg_FindCmd(struct dbg_cmd* cmd, char* cmdString);
 
 void
-Dbg_DumpMemory(word_t address, u16 numUnits, char formatType, char unitType);
+Dbg_DumpMemory(word_t address, u32 numUnits, char formatType, char unitType);
 
 bool
 Dbg_LoadProgram(char* path);
 
+bool
+Dbg_ParseAddress(char* string, word_t* address);
+
 void
 Dbg_PrintRegs();
 
 void
 Dbg_CmdNotImplemented(char* cmdString);
 
+void
+Dbg_ReportStop(u8 stopReason);
+
+internal const char*
+Dbg_SymbolSuffix(word_t address);
+
+bool
+Dbg_LoadScript(char* path);
+
+void
+Dbg_RunScript();
+
 
-#define MEM_SIZE 256
+#define MEM_SIZE 0x10000
 
 internal bool    isRunning;
 internal byte_t* memory;
 
+/*
+  Command output goes here. Interactively it is stdout; scripts
+  capture it per command so it can be reported along with the result.
+*/
+internal FILE*   dbgOut;
+/* Likewise for error messages, which scripts report as "error" */
+internal FILE*   dbgErr;
+
+#define DBG_STOP_NONE  0xff
+/* Set by Dbg_ReportStop() so scripts can report why execution ended */
+internal u8      lastStopReason = DBG_STOP_NONE;
+
+/* Where --stats writes its JSON report at exit */
+internal char*   statsPath;
+/* Where --profile writes collapsed stacks at exit, and how many
+   functions --profile-top reports */
+internal char*   profilePath;
+internal u32     profileTop;
+/* Where --metrics exports to, and how often */
+internal char*   metricsPath;
+internal u32     metricsInterval = METRICS_DEFAULT_INTERVAL;
+
+
+/*
+  Debugger scripts
+
+  A script is parsed once up front into a list of ops. Besides
+  debugger commands it may contain blocks, which can be nested:
+
+    repeat COUNT        run the block COUNT times
+    while EXPR          run the block while EXPR is non-zero
+    end
+
+  Blank lines and lines starting with '#' are ignored. Each command
+  run writes one JSON object per line to stdout.
+*/
+#define MAX_SCRIPT_DEPTH  16
+
+enum
+{
+  SCRIPTOP_CMD,
+  SCRIPTOP_REPEAT,
+  SCRIPTOP_WHILE,
+  SCRIPTOP_END
+};
+
+struct script_op
+{
+  u8                  kind;
+  u32                 lineNumber;
+  /* Iteration count of a repeat block */
+  u32                 count;
+  /* Index of the matching end for repeat/while, and of the opening
+     op for end */
+  u32                 match;
+  struct expr_program condition;
+  struct dbg_cmd      cmd;
+};
+
+internal struct script_op* scriptOps;
+internal u32               scriptLength;
+
+
+internal void
+HandleInterrupt(int signalNumber)
+{
+  /* Ctrl-C stops a running program; at the prompt it exits as it
+     would without the handler */
+  if (CPU_IsRunning())
+    CPU_RequestStop();
+  else
+  {
+    signal(SIGINT, SIG_DFL);
+    raise(SIGINT);
+  }
+}
+
+
+internal void
+WriteStatsAtExit()
+{
+  if (!Stats_WriteJsonFile(statsPath))
+    fprintf(stderr, "cannot write statistics to %s\n", statsPath);
+}
+
+internal void
+WriteProfileAtExit()
+{
+  if (profilePath && !Prof_WriteCollapsedFile(profilePath))
+    fprintf(stderr, "cannot write profile to %s\n", profilePath);
+  if (profileTop)
+    Prof_PrintTop(stderr, profileTop);
+}
 
 int
 main(int argc, char* argv[])
 {
-  char* debuggeePath;
+  char*  debuggeePath;
+  bool   runHeadless;
+  bool   throttle;
+  u32    clockRate;
+  double turboFactor;
+  char*  scriptPath;
+  char*  gdbAddress;
+  char*  disassemblyPath;
+  char*  symbolsPath;
+  char*  tracePath;
+  u64    traceRecords;
+  u8     traceFormat;
 
   Log_Init();
+  dbgOut = stdout;
+  dbgErr = stderr;
 
   debuggeePath = 0;
+  runHeadless  = false;
+  throttle     = false;
+  clockRate    = THROTTLE_DEFAULT_CLOCK_HZ;
+  turboFactor  = 1.0;
+  scriptPath   = 0;
+  gdbAddress   = 0;
+  disassemblyPath = 0;
+  symbolsPath     = 0;
+  tracePath       = 0;
+  traceRecords    = TRACE_DEFAULT_RECORDS;
+  traceFormat     = TRACE_FORMAT_RING;
   for (int argi = 1;
        argi < argc;
        ++argi)
@@ -232,7 +448,113 @@ main(int argc, char* argv[])
 
     else if (strcmp(argv[argi], "--verbose-debug") == 0 ||
              strcmp(argv[argi], "-d") == 0)
-      Log_SetVerbosity(3);
+      Log_SetVerbosity(LOG_LEVEL_DEBUG);
+
+    else if (strncmp(argv[argi], "--log-level=", 12) == 0)
+    {
+      u8 level;
+
+      if (Log_ParseLevel(argv[argi] + 12, &level))
+        Log_SetVerbosity(level);
+      else
+        fprintf(stderr, "unknown log level: %s\n", argv[argi] + 12);
+    }
+
+    else if (strncmp(argv[argi], "--log-categories=", 17) == 0)
+    {
+      u32 categories;
+
+      if (Log_ParseCategories(argv[argi] + 17, &categories))
+        Log_SetCategories(categories);
+      else
+        fprintf(stderr, "unknown log category in %s\n", argv[argi] + 17);
+    }
+
+    else if (strncmp(argv[argi], "--log-file=", 11) == 0)
+    {
+      if (!Log_SetFile(argv[argi] + 11))
+        fprintf(stderr, "cannot create log file %s\n", argv[argi] + 11);
+    }
+
+    else if (strcmp(argv[argi], "--log-async") == 0 ||
+             strncmp(argv[argi], "--log-async=", 12) == 0)
+    {
+      u32 entries = (argv[argi][11] == '=') ? strtoul(argv[argi] + 12, 0, 0) : 0;
+
+      if (!Log_StartAsync(entries))
+        fprintf(stderr, "cannot start the logging thread\n");
+    }
+
+    else if (strcmp(argv[argi], "--run") == 0 ||
+             strcmp(argv[argi], "-r") == 0)
+      runHeadless = true;
+
+    else if (strcmp(argv[argi], "--throttle") == 0 ||
+             strcmp(argv[argi], "-t") == 0)
+      throttle = true;
+
+    else if (strncmp(argv[argi], "--throttle=", 11) == 0)
+    {
+      throttle  = true;
+      clockRate = strtoul(argv[argi] + 11, 0, 0);
+    }
+
+    else if (strncmp(argv[argi], "--turbo=", 8) == 0)
+      turboFactor = atof(argv[argi] + 8);
+
+    else if ((strcmp(argv[argi], "--script") == 0 ||
+              strcmp(argv[argi], "-x") == 0) &&
+             argi + 1 < argc)
+      scriptPath = argv[++argi];
+
+    else if (strncmp(argv[argi], "--script=", 9) == 0)
+      scriptPath = argv[argi] + 9;
+
+    else if ((strcmp(argv[argi], "--gdb") == 0 ||
+              strcmp(argv[argi], "-g") == 0) &&
+             argi + 1 < argc)
+      gdbAddress = argv[++argi];
+
+    else if (strncmp(argv[argi], "--gdb=", 6) == 0)
+      gdbAddress = argv[argi] + 6;
+
+    else if (strncmp(argv[argi], "--disassemble=", 14) == 0)
+      disassemblyPath = argv[argi] + 14;
+
+    else if ((strcmp(argv[argi], "--symbols") == 0 ||
+              strcmp(argv[argi], "-s") == 0) &&
+             argi + 1 < argc)
+      symbolsPath = argv[++argi];
+
+    else if (strncmp(argv[argi], "--symbols=", 10) == 0)
+      symbolsPath = argv[argi] + 10;
+
+    else if (strncmp(argv[argi], "--stats=", 8) == 0)
+      statsPath = argv[argi] + 8;
+
+    else if (strncmp(argv[argi], "--metrics=", 10) == 0)
+      metricsPath = argv[argi] + 10;
+
+    else if (strncmp(argv[argi], "--metrics-interval=", 19) == 0)
+      metricsInterval = strtoul(argv[argi] + 19, 0, 0);
+
+    else if (strncmp(argv[argi], "--profile=", 10) == 0)
+      profilePath = argv[argi] + 10;
+
+    else if (strncmp(argv[argi], "--profile-top=", 14) == 0)
+      profileTop = strtoul(argv[argi] + 14, 0, 0);
+
+    else if (strncmp(argv[argi], "--trace=", 8) == 0)
+      tracePath = argv[argi] + 8;
+
+    else if (strncmp(argv[argi], "--trace-records=", 16) == 0)
+      traceRecords = strtoull(argv[argi] + 16, 0, 0);
+
+    else if (strcmp(argv[argi], "--trace-format=ring") == 0)
+      traceFormat = TRACE_FORMAT_RING;
+
+    else if (strcmp(argv[argi], "--trace-format=delta") == 0)
+      traceFormat = TRACE_FORMAT_DELTA;
   }
 
   if (!debuggeePath)
@@ -242,14 +564,64 @@ main(int argc, char* argv[])
   }
 
   Dbg_Init();
+  Bp_Init();
+  Hist_Init();
+  Sched_Init();
+  Sym_Init();
+  IO_Init();
+  Throttle_Init(clockRate, turboFactor);
+  Throttle_SetEnabled(throttle);
+  signal(SIGINT, HandleInterrupt);
 
   CPU_Init(memory);
   memory = Mem_Init(MEM_SIZE);
+  Disp_Init(0, 0x100);
 
   if (!Dbg_LoadProgram(debuggeePath))
   {
     ErrorFatal(ERRDBG_LOADPROGRAMFAILED);
   }
+  if (symbolsPath && !Sym_Load(symbolsPath))
+    fprintf(stderr, "cannot load symbols from %s\n", symbolsPath);
+  if (statsPath)
+    atexit(WriteStatsAtExit);
+  if (metricsPath && !Metrics_StartExport(metricsPath, metricsInterval))
+    fprintf(stderr, "cannot write metrics to %s\n", metricsPath);
+  if (profilePath || profileTop)
+  {
+    Prof_SetEnabled(true);
+    atexit(WriteProfileAtExit);
+  }
+  if (tracePath && !Trace_Open(tracePath, traceFormat, traceRecords))
+  {
+    fprintf(stderr, "cannot create trace file %s\n", tracePath);
+    return 1;
+  }
+
+  if (runHeadless)
+  {
+    Dbg_ReportStop(Throttle_Run(CPU_NO_CYCLELIMIT));
+    Dbg_PrintRegs();
+    return 0;
+  }
+
+  if (disassemblyPath)
+    return Disas_WriteImage(disassemblyPath) ? 0 : 1;
+
+  if (gdbAddress)
+    return Gdb_Serve(gdbAddress) ? 0 : 1;
+
+  Hist_SetEnabled(true);
+
+  if (!scriptPath && !isatty(STDIN_FILENO))
+    scriptPath = "-";
+  if (scriptPath)
+  {
+    if (!Dbg_LoadScript(scriptPath))
+      return 1;
+    Dbg_RunScript();
+    return 0;
+  }
 
   isRunning = true;
   while (isRunning)
@@ -257,9 +629,9 @@ main(int argc, char* argv[])
     /* CPU_DoInstructionCycle(); */
     char cmdString[1024];
 
-    Dbg_PrintRegs();
-    Dbg_DumpMemory(0, 0x100, 'x', 'b');
-    Dbg_Prompt(cmdString);
+    Disp_Refresh();
+    if (!Dbg_Prompt(cmdString))
+      break;
     Dbg_ParseCmd(&dbgCmd, cmdString);
     Dbg_ExecuteCmd(&dbgCmd);
   }
@@ -284,21 +656,93 @@ GetLine(char* line, u16 maxSize)
   }
 
   line[count] = '\0';
+  if (c == EOF && count == 0)
+    return -1;
   return count;
 }
 
+internal void
+Dbg_InitTrieNode(struct dbg_trie_node* node)
+{
+  memset(node->children, 0, sizeof(node->children));
+  node->exactCmd  = DBG_TRIE_NONE;
+  node->prefixCmd = DBG_TRIE_NONE;
+}
+
+internal bool
+Dbg_AddCmdName(char* name, i16 cmdIndex)
+{
+  struct dbg_trie_node* node;
+  char*                 c;
+  u16*                  child;
+
+  node = &cmdTrie[0];
+  for (c = name; ; ++c)
+  {
+    if (node->prefixCmd == DBG_TRIE_NONE)
+      node->prefixCmd = cmdIndex;
+    else if (node->prefixCmd != cmdIndex)
+      node->prefixCmd = DBG_TRIE_AMBIGUOUS;
+
+    if (!*c)
+      break;
+    if (*c < DBG_TRIE_FIRST_CHAR || *c >= 0x80)
+      return false;
+
+    child = &node->children[*c - DBG_TRIE_FIRST_CHAR];
+    if (!*child)
+    {
+      if (cmdTrieSize == DBG_TRIE_MAX_NODES)
+        return false;
+      *child = cmdTrieSize;
+      Dbg_InitTrieNode(&cmdTrie[cmdTrieSize++]);
+    }
+    node = &cmdTrie[*child];
+  }
+
+  node->exactCmd = cmdIndex;
+  return true;
+}
+
 void
 Dbg_Init()
 {
+  u32 i, j;
+
+  cmdTrieSize = 1;
+  Dbg_InitTrieNode(&cmdTrie[0]);
+  for (i = 0; i < DBGCMD_NUMCMDS; ++i)
+  {
+    if (!Dbg_AddCmdName(DebuggerCommands[i].cmdName, i))
+      fprintf(stderr, "Cannot add debugger command: %s\n", DebuggerCommands[i].cmdName);
+  }
+  for (i = 0; i < sizeof(DebuggerAliases) / sizeof(DebuggerAliases[0]); ++i)
+  {
+    for (j = 0; j < DBGCMD_NUMCMDS; ++j)
+    {
+      if (DebuggerCommands[j].cmdID == DebuggerAliases[i].cmdID)
+        break;
+    }
+    if (j == DBGCMD_NUMCMDS ||
+        !Dbg_AddCmdName(DebuggerAliases[i].name, j))
+      fprintf(stderr, "Cannot add debugger alias: %s\n", DebuggerAliases[i].name);
+  }
+
   Dbg_FindCmd(&dbgCmd, "_NOCMD");
 }
 
-void
+bool
 Dbg_Prompt(char* cmdString)
 {
   const char* prompt = " > ";
   printf("[%04x]%s", CPU_GetProgramCounter(), prompt);
-  GetLine(cmdString, 1024);
+  if (GetLine(cmdString, 1024) < 0)
+  {
+    /* End of input */
+    printf("\n");
+    return false;
+  }
+  return true;
 }
 
 bool
@@ -308,10 +752,18 @@ Dbg_ParseCmd(struct dbg_cmd* cmd, char* cmdString)
   char *cmdName;
   char *tok;
   char delims[] = " \t";
+  char args[MAX_ARGS_LENGTH];
+  char *argsStart;
   u16  numParms;
 
   StripWhiteSpace(cmdString);
 
+  /* keep a copy of the arguments before strtok() splits them up */
+  argsStart  = cmdString + strcspn(cmdString, delims);
+  argsStart += strspn(argsStart, delims);
+  strncpy(args, argsStart, MAX_ARGS_LENGTH - 1);
+  args[MAX_ARGS_LENGTH - 1] = '\0';
+
   /* tokenize cmdString */
   numParms = 0;
   tok = strtok(cmdString, delims);
@@ -336,7 +788,7 @@ Dbg_ParseCmd(struct dbg_cmd* cmd, char* cmdString)
     Log_Debug("Dbg_ParseCmd: cmdFoundCount == 0");
 #endif
     cmd->cmdID = DBGCMD_NOCMD;
-    fprintf(stderr, "Unknown command: %s\n", cmdString);
+    fprintf(dbgErr, "Unknown command: %s\n", cmdString);
     return false;
   }
   else if (cmdFoundCount > 1)
@@ -345,10 +797,12 @@ Dbg_ParseCmd(struct dbg_cmd* cmd, char* cmdString)
     Log_Debug("Dbg_ParseCmd: cmdFoundCount > 1 (%d)", cmdFoundCount);
 #endif
     cmd->cmdID = DBGCMD_NOCMD;
-    fprintf(stderr, "Ambiguous command: %s\n", cmdString);
+    fprintf(dbgErr, "Ambiguous command: %s\n", cmdString);
     return false;
   }
 
+  strcpy(cmd->args, args);
+
   /* Handle cases where we already processed a '/' in the initial
      token (e.g. the 'x' command) */
   if (cmdName != tok)
@@ -417,7 +871,7 @@ Dbg_ExecuteCmd(struct dbg_cmd* cmd)
       repeatCount = atoi(cmd->parms[0]);
       if (repeatCount < 0)
       {
-        fprintf(stderr, "next: invalid repeat count: %u\n", repeatCount);
+        fprintf(dbgErr, "next: invalid repeat count: %u\n", repeatCount);
         break;
       }
       if (repeatCount == 0) repeatCount = 1;
@@ -432,15 +886,142 @@ Dbg_ExecuteCmd(struct dbg_cmd* cmd)
            i < repeatCount;
            ++i)
       {
-        CPU_DoInstructionCycle();
+        CPU_Step();
+        if (CPU_IsHalted())
+        {
+          Dbg_ReportStop(CPU_STOP_HALTED);
+          break;
+        }
+      }
+      break;
+    }
+
+  case DBGCMD_DISAS:
+    {
+#define DBGCMD_DISAS_DEFAULT_COUNT  10
+      word_t address;
+      u32    count;
+
+      /* 'disas all FILE' writes out the whole address space */
+      if (strcmp(cmd->parms[0], "all") == 0)
+      {
+        char* path = cmd->parms[1][0] ? cmd->parms[1] : "-";
+        if (!Disas_WriteImage(path))
+          fprintf(dbgErr, "disas: cannot write %s\n", path);
+        break;
+      }
+
+      if (!cmd->parms[0][0])
+        address = CPU_GetProgramCounter();
+      else if (!Dbg_ParseAddress(cmd->parms[0], &address))
+      {
+        fprintf(dbgErr, "disas: invalid address: %s\n", cmd->parms[0]);
+        break;
+      }
+      count = atoi(cmd->parms[1]);
+      if (count == 0) count = DBGCMD_DISAS_DEFAULT_COUNT;
+
+      Disas_Print(dbgOut, address, count);
+      break;
+    }
+
+  case DBGCMD_DISPLAY:
+    {
+      /* Redraw everything at the next prompt */
+      Disp_Invalidate();
+      break;
+    }
+
+  case DBGCMD_STATS:
+    {
+      /* 'stats', 'stats reset' or 'stats json FILE' */
+      if (strcmp(cmd->parms[0], "reset") == 0)
+        Stats_Reset();
+      else if (strcmp(cmd->parms[0], "json") == 0)
+      {
+        if (cmd->parms[1][0] && !Stats_WriteJsonFile(cmd->parms[1]))
+          fprintf(dbgErr, "stats: cannot write %s\n", cmd->parms[1]);
+        else if (!cmd->parms[1][0])
+          Stats_WriteJson(dbgOut);
+      }
+      else if (cmd->parms[0][0])
+        fprintf(dbgErr, "stats: expected 'reset' or 'json [FILE]': %s\n", cmd->parms[0]);
+      else
+        Stats_Print(dbgOut);
+      break;
+    }
+
+  case DBGCMD_METRICS:
+    {
+      /* 'metrics' or 'metrics prom [FILE]' */
+      if (strcmp(cmd->parms[0], "prom") == 0)
+      {
+        if (cmd->parms[1][0] && !Metrics_WritePrometheusFile(cmd->parms[1]))
+          fprintf(dbgErr, "metrics: cannot write %s\n", cmd->parms[1]);
+        else if (!cmd->parms[1][0])
+          Metrics_WritePrometheus(dbgOut);
+      }
+      else if (cmd->parms[0][0])
+        fprintf(dbgErr, "metrics: expected 'prom [FILE]': %s\n", cmd->parms[0]);
+      else
+        Metrics_Print(dbgOut);
+      break;
+    }
+
+  case DBGCMD_PROFILE:
+    {
+      /* 'profile [N]', 'profile on|off|reset' or 'profile write [FILE]' */
+      u32   count = PROF_DEFAULT_TOP;
+      char* end   = "";
+
+      if (cmd->parms[0][0] && isdigit((unsigned char)cmd->parms[0][0]))
+        count = strtoul(cmd->parms[0], &end, 0);
+
+      if (strcmp(cmd->parms[0], "on") == 0)
+        Prof_SetEnabled(true);
+      else if (strcmp(cmd->parms[0], "off") == 0)
+        Prof_SetEnabled(false);
+      else if (strcmp(cmd->parms[0], "reset") == 0)
+        Prof_Reset();
+      else if (strcmp(cmd->parms[0], "write") == 0)
+      {
+        if (cmd->parms[1][0] && !Prof_WriteCollapsedFile(cmd->parms[1]))
+          fprintf(dbgErr, "profile: cannot write %s\n", cmd->parms[1]);
+        else if (!cmd->parms[1][0])
+          Prof_WriteCollapsed(dbgOut);
+      }
+      else if ((cmd->parms[0][0] && !isdigit((unsigned char)cmd->parms[0][0])) || *end)
+        fprintf(dbgErr, "profile: expected a count, 'on', 'off', 'reset' or 'write [FILE]': %s\n",
+                cmd->parms[0]);
+      else
+      {
+        if (!Prof_IsEnabled())
+          fprintf(dbgOut, "Profiling is off; 'profile on' starts it.\n");
+        Prof_PrintTop(dbgOut, count);
+      }
+      break;
+    }
+
+  case DBGCMD_SYMBOLS:
+    {
+      if (!cmd->parms[0][0])
+      {
+        fprintf(dbgOut, "%u symbols loaded.\n", Sym_GetCount());
+        break;
+      }
+      if (!Sym_Load(cmd->parms[0]))
+      {
+        fprintf(dbgErr, "symbols: cannot read %s\n", cmd->parms[0]);
+        break;
       }
+      fprintf(dbgOut, "%u symbols loaded.\n", Sym_GetCount());
       break;
     }
 
   case DBGCMD_X:
     {
       char*  fmt;
-      u16    numUnits;
+      u32    numUnits;
       char   formatType;
       char   unitType;
       word_t address;
@@ -480,10 +1061,9 @@ Dbg_ExecuteCmd(struct dbg_cmd* cmd)
         unitType = *(fmt++);
       }
 
-      if (cmd->flags & DBGCMD_FLG_HASEXPARMS)
-        address = atoi(cmd->parms[1]);
-      else
-        address = atoi(cmd->parms[0]);
+      if (!Dbg_ParseAddress(cmd->parms[(cmd->flags & DBGCMD_FLG_HASEXPARMS) ? 1 : 0],
+                            &address))
+        address = 0;
 
       /*
 #ifdef _DEBUG
@@ -495,28 +1075,272 @@ Dbg_ExecuteCmd(struct dbg_cmd* cmd)
       break;
     }
 
-  case DBGCMD_QUIT:
+  case DBGCMD_STEP:
     {
-      isRunning = false;
+      u16 i, repeatCount;
+      u8  stopReason;
+
+      repeatCount = atoi(cmd->parms[0]);
+      if (repeatCount == 0) repeatCount = 1;
+
+      stopReason = CPU_STOP_CYCLELIMIT;
+      for (i = 0;
+           i < repeatCount && stopReason == CPU_STOP_CYCLELIMIT;
+           ++i)
+      {
+        word_t pc     = CPU_GetProgramCounter();
+        byte_t opcode = Mem_ReadByte(pc);
+
+        if (!CPU_IsCallInstruction(opcode))
+        {
+          CPU_Step();
+          if (CPU_IsHalted())
+            stopReason = CPU_STOP_HALTED;
+          continue;
+        }
+
+        /* Run the whole call at full speed, stopping when it returns
+           to the next instruction with the stack no deeper than now
+           (so recursive calls don't stop early) */
+        Bp_SetTemporary(pc + CPU_GetInstructionLength(opcode),
+                        CPU_GetStackPointer());
+        stopReason = Throttle_Run(CPU_NO_CYCLELIMIT);
+        Bp_ClearTemporary();
+
+        if (stopReason == CPU_STOP_BREAKPOINT &&
+            CPU_GetProgramCounter() == (word_t)(pc + CPU_GetInstructionLength(opcode)) &&
+            !Bp_IsSet(CPU_GetProgramCounter()))
+          stopReason = CPU_STOP_CYCLELIMIT;
+      }
+      Dbg_ReportStop(stopReason);
       break;
     }
 
-  case DBGCMD_NOCMD:
+  case DBGCMD_FINISH:
     {
+      CPU_SetReturnWatch(CPU_GetStackPointer());
+      Dbg_ReportStop(Throttle_Run(CPU_NO_CYCLELIMIT));
+      CPU_SetReturnWatch(CPU_NO_RETURNWATCH);
       break;
     }
 
-  default:
+  case DBGCMD_CONTINUE:
     {
-      /* TODO: Sanity check? */
-      return;
+      Dbg_ReportStop(Throttle_Run(CPU_NO_CYCLELIMIT));
+      break;
     }
-  }
-}
 
-bool
-Dbg_LoadProgram(char* path)
-{
+  case DBGCMD_UNTIL:
+    {
+      word_t address;
+      u8     stopReason;
+
+      if (!Dbg_ParseAddress(cmd->parms[0], &address))
+      {
+        fprintf(dbgErr, "until: invalid address: %s\n", cmd->parms[0]);
+        break;
+      }
+
+      Bp_SetTemporary(address, 0);
+      stopReason = Throttle_Run(CPU_NO_CYCLELIMIT);
+      Bp_ClearTemporary();
+
+      if (stopReason == CPU_STOP_BREAKPOINT &&
+          CPU_GetProgramCounter() == address)
+        fprintf(dbgOut, "Stopped at 0x%04x.\n", address);
+      else
+        Dbg_ReportStop(stopReason);
+      break;
+    }
+
+  case DBGCMD_REVERSESTEP:
+    {
+      u64 count;
+
+      count = strtoull(cmd->parms[0], 0, 0);
+      if (count == 0) count = 1;
+
+      if (count > Hist_GetReachableDepth())
+        fprintf(dbgErr, "reverse-step: history only reaches back %llu instructions\n",
+                (unsigned long long)Hist_GetReachableDepth());
+      else if (!Hist_GoBack(count))
+        fprintf(dbgErr, "reverse-step: re-execution stopped at 0x%04x short of the target\n",
+                CPU_GetProgramCounter());
+      break;
+    }
+
+  case DBGCMD_REVERSECONTINUE:
+    {
+      bool found = false;
+
+      while (Hist_StepBack())
+      {
+        if (Bp_IsSet(CPU_GetProgramCounter()) &&
+            Bp_Matches(CPU_GetProgramCounter()))
+        {
+          found = true;
+          break;
+        }
+      }
+
+      if (found)
+        Dbg_ReportStop(CPU_STOP_BREAKPOINT);
+      else
+        fprintf(dbgOut, "Reached the start of recorded history.\n");
+      break;
+    }
+
+  case DBGCMD_BREAK:
+    {
+      word_t address;
+      u32    i;
+
+      char*  condition;
+      char*  errorMessage;
+
+      if (!cmd->parms[0][0])
+      {
+        if (!Bp_GetCount())
+          fprintf(dbgOut, "No breakpoints.\n");
+        for (i = 0; i < Bp_GetCount(); ++i)
+        {
+          const struct breakpoint* breakpoint = Bp_Get(i);
+          fprintf(dbgOut, "Breakpoint at 0x%04x%s  hits=%llu", breakpoint->address,
+                 Dbg_SymbolSuffix(breakpoint->address),
+                 (unsigned long long)breakpoint->hitCount);
+          if (breakpoint->ignoreCount)
+            fprintf(dbgOut, "  ignore=%llu", (unsigned long long)breakpoint->ignoreCount);
+          if (breakpoint->hasCondition)
+            fprintf(dbgOut, "  if %s", breakpoint->conditionText);
+          fprintf(dbgOut, "\n");
+        }
+        break;
+      }
+
+      /* 'break ADDR if EXPR' */
+      condition = 0;
+      if (strcmp(cmd->parms[1], "if") == 0)
+      {
+        condition  = cmd->args + strcspn(cmd->args, " \t");
+        condition += strspn(condition, " \t") + 2;
+        condition += strspn(condition, " \t");
+        if (!*condition)
+        {
+          fprintf(dbgErr, "break: missing condition\n");
+          break;
+        }
+      }
+      else if (cmd->parms[1][0])
+      {
+        fprintf(dbgErr, "break: expected 'if': %s\n", cmd->parms[1]);
+        break;
+      }
+
+      if (!Dbg_ParseAddress(cmd->parms[0], &address))
+      {
+        fprintf(dbgErr, "break: invalid address: %s\n", cmd->parms[0]);
+        break;
+      }
+      if (!Bp_Set(address))
+      {
+        fprintf(dbgErr, "break: cannot set breakpoint at 0x%04x\n", address);
+        break;
+      }
+      if (condition &&
+          !Bp_SetCondition(address, condition, &errorMessage))
+      {
+        fprintf(dbgErr, "break: %s: %s\n", errorMessage, condition);
+        Bp_Clear(address);
+        break;
+      }
+      fprintf(dbgOut, "Breakpoint at 0x%04x%s\n", address, Dbg_SymbolSuffix(address));
+      break;
+    }
+
+  case DBGCMD_CONDITION:
+    {
+      word_t address;
+      char*  condition;
+      char*  errorMessage;
+
+      if (!Dbg_ParseAddress(cmd->parms[0], &address))
+      {
+        fprintf(dbgErr, "condition: invalid address: %s\n", cmd->parms[0]);
+        break;
+      }
+
+      /* everything after the address; empty removes the condition */
+      condition  = cmd->args + strcspn(cmd->args, " \t");
+      condition += strspn(condition, " \t");
+      if (!Bp_SetCondition(address, condition, &errorMessage))
+        fprintf(dbgErr, "condition: %s\n", errorMessage);
+      break;
+    }
+
+  case DBGCMD_IGNORE:
+    {
+      word_t address;
+      char*  end;
+      u64    count;
+
+      if (!Dbg_ParseAddress(cmd->parms[0], &address))
+      {
+        fprintf(dbgErr, "ignore: invalid address: %s\n", cmd->parms[0]);
+        break;
+      }
+      count = strtoull(cmd->parms[1], &end, 0);
+      if (!cmd->parms[1][0] || *end)
+      {
+        fprintf(dbgErr, "ignore: invalid count: %s\n", cmd->parms[1]);
+        break;
+      }
+      if (!Bp_SetIgnoreCount(address, count))
+        fprintf(dbgErr, "ignore: no breakpoint at 0x%04x\n", address);
+      break;
+    }
+
+  case DBGCMD_DELETE:
+    {
+      word_t address;
+
+      if (!cmd->parms[0][0])
+      {
+        Bp_ClearAll();
+        break;
+      }
+
+      if (!Dbg_ParseAddress(cmd->parms[0], &address))
+      {
+        fprintf(dbgErr, "delete: invalid address: %s\n", cmd->parms[0]);
+        break;
+      }
+      if (!Bp_Clear(address))
+        fprintf(dbgErr, "delete: no breakpoint at 0x%04x\n", address);
+      break;
+    }
+
+  case DBGCMD_QUIT:
+    {
+      isRunning = false;
+      break;
+    }
+
+  case DBGCMD_NOCMD:
+    {
+      break;
+    }
+
+  default:
+    {
+      /* TODO: Sanity check? */
+      return;
+    }
+  }
+}
+
+bool
+Dbg_LoadProgram(char* path)
+{
   FILE* fp;
   fp = fopen(path, "rb");
   if (!fp)
@@ -528,155 +1352,558 @@ Dbg_LoadProgram(char* path)
   return true;
 }
 
+/*
+  Dbg_ParseAddress()
+
+  Parse an address in C notation (0x1234, 01234 or 1234), or as a
+  symbol name optionally followed by +offset. Returns false if the
+  string is neither or is out of range.
+*/
+bool
+Dbg_ParseAddress(char* string, word_t* address)
+{
+  char          name[SYM_MAX_NAME];
+  char*         plus;
+  char*         end;
+  unsigned long value;
+  word_t        base;
+  u32           length;
+
+  if (!string || !*string)
+    return false;
+
+  value = strtoul(string, &end, 0);
+  if (!*end && value <= 0xffff)
+  {
+    *address = (word_t)value;
+    return true;
+  }
+
+  plus   = strchr(string, '+');
+  length = plus ? (u32)(plus - string) : strlen(string);
+  if (length == 0 || length >= SYM_MAX_NAME)
+    return false;
+  memcpy(name, string, length);
+  name[length] = '\0';
+  if (!Sym_FindAddress(name, &base))
+    return false;
+
+  value = 0;
+  if (plus)
+  {
+    value = strtoul(plus + 1, &end, 0);
+    if (!plus[1] || *end)
+      return false;
+  }
+  if (base + value > 0xffff)
+    return false;
+
+  *address = (word_t)(base + value);
+  return true;
+}
+
+/*
+  Dbg_FindCmd()
+
+  Look up a command by name, alias or unique prefix, and copy its
+  table entry into 'cmd'. Returns the number of commands matched: 0
+  for none, 1 on success, and more than 1 if the prefix is ambiguous.
+*/
 int
 Dbg_FindCmd(struct dbg_cmd* cmd, char* cmdName)
 {
-  struct dbg_cmd* currCmd;
-  int i;
-  int foundCount;
+  struct dbg_trie_node* node;
+  char*                 c;
+  i16                   cmdIndex;
 
-  /*
-#ifdef _DEBUG
-  Log_Debug("Dbg_FindCmd: Searching for '%s'", cmdName);
-#endif
-  */
+  if (!*cmdName)
+    return 0;
 
-  foundCount = 0;
-  for (i = 0;
-       i < DBGCMD_NUMCMDS;
-       ++i)
+  node = &cmdTrie[0];
+  for (c = cmdName; *c; ++c)
   {
-    currCmd = &DebuggerCommands[i];
-    /* TODO: Exact match should override multiple hits */
-    if (strcmp(currCmd->cmdName, cmdName) == 0)
-    {
-      memcpy(cmd, currCmd, sizeof(struct dbg_cmd));
-      /*
-#ifdef _DEBUG
-      Log_Debug("Dbg_FindCmd: Found '%s'", currCmd->cmdName); 
-#endif
-      */
-      return 1;
-    }
-    else if (FuzzyCompare(currCmd->cmdName, cmdName))
-    {
-      memcpy(cmd, currCmd, sizeof(struct dbg_cmd));
-      /*
+    u16 child;
+
+    if (*c < DBG_TRIE_FIRST_CHAR || *c >= 0x80)
+      return 0;
+    child = node->children[*c - DBG_TRIE_FIRST_CHAR];
+    if (!child)
+      return 0;
+    node = &cmdTrie[child];
+  }
+
+  cmdIndex = (node->exactCmd != DBG_TRIE_NONE) ? node->exactCmd : node->prefixCmd;
+  if (cmdIndex == DBG_TRIE_AMBIGUOUS)
+    return 2;
+  if (cmdIndex == DBG_TRIE_NONE)
+    return 0;
+
+  /*
 #ifdef _DEBUG
-      Log_Debug("Dbg_FindCmd: Found '%s'", currCmd->cmdName); 
+  Log_Debug("Dbg_FindCmd: Found '%s'", DebuggerCommands[cmdIndex].cmdName);
 #endif
-      */
-      ++foundCount;
-    }
-  }
-  return foundCount;
+  */
+  memcpy(cmd, &DebuggerCommands[cmdIndex], sizeof(struct dbg_cmd));
+  return 1;
 }
 
 void
-Dbg_DumpMemory(word_t address, u16 numUnits, char formatType, char unitType)
+Dbg_DumpMemory(word_t address, u32 numUnits, char formatType, char unitType)
 {
-  /*
-    TODO: Implement all formats/unit types
-    TODO: Allow for different numbering systems (hex/octal) as params
-  */
-  char* ValidFormatTypes = "acdfostux";
+  char* ValidFormatTypes = "acdfiostux";
   char* ValidUnitTypes   = "bw";
 
   if (numUnits < 1) return;
   if (!CharInString(ValidFormatTypes, formatType))
   {
-    fprintf(stderr, "Invalid format type: %c\n", formatType);
+    fprintf(dbgErr, "Invalid format type: %c\n", formatType);
     return;
   }
   if (!CharInString(ValidUnitTypes, unitType))
   {
-    fprintf(stderr, "Invalid unit type: %c\n", unitType);
+    fprintf(dbgErr, "Invalid unit type: %c\n", unitType);
     return;
   }
 
+  if (formatType == 'i')
+    Disas_Print(dbgOut, address, numUnits);
+  else
+    Dump_Memory(dbgOut, address, numUnits, formatType, unitType);
+}
+
+/*
+  Dbg_SymbolSuffix()
+
+  Return " <name+offset>" for an address that falls in a symbol, or an
+  empty string. The result is only valid until the next call.
+*/
+internal const char*
+Dbg_SymbolSuffix(word_t address)
+{
+  static char suffix[SYM_MAX_NAME + 20];
+  u32         length;
+
+  length = Sym_Format(address, suffix + 2, sizeof(suffix) - 3);
+  if (!length)
+    return "";
+  suffix[0] = ' ';
+  suffix[1] = '<';
+  suffix[length + 2] = '>';
+  suffix[length + 3] = '\0';
+  return suffix;
+}
+
+void
+Dbg_CmdNotImplemented(char* cmdString)
+{
+  fprintf(dbgErr, "%s: not yet implemented\n", cmdString);
+}
 
-  char fmtString[10];
-  switch (formatType)
+void
+Dbg_ReportStop(u8 stopReason)
+{
+  lastStopReason = stopReason;
+  switch (stopReason)
   {
-  case 'o':
+  case CPU_STOP_HALTED:
+    {
+      fprintf(dbgOut, "Program halted at 0x%04x%s.\n", CPU_GetProgramCounter(),
+              Dbg_SymbolSuffix(CPU_GetProgramCounter()));
+      break;
+    }
+
+  case CPU_STOP_BREAKPOINT:
+    {
+      fprintf(dbgOut, "Breakpoint at 0x%04x%s.\n", CPU_GetProgramCounter(),
+              Dbg_SymbolSuffix(CPU_GetProgramCounter()));
+      break;
+    }
+
+  case CPU_STOP_RETURNED:
     {
-      u8 digits = (unitType == 'b') ? 4 : 8;
-      sprintf(fmtString, " %%0%do", digits);
+      fprintf(dbgOut, "Returned to 0x%04x%s.\n", CPU_GetProgramCounter(),
+              Dbg_SymbolSuffix(CPU_GetProgramCounter()));
       break;
     }
-  case 'x':
+
+  case CPU_STOP_REQUESTED:
+    {
+      fprintf(dbgOut, "Program stopped at 0x%04x%s.\n", CPU_GetProgramCounter(),
+              Dbg_SymbolSuffix(CPU_GetProgramCounter()));
+      break;
+    }
+
   default:
     {
-      u8 digits = (unitType == 'b') ? 2 : 4;
-      sprintf(fmtString, " %%0%dx", digits);
       break;
     }
   }
-  printf("\n");
-  u8  bytesPerRow = 16;
-  u16 numCols = (unitType == 'w') ? 8 : 16;
-  u16 numRows = (numUnits / numCols) + 1;
-  u16 numBytes = numUnits * ((unitType == 'b') ? 1 : 2);
-  u16 lastByte = address + numBytes - 1;
-  u16 currByte = address;
-  for (u16 row = 0;
-       row < numRows && currByte <= lastByte;
-       ++row)
+}
+
+void
+Dbg_PrintRegs()
+{
+  fprintf(dbgOut, "\n");
+  fprintf(dbgOut, " A: 0x%02x\n", CPU_GetRegValue(REG_A));
+  fprintf(dbgOut, " B: 0x%02x\n", CPU_GetRegValue(REG_B));
+  fprintf(dbgOut, " C: 0x%02x\n", CPU_GetRegValue(REG_C));
+  fprintf(dbgOut, " D: 0x%02x\n", CPU_GetRegValue(REG_D));
+  fprintf(dbgOut, " E: 0x%02x\n", CPU_GetRegValue(REG_E));
+  fprintf(dbgOut, " H: 0x%02x\n", CPU_GetRegValue(REG_H));
+  fprintf(dbgOut, " L: 0x%02x\n", CPU_GetRegValue(REG_L));
+
+  fprintf(dbgOut, "\n");
+  fprintf(dbgOut, "SP: 0x%04x\n", CPU_GetStackPointer());
+  fprintf(dbgOut, "PC: 0x%04x\n", CPU_GetProgramCounter());
+
+  fprintf(dbgOut, "\n");
+  fprintf(dbgOut, "Flags:");
+  fprintf(dbgOut, " %s", CPU_GetFlag(FLG_SIGN)   ? "S"  : "s");
+  fprintf(dbgOut, " %s", CPU_GetFlag(FLG_ZERO)   ? "Z"  : "z");
+  fprintf(dbgOut, " %s", CPU_GetFlag(FLG_AUXCRY) ? "AC" : "ac");
+  fprintf(dbgOut, " %s", CPU_GetFlag(FLG_PARITY) ? "P"  : "p");
+  fprintf(dbgOut, " %s", CPU_GetFlag(FLG_CARRY)  ? "C"  : "c");
+  fprintf(dbgOut, "\n\n");
+}
+
+internal const char*
+Dbg_StopReasonName(u8 stopReason)
+{
+  switch (stopReason)
+  {
+  case CPU_STOP_CYCLELIMIT: { return "cyclelimit"; }
+  case CPU_STOP_REQUESTED:  { return "requested";  }
+  case CPU_STOP_HALTED:     { return "halted";     }
+  case CPU_STOP_BREAKPOINT: { return "breakpoint"; }
+  case CPU_STOP_RETURNED:   { return "returned";   }
+  default:                  { return 0;            }
+  }
+}
+
+internal void
+Dbg_WriteJsonString(FILE* out, const char* string, size_t length)
+{
+  fputc('"', out);
+  for (size_t i = 0; i < length; ++i)
+  {
+    unsigned char c = string[i];
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c == '\n')
+      fputs("\\n", out);
+    else if (c < 0x20 || c >= 0x7f)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+/*
+  Report a script line that cannot be parsed, both on stderr and as a
+  JSON record with an "error" field.
+*/
+internal void
+Dbg_ReportScriptError(char* path, u32 lineNumber, char* keyword, const char* fmt, ...)
+{
+  char    message[512];
+  va_list args;
+
+  va_start(args, fmt);
+  vsnprintf(message, sizeof(message), fmt, args);
+  va_end(args);
+
+  fprintf(stderr, "%s:%u: %s\n", path, lineNumber, message);
+  printf("{\"line\":%u,\"cmd\":", lineNumber);
+  Dbg_WriteJsonString(stdout, keyword, strlen(keyword));
+  printf(",\"error\":");
+  Dbg_WriteJsonString(stdout, message, strlen(message));
+  printf("}\n");
+}
+
+/*
+  Parse a script command, returning in 'errorMessage' what the parser
+  printed about a failure, or null. Free it after use.
+*/
+internal bool
+Dbg_ParseScriptCmd(struct dbg_cmd* cmd, char* cmdString, char** errorMessage)
+{
+  size_t length = 0;
+  bool   parsed;
+
+  *errorMessage = 0;
+  dbgErr = open_memstream(errorMessage, &length);
+  if (!dbgErr)
+    dbgErr = stderr;
+  parsed = Dbg_ParseCmd(cmd, cmdString);
+  if (dbgErr != stderr)
+    fclose(dbgErr);
+  dbgErr = stderr;
+
+  if (*errorMessage && length && (*errorMessage)[length - 1] == '\n')
+    (*errorMessage)[length - 1] = '\0';
+  if (parsed || (*errorMessage && !**errorMessage))
+  {
+    free(*errorMessage);
+    *errorMessage = 0;
+  }
+  return parsed;
+}
+
+/*
+  Dbg_LoadScript()
+
+  Read and parse a whole script. A path of "-" reads stdin. Nothing is
+  run if any line fails to parse.
+*/
+bool
+Dbg_LoadScript(char* path)
+{
+  FILE* fp;
+  char  line[1024];
+  u32   capacity;
+  u32   lineNumber;
+  u32   openBlocks[MAX_SCRIPT_DEPTH];
+  u32   depth;
+
+  fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+  if (!fp)
+  {
+    fprintf(stderr, "Cannot open script: %s\n", path);
+    return false;
+  }
+
+  capacity     = 0;
+  scriptLength = 0;
+  lineNumber   = 0;
+  depth        = 0;
+  while (fgets(line, sizeof(line), fp))
   {
-    printf("0x%04x: ", address + (bytesPerRow*row));
-    for (u16 col = 0;
-         col < numCols && currByte <= lastByte;
-         ++col)
+    struct script_op* op;
+    char*             keyword;
+    char*             rest;
+    char*             errorMessage;
+
+    ++lineNumber;
+    line[strcspn(line, "\r\n")] = '\0';
+    keyword = line + strspn(line, " \t");
+    if (*keyword == '\0' || *keyword == '#')
+      continue;
+
+    if (scriptLength == capacity)
     {
-      switch (unitType)
+      capacity  = capacity ? capacity * 2 : 64;
+      scriptOps = (struct script_op*)realloc(scriptOps, capacity * sizeof(struct script_op));
+    }
+    op = &scriptOps[scriptLength];
+    memset(op, 0, sizeof(struct script_op));
+    op->lineNumber = lineNumber;
+
+    rest = keyword + strcspn(keyword, " \t");
+    if (*rest)
+      *rest++ = '\0';
+    rest += strspn(rest, " \t");
+
+    if (strcmp(keyword, "repeat") == 0 ||
+        strcmp(keyword, "while") == 0)
+    {
+      if (depth == MAX_SCRIPT_DEPTH)
+      {
+        Dbg_ReportScriptError(path, lineNumber, keyword, "blocks nested too deeply");
+        goto failed;
+      }
+      if (keyword[0] == 'r')
       {
-      case 'b':
+        op->kind  = SCRIPTOP_REPEAT;
+        op->count = strtoul(rest, &errorMessage, 0);
+        if (*rest == '\0' || *errorMessage != '\0')
         {
-          printf(fmtString, Mem_ReadByte(currByte));
-          break;
+          Dbg_ReportScriptError(path, lineNumber, keyword, "repeat: invalid count: %s", rest);
+          goto failed;
         }
-      case 'w':
+      }
+      else
+      {
+        op->kind = SCRIPTOP_WHILE;
+        if (!Expr_Compile(rest, &op->condition, &errorMessage))
         {
-          printf(fmtString, Mem_ReadWord(currByte));
-          break;
+          Dbg_ReportScriptError(path, lineNumber, keyword, "while: %s: %s", errorMessage, rest);
+          goto failed;
         }
       }
-      currByte += (unitType == 'b') ? 1 : 2;
+      openBlocks[depth++] = scriptLength;
     }
-    printf("\n");
+    else if (strcmp(keyword, "end") == 0)
+    {
+      if (depth == 0)
+      {
+        Dbg_ReportScriptError(path, lineNumber, keyword, "end without repeat or while");
+        goto failed;
+      }
+      op->kind  = SCRIPTOP_END;
+      op->match = openBlocks[--depth];
+      scriptOps[op->match].match = scriptLength;
+    }
+    else
+    {
+      /* Put the line back together for the command parser */
+      if (*rest)
+        rest[-1] = ' ';
+      op->kind = SCRIPTOP_CMD;
+      if (!Dbg_ParseScriptCmd(&op->cmd, keyword, &errorMessage))
+      {
+        keyword[strcspn(keyword, " \t")] = '\0';
+        Dbg_ReportScriptError(path, lineNumber, keyword, "%s",
+                              errorMessage ? errorMessage : "invalid command");
+        free(errorMessage);
+        goto failed;
+      }
+    }
+    ++scriptLength;
   }
-  printf("\n");
-  
+
+  if (depth)
+  {
+    struct script_op* open = &scriptOps[openBlocks[depth - 1]];
+
+    Dbg_ReportScriptError(path, open->lineNumber,
+                          (open->kind == SCRIPTOP_REPEAT) ? "repeat" : "while", "missing end");
+    goto failed;
+  }
+  if (fp != stdin)
+    fclose(fp);
+  return true;
+
+failed:
+  if (fp != stdin)
+    fclose(fp);
+  scriptLength = 0;
+  return false;
 }
 
-void
-Dbg_CmdNotImplemented(char* cmdString)
+/*
+  Dbg_RunScriptCmd()
+
+  Run one command with its output and error messages captured, then
+  write the result as a JSON object. A command that printed an error
+  gets an "error" field.
+*/
+internal void
+Dbg_RunScriptCmd(struct script_op* op)
 {
-  fprintf(stderr, "%s: not yet implemented\n", cmdString);
+  const struct registers* regs;
+  const char*             stopName;
+  char*                   output;
+  size_t                  outputLength;
+  char*                   error;
+  size_t                  errorLength;
+
+  output         = 0;
+  outputLength   = 0;
+  error          = 0;
+  errorLength    = 0;
+  lastStopReason = DBG_STOP_NONE;
+  dbgOut         = open_memstream(&output, &outputLength);
+  if (!dbgOut)
+    dbgOut = stderr;
+  dbgErr         = open_memstream(&error, &errorLength);
+  if (!dbgErr)
+    dbgErr = stderr;
+
+  Dbg_ExecuteCmd(&op->cmd);
+
+  if (dbgOut != stderr)
+    fclose(dbgOut);
+  if (dbgErr != stderr)
+    fclose(dbgErr);
+  dbgOut = stdout;
+  dbgErr = stderr;
+
+  regs     = CPU_GetRegisters();
+  stopName = Dbg_StopReasonName(lastStopReason);
+  printf("{\"line\":%u,\"cmd\":\"%s\",\"args\":", op->lineNumber, op->cmd.cmdName);
+  Dbg_WriteJsonString(stdout, op->cmd.args, strlen(op->cmd.args));
+  printf(",\"pc\":%u,\"sp\":%u,\"cycles\":%llu", regs->PC, regs->SP,
+         (unsigned long long)CPU_GetCycleCount());
+  printf(",\"regs\":{\"a\":%u,\"b\":%u,\"c\":%u,\"d\":%u,\"e\":%u,\"h\":%u,\"l\":%u,\"f\":%u}",
+         regs->A, regs->B, regs->C, regs->D, regs->E, regs->H, regs->L, regs->F);
+  if (stopName)
+    printf(",\"stop\":\"%s\"", stopName);
+  if (outputLength)
+  {
+    printf(",\"output\":");
+    Dbg_WriteJsonString(stdout, output, outputLength);
+  }
+  if (errorLength)
+  {
+    /* Also on stderr, as when run interactively */
+    fwrite(error, 1, errorLength, stderr);
+    if (error[errorLength - 1] == '\n')
+      --errorLength;
+    printf(",\"error\":");
+    Dbg_WriteJsonString(stdout, error, errorLength);
+  }
+  printf("}\n");
+
+  free(output);
+  free(error);
 }
 
 void
-Dbg_PrintRegs()
+Dbg_RunScript()
 {
-  printf("\n");
-  printf(" A: 0x%02x\n", CPU_GetRegValue(REG_A));
-  printf(" B: 0x%02x\n", CPU_GetRegValue(REG_B));
-  printf(" C: 0x%02x\n", CPU_GetRegValue(REG_C));
-  printf(" D: 0x%02x\n", CPU_GetRegValue(REG_D));
-  printf(" E: 0x%02x\n", CPU_GetRegValue(REG_E));
-  printf(" H: 0x%02x\n", CPU_GetRegValue(REG_H));
-  printf(" L: 0x%02x\n", CPU_GetRegValue(REG_L));
-
-  printf("\n");
-  printf("SP: 0x%04x\n", CPU_GetStackPointer());
-  printf("PC: 0x%04x\n", CPU_GetProgramCounter());
-
-  printf("\n");
-  printf("Flags:");
-  printf(" %s", CPU_GetFlag(FLG_SIGN)   ? "S"  : "s");
-  printf(" %s", CPU_GetFlag(FLG_ZERO)   ? "Z"  : "z");
-  printf(" %s", CPU_GetFlag(FLG_AUXCRY) ? "AC" : "ac");
-  printf(" %s", CPU_GetFlag(FLG_PARITY) ? "P"  : "p");
-  printf(" %s", CPU_GetFlag(FLG_CARRY)  ? "C"  : "c");
-  printf("\n\n");
+  u32 remaining[MAX_SCRIPT_DEPTH];
+  u32 depth;
+  u32 pc;
+
+  isRunning = true;
+  depth     = 0;
+  pc        = 0;
+  while (pc < scriptLength && isRunning)
+  {
+    struct script_op* op = &scriptOps[pc];
+
+    switch (op->kind)
+    {
+    case SCRIPTOP_CMD:
+      {
+        Dbg_RunScriptCmd(op);
+        ++pc;
+        break;
+      }
+
+    case SCRIPTOP_REPEAT:
+      {
+        if (op->count == 0)
+        {
+          pc = op->match + 1;
+          break;
+        }
+        remaining[depth++] = op->count;
+        ++pc;
+        break;
+      }
+
+    case SCRIPTOP_WHILE:
+      {
+        pc = Expr_Evaluate(&op->condition) ? pc + 1 : op->match + 1;
+        break;
+      }
+
+    case SCRIPTOP_END:
+      {
+        if (scriptOps[op->match].kind == SCRIPTOP_WHILE)
+          pc = op->match;
+        else if (--remaining[depth - 1])
+          pc = op->match + 1;
+        else
+        {
+          --depth;
+          ++pc;
+        }
+        break;
+      }
+    }
+  }
+  fflush(stdout);
 }
@@ -1,20 +1,94 @@
+#include "breakpoint.h"
 #include "common.h"
+#include "history.h"
 #include "log.h"
 #include "memory.h"
+#include "trace.h"
 
 
 
 internal byte_t* memory;
 internal u32     memSize;
 
+/* MEM_HOOK_* bits */
+internal u32     writeHooks;
+
+internal u32     pageGenerations[MEM_NUM_PAGES];
+
+
+/*
+  Tell interested modules a byte is about to be modified, while its
+  old value is still in memory. Only called when a hook is enabled.
+*/
+internal void
+Mem_NotifyWrite(word_t address)
+{
+  if (writeHooks & MEM_HOOK_HISTORY)
+    Hist_RecordWrite(address, memory[address]);
+  if (writeHooks & MEM_HOOK_WATCH)
+    Bp_NotifyWrite(address);
+  if (writeHooks & MEM_HOOK_GENERATION)
+    ++pageGenerations[address >> MEM_PAGE_SHIFT];
+  if (writeHooks & MEM_HOOK_TRACE)
+    Trace_NoteWrite(address, 1);
+}
+
 byte_t*
 Mem_Init(u32 size)
 {
-  memory  = (byte_t*)malloc(size);
+  memory  = (byte_t*)calloc(size, 1);
   memSize = size;
   return memory;
 }
 
+u32
+Mem_GetSize()
+{
+  return memSize;
+}
+
+/*
+  Direct access to the whole memory block for bulk operations such as
+  snapshots. Writes through it bypass the write hooks.
+*/
+byte_t*
+Mem_GetBase()
+{
+  return memory;
+}
+
+void
+Mem_EnableWriteHook(u32 hook, bool enabled)
+{
+  if (enabled)
+    writeHooks |= hook;
+  else
+    writeHooks &= ~hook;
+}
+
+u32
+Mem_GetPageGeneration(word_t address)
+{
+  return pageGenerations[address >> MEM_PAGE_SHIFT];
+}
+
+void
+Mem_MarkModified(word_t address, u32 length)
+{
+  u32 page;
+  u32 lastPage;
+
+  if (length == 0)
+    return;
+  if (writeHooks & MEM_HOOK_TRACE)
+    Trace_NoteWrite(address, length);
+  lastPage = ((u32)address + length - 1) >> MEM_PAGE_SHIFT;
+  for (page = address >> MEM_PAGE_SHIFT;
+       page <= lastPage && page < MEM_NUM_PAGES;
+       ++page)
+    ++pageGenerations[page];
+}
+
 byte_t
 Mem_ReadByte(word_t address)
 {
@@ -48,6 +122,8 @@ Mem_WriteByte(word_t address, byte_t data)
     abort();
   }
 
+  if (writeHooks)
+    Mem_NotifyWrite(address);
   memory[address] = data;
 }
 
@@ -55,20 +131,29 @@ void
 Mem_WriteWord(word_t address, word_t data)
 {
 
-#ifdef _DEBUG
-  Log_Debug("Mem_WriteWord: address=0x%04x data=0x%04x", address, data);
-#endif
+  LOG_TRACE(LOG_CAT_MEM, "Mem_WriteWord: address=0x%04x data=0x%04x", address, data);
   
-  if (address > memSize - 1)
+  if (address + 1 > memSize - 1)
   {
     // TODO: Out of range
     abort();
   }
 
+  if (writeHooks)
+  {
+    Mem_NotifyWrite(address);
+    Mem_NotifyWrite(address+1);
+  }
   memory[address]   = (byte_t)data;
   memory[address+1] = (byte_t)(data >> 8);
 }
 
+/*
+  Mem_GetBytePointer()
+
+  The returned pointer is only used by instructions that modify memory
+  in place, so it counts as a write for the write hooks.
+*/
 byte_t*
 Mem_GetBytePointer(word_t address)
 {
@@ -78,5 +163,7 @@ Mem_GetBytePointer(word_t address)
     return 0;
   }
 
+  if (writeHooks)
+    Mem_NotifyWrite(address);
   return &memory[address];
 }
@@ -8,9 +8,44 @@
 
 
 
+/*
+  Write hooks, called with the address before a byte of memory is
+  modified.
+*/
+#define MEM_HOOK_HISTORY    0x01
+#define MEM_HOOK_WATCH      0x02
+#define MEM_HOOK_GENERATION 0x04
+#define MEM_HOOK_TRACE      0x08
+
+/*
+  Memory is split into pages, each with a generation counter that is
+  bumped whenever a byte in it changes (while MEM_HOOK_GENERATION is
+  enabled). Caches of anything derived from memory stamp their entries
+  with it. Code that writes through Mem_GetBase() calls
+  Mem_MarkModified() itself.
+*/
+#define MEM_PAGE_SHIFT      8
+#define MEM_NUM_PAGES       (0x10000 >> MEM_PAGE_SHIFT)
+
+
 byte_t*
 Mem_Init(u32 size);
 
+u32
+Mem_GetSize();
+
+byte_t*
+Mem_GetBase();
+
+void
+Mem_EnableWriteHook(u32 hook, bool enabled);
+
+u32
+Mem_GetPageGeneration(word_t address);
+
+void
+Mem_MarkModified(word_t address, u32 length);
+
 byte_t
 Mem_ReadByte(word_t address);
 
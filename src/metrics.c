@@ -0,0 +1,204 @@
+#include "cpu.h"
+#include "io.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+#define METRICS_MAX_PATH  4096
+
+/* Host time spent in CPU_Run(), not counting the run in progress */
+internal u64   hostNs;
+internal u64   runStartNs;
+internal bool  running;
+
+/* Periodic export; see Metrics_StartExport() */
+internal char* exportPath;
+internal u64   exportIntervalNs;
+internal u64   nextExportNs;
+
+
+internal u64
+Metrics_GetTimeNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void
+Metrics_EnterRun()
+{
+  runStartNs = Metrics_GetTimeNs();
+  running    = true;
+}
+
+void
+Metrics_LeaveRun()
+{
+  hostNs += Metrics_GetTimeNs() - runStartNs;
+  running = false;
+}
+
+void
+Metrics_Gather(struct metrics* metrics)
+{
+  const struct cpu_interrupt_counts* interrupts = CPU_GetInterruptCounts();
+
+  memset(metrics, 0, sizeof(*metrics));
+  metrics->instructions = CPU_GetRetiredInstructions();
+  metrics->cycles = CPU_GetCycleCount();
+  metrics->hostNs = hostNs;
+  if (running)
+    metrics->hostNs += Metrics_GetTimeNs() - runStartNs;
+  IO_GetCallCounts(&metrics->ioReads, &metrics->ioWrites);
+  metrics->interruptsDelivered = interrupts->delivered;
+  metrics->interruptsIgnored   = interrupts->ignored;
+
+  /* Instructions per microsecond is millions per second */
+  if (metrics->hostNs)
+  {
+    metrics->mips = metrics->instructions * 1e3 / metrics->hostNs;
+    metrics->mhz  = metrics->cycles * 1e3 / metrics->hostNs;
+  }
+}
+
+void
+Metrics_Print(FILE* out)
+{
+  struct metrics metrics;
+
+  Metrics_Gather(&metrics);
+  fprintf(out, "Instructions:  %llu\n", (unsigned long long)metrics.instructions);
+  fprintf(out, "Cycles:        %llu\n", (unsigned long long)metrics.cycles);
+  fprintf(out, "Host time:     %llu ns\n", (unsigned long long)metrics.hostNs);
+  fprintf(out, "Effective:     %.2f MIPS  %.2f MHz\n", metrics.mips, metrics.mhz);
+  fprintf(out, "I/O calls:     %llu in  %llu out\n",
+          (unsigned long long)metrics.ioReads, (unsigned long long)metrics.ioWrites);
+  fprintf(out, "Interrupts:    %llu delivered  %llu ignored\n",
+          (unsigned long long)metrics.interruptsDelivered,
+          (unsigned long long)metrics.interruptsIgnored);
+}
+
+internal void
+Metrics_WriteCounter(FILE* out, const char* name, const char* help, u64 value)
+{
+  fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s{cpu=\"0\"} %llu\n",
+          name, help, name, name, (unsigned long long)value);
+}
+
+internal void
+Metrics_WriteGauge(FILE* out, const char* name, const char* help, double value)
+{
+  fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s{cpu=\"0\"} %.6f\n",
+          name, help, name, name, value);
+}
+
+void
+Metrics_WritePrometheus(FILE* out)
+{
+  struct metrics metrics;
+
+  Metrics_Gather(&metrics);
+  Metrics_WriteCounter(out, "i8080_instructions_total",
+                       "Instructions executed.", metrics.instructions);
+  Metrics_WriteCounter(out, "i8080_cycles_total",
+                       "Guest clock cycles.", metrics.cycles);
+  fprintf(out, "# HELP i8080_host_seconds_total Host time spent running the CPU.\n"
+          "# TYPE i8080_host_seconds_total counter\n"
+          "i8080_host_seconds_total{cpu=\"0\"} %.9f\n", metrics.hostNs / 1e9);
+  Metrics_WriteGauge(out, "i8080_effective_mips",
+                     "Instructions per host microsecond over the run.", metrics.mips);
+  Metrics_WriteGauge(out, "i8080_effective_mhz",
+                     "Guest cycles per host microsecond over the run.", metrics.mhz);
+  Metrics_WriteCounter(out, "i8080_io_reads_total",
+                       "IN instructions executed.", metrics.ioReads);
+  Metrics_WriteCounter(out, "i8080_io_writes_total",
+                       "OUT instructions executed.", metrics.ioWrites);
+  Metrics_WriteCounter(out, "i8080_interrupts_delivered_total",
+                       "Interrupts taken by the CPU.", metrics.interruptsDelivered);
+  Metrics_WriteCounter(out, "i8080_interrupts_ignored_total",
+                       "Interrupts requested while disabled.", metrics.interruptsIgnored);
+}
+
+/*
+  Write the metrics to 'path', or to stdout for "-". A file is written
+  beside its final name and renamed into place.
+*/
+bool
+Metrics_WritePrometheusFile(char* path)
+{
+  char  tempPath[METRICS_MAX_PATH];
+  FILE* fp;
+
+  if (strcmp(path, "-") == 0)
+  {
+    Metrics_WritePrometheus(stdout);
+    fflush(stdout);
+    return true;
+  }
+
+  snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+  fp = fopen(tempPath, "w");
+  if (!fp)
+    return false;
+  Metrics_WritePrometheus(fp);
+  if (fclose(fp) != 0)
+  {
+    remove(tempPath);
+    return false;
+  }
+  return rename(tempPath, path) == 0;
+}
+
+bool
+Metrics_IsExporting()
+{
+  return exportPath != 0;
+}
+
+/*
+  Called by CPU_Run() between batches of at most METRICS_CHECK_CYCLES
+  while exporting. This is driven from the host side, not by a guest
+  scheduler event, so exporting never changes when a halted CPU wakes.
+*/
+void
+Metrics_PollExport()
+{
+  u64 now = Metrics_GetTimeNs();
+
+  if (now < nextExportNs)
+    return;
+  if (!Metrics_WritePrometheusFile(exportPath))
+    fprintf(stderr, "cannot write metrics to %s\n", exportPath);
+  nextExportNs = now + exportIntervalNs;
+}
+
+internal void
+Metrics_ExportAtExit()
+{
+  if (!Metrics_WritePrometheusFile(exportPath))
+    fprintf(stderr, "cannot write metrics to %s\n", exportPath);
+}
+
+/*
+  Metrics_StartExport()
+
+  Write the metrics to 'path' now, every 'intervalSeconds' while the
+  CPU runs, and at exit.
+*/
+bool
+Metrics_StartExport(char* path, u32 intervalSeconds)
+{
+  if (!Metrics_WritePrometheusFile(path))
+    return false;
+
+  exportPath       = path;
+  exportIntervalNs = (u64)intervalSeconds * 1000000000ULL;
+  nextExportNs     = Metrics_GetTimeNs() + exportIntervalNs;
+  atexit(Metrics_ExportAtExit);
+  return true;
+}
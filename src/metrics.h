@@ -0,0 +1,78 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+#pragma once
+
+
+#include "types.h"
+
+#include <stdio.h>
+
+
+/*
+  Runtime performance counters.
+
+  Nothing here is counted per instruction. Instructions come from the
+  CPU's retired-instruction count (CPU_GetRetiredInstructions()),
+  which a stats reset does not clear, guest cycles from its cycle
+  count, I/O calls and interrupts from counters bumped once per event,
+  and host time from the clock read as CPU_Run() is entered and left.
+  Effective MIPS and MHz are derived from those over the whole run.
+
+  Metrics_StartExport() rewrites a Prometheus text format file every
+  so many seconds while the CPU runs, for a node_exporter textfile
+  collector or similar, and once more at exit. The file is replaced
+  with rename() so it is never seen half written. CPU_Run() checks the
+  clock between batches, so exporting schedules nothing the guest
+  could observe.
+
+  The emulator runs one CPU, so there is one set of counters; the
+  'cpu' label leaves room for more.
+*/
+
+#define METRICS_DEFAULT_INTERVAL  10
+/* Most guest cycles CPU_Run() runs between checks of the export clock */
+#define METRICS_CHECK_CYCLES      (1 << 20)
+
+struct metrics
+{
+  u64    instructions;
+  u64    cycles;
+  u64    hostNs;
+  u64    ioReads;
+  u64    ioWrites;
+  u64    interruptsDelivered;
+  u64    interruptsIgnored;
+  double mips;
+  double mhz;
+};
+
+
+void
+Metrics_EnterRun();
+
+void
+Metrics_LeaveRun();
+
+void
+Metrics_Gather(struct metrics* metrics);
+
+void
+Metrics_Print(FILE* out);
+
+void
+Metrics_WritePrometheus(FILE* out);
+
+bool
+Metrics_WritePrometheusFile(char* path);
+
+bool
+Metrics_StartExport(char* path, u32 intervalSeconds);
+
+bool
+Metrics_IsExporting();
+
+void
+Metrics_PollExport();
+
+
+#endif    /* __METRICS_H__ */
@@ -0,0 +1,397 @@
+#include "cpu.h"
+#include "memory.h"
+#include "profile.h"
+#include "symbols.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/* Longest name a frame is given: a symbol with an offset, or 0x1234 */
+#define PROF_MAX_NAME     (SYM_MAX_NAME + 8)
+/* Node 0 is the root, so it doubles as 'no node' in child links */
+#define PROF_NO_NODE      0
+
+/*
+  One node of the call tree: a function reached by one particular
+  path of calls from the root.
+*/
+struct prof_node
+{
+  u64    cycles;
+  u64    calls;
+  u32    parent;
+  u32    firstChild;
+  u32    nextSibling;
+  word_t entry;
+};
+
+/* A call still on the shadow stack */
+struct prof_frame
+{
+  /* Node to return to once the frame is left */
+  u32    caller;
+  /* Where the call pushed its return address */
+  word_t sp;
+};
+
+internal bool              profEnabled = false;
+
+internal struct prof_node  nodes[PROF_MAX_NODES];
+internal u32               nodeCount;
+internal u32               currentNode;
+internal struct prof_frame stack[PROF_MAX_DEPTH];
+internal u32               depth;
+/* Calls that found the tree or the shadow stack full and were charged
+   to their caller instead */
+internal u64               lostCalls;
+
+internal u64               addressCycles[0x10000];
+internal u64               totalCycles;
+
+/* The instruction started by the last Prof_BeginInstruction(), whose
+   cycles and effect on the stack are not known until the next one */
+internal bool              pending;
+internal word_t            pendingPC;
+internal word_t            pendingSP;
+internal byte_t            pendingOpcode;
+internal u64               pendingCycle;
+
+
+void
+Prof_Reset()
+{
+  nodeCount   = 0;
+  currentNode = 0;
+  depth       = 0;
+  lostCalls   = 0;
+  totalCycles = 0;
+  pending     = false;
+  memset(addressCycles, 0, sizeof(addressCycles));
+}
+
+void
+Prof_SetEnabled(bool enabled)
+{
+  /* Time spent with the profiler off is not charged to anything */
+  pending     = false;
+  profEnabled = enabled;
+  CPU_EnableHook(CPU_HOOK_PROFILE, enabled);
+}
+
+bool
+Prof_IsEnabled()
+{
+  return profEnabled;
+}
+
+/*
+  Charge the cycles from the start of the pending instruction to 'now'
+  to its address and function. Going back in time (reverse debugging)
+  charges nothing.
+*/
+internal void
+Prof_ChargePending(u64 now)
+{
+  u64 cycles;
+
+  if (!pending || now < pendingCycle)
+    return;
+
+  cycles = now - pendingCycle;
+  nodes[currentNode].cycles += cycles;
+  addressCycles[pendingPC]  += cycles;
+  totalCycles               += cycles;
+  pendingCycle = now;
+}
+
+internal void
+Prof_EnterFrame(word_t entry, word_t sp)
+{
+  u32 child;
+
+  if (depth == PROF_MAX_DEPTH)
+  {
+    ++lostCalls;
+    return;
+  }
+
+  for (child = nodes[currentNode].firstChild;
+       child != PROF_NO_NODE && nodes[child].entry != entry;
+       child = nodes[child].nextSibling)
+    ;
+  if (child == PROF_NO_NODE)
+  {
+    if (nodeCount == PROF_MAX_NODES)
+    {
+      ++lostCalls;
+      return;
+    }
+    child = nodeCount++;
+    memset(&nodes[child], 0, sizeof(nodes[child]));
+    nodes[child].entry       = entry;
+    nodes[child].parent      = currentNode;
+    nodes[child].nextSibling = nodes[currentNode].firstChild;
+    nodes[currentNode].firstChild = child;
+  }
+
+  ++nodes[child].calls;
+  stack[depth].caller = currentNode;
+  stack[depth].sp     = sp;
+  ++depth;
+  currentNode = child;
+}
+
+/*
+  Prof_Begin()
+
+  Finish off the pending instruction now that its effect is known,
+  then make the instruction about to run at 'pc' pending. Frames whose
+  return address is now above SP have been left, however that
+  happened; a call that pushed a return address enters a frame at the
+  address it went to.
+*/
+internal void
+Prof_Begin(byte_t opcode)
+{
+  const struct registers* regs = CPU_GetRegisters();
+  u64                     now  = CPU_GetCycleCount();
+
+  if (nodeCount == 0)
+  {
+    memset(&nodes[0], 0, sizeof(nodes[0]));
+    nodes[0].entry = regs->PC;
+    nodeCount      = 1;
+  }
+
+  if (pending)
+  {
+    Prof_ChargePending(now);
+    while (depth && stack[depth - 1].sp < regs->SP)
+      currentNode = stack[--depth].caller;
+    if (CPU_IsCallInstruction(pendingOpcode) &&
+        regs->SP == (word_t)(pendingSP - 2))
+      Prof_EnterFrame(regs->PC, regs->SP);
+  }
+
+  pending       = true;
+  pendingPC     = regs->PC;
+  pendingSP     = regs->SP;
+  pendingOpcode = opcode;
+  pendingCycle  = now;
+}
+
+void
+Prof_BeginInstruction()
+{
+  Prof_Begin(Mem_ReadByte(CPU_GetProgramCounter()));
+}
+
+/*
+  An interrupt is profiled as its RST instruction, run at the address
+  it interrupted.
+*/
+void
+Prof_RecordInterrupt(byte_t rstOpcode)
+{
+  Prof_Begin(rstOpcode);
+}
+
+
+internal u32
+Prof_FormatName(word_t address, char* out, u32 size)
+{
+  u32 length = Sym_Format(address, out, size);
+
+  if (length)
+    return length;
+  return snprintf(out, size, "0x%04x", address);
+}
+
+/* qsort() has no context argument, so the keys being sorted by are
+   kept here */
+internal const u64* sortKeys;
+
+internal int
+Prof_CompareKeys(const void* a, const void* b)
+{
+  u64 left  = sortKeys[*(const u32*)a];
+  u64 right = sortKeys[*(const u32*)b];
+
+  if (left != right)
+    return (left > right) ? -1 : 1;
+  return (*(const u32*)a < *(const u32*)b) ? -1 : 1;
+}
+
+/* Indices of the non-zero keys, largest first */
+internal u32
+Prof_Sort(const u64* keys, u32 keyCount, u32* order)
+{
+  u32 used = 0;
+  u32 i;
+
+  for (i = 0; i < keyCount; ++i)
+  {
+    if (keys[i])
+      order[used++] = i;
+  }
+  sortKeys = keys;
+  qsort(order, used, sizeof(u32), Prof_CompareKeys);
+  return used;
+}
+
+internal double
+Prof_Percent(u64 part, u64 whole)
+{
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+/* True if a node further up the path to 'node' is the same function,
+   so its cycles are already in that function's total */
+internal bool
+Prof_IsRecursive(u32 node)
+{
+  u32 ancestor = node;
+
+  while (ancestor != 0)
+  {
+    ancestor = nodes[ancestor].parent;
+    if (nodes[ancestor].entry == nodes[node].entry)
+      return true;
+  }
+  return false;
+}
+
+/*
+  Prof_PrintTop()
+
+  Print the 'count' functions with the most cycles of their own, with
+  the cycles of everything they called included in 'total', then the
+  'count' busiest addresses.
+*/
+void
+Prof_PrintTop(FILE* out, u32 count)
+{
+  u64* inclusive;
+  u64* selfCycles;
+  u64* totals;
+  u64* calls;
+  u32* order;
+  char name[PROF_MAX_NAME];
+  u32  used;
+  u32  i;
+
+  Prof_ChargePending(CPU_GetCycleCount());
+  fprintf(out, "Profiled cycles: %llu  Call paths: %u\n",
+          (unsigned long long)totalCycles, nodeCount);
+  if (lostCalls)
+    fprintf(out, "%llu calls beyond the call tree's limits were charged to their callers\n",
+            (unsigned long long)lostCalls);
+  if (!totalCycles)
+    return;
+
+  inclusive  = (u64*)malloc(nodeCount * sizeof(u64));
+  selfCycles = (u64*)calloc(0x10000, sizeof(u64));
+  totals     = (u64*)calloc(0x10000, sizeof(u64));
+  calls      = (u64*)calloc(0x10000, sizeof(u64));
+  order      = (u32*)malloc(0x10000 * sizeof(u32));
+
+  /* Children always come after their parents */
+  for (i = 0; i < nodeCount; ++i)
+    inclusive[i] = nodes[i].cycles;
+  for (i = nodeCount - 1; i > 0; --i)
+    inclusive[nodes[i].parent] += inclusive[i];
+
+  for (i = 0; i < nodeCount; ++i)
+  {
+    word_t entry = nodes[i].entry;
+
+    selfCycles[entry] += nodes[i].cycles;
+    calls[entry]      += nodes[i].calls;
+    if (!Prof_IsRecursive(i))
+      totals[entry] += inclusive[i];
+  }
+
+  fprintf(out, "\nFunctions:\n");
+  fprintf(out, "          self       %%           total       %%       calls  function\n");
+  used = Prof_Sort(selfCycles, 0x10000, order);
+  for (i = 0; i < used && i < count; ++i)
+  {
+    u32 entry = order[i];
+
+    Prof_FormatName(entry, name, sizeof(name));
+    fprintf(out, "  %12llu  %6.2f  %14llu  %6.2f  %10llu  %s\n",
+            (unsigned long long)selfCycles[entry], Prof_Percent(selfCycles[entry], totalCycles),
+            (unsigned long long)totals[entry], Prof_Percent(totals[entry], totalCycles),
+            (unsigned long long)calls[entry], name);
+  }
+
+  fprintf(out, "\nAddresses:\n");
+  fprintf(out, "  addr        cycles       %%  location\n");
+  used = Prof_Sort(addressCycles, 0x10000, order);
+  for (i = 0; i < used && i < count; ++i)
+  {
+    u32 address = order[i];
+
+    name[0] = '\0';
+    Sym_Format(address, name, sizeof(name));
+    fprintf(out, "  %04x  %12llu  %6.2f  %s\n", address,
+            (unsigned long long)addressCycles[address],
+            Prof_Percent(addressCycles[address], totalCycles), name);
+  }
+
+  free(order);
+  free(calls);
+  free(totals);
+  free(selfCycles);
+  free(inclusive);
+}
+
+/* Room for the names of a full shadow stack and the root */
+internal char stackText[(PROF_MAX_DEPTH + 1) * (PROF_MAX_NAME + 1)];
+
+internal void
+Prof_WriteNode(FILE* out, u32 node, u32 length)
+{
+  u32 child;
+
+  if (length)
+    stackText[length++] = ';';
+  length += Prof_FormatName(nodes[node].entry, stackText + length, PROF_MAX_NAME);
+
+  if (nodes[node].cycles)
+    fprintf(out, "%.*s %llu\n", (int)length, stackText,
+            (unsigned long long)nodes[node].cycles);
+  for (child = nodes[node].firstChild;
+       child != PROF_NO_NODE;
+       child = nodes[child].nextSibling)
+    Prof_WriteNode(out, child, length);
+}
+
+/*
+  Write one 'caller;callee;... cycles' line for each call path that
+  used any cycles itself, as read by flamegraph.pl and speedscope.
+*/
+void
+Prof_WriteCollapsed(FILE* out)
+{
+  Prof_ChargePending(CPU_GetCycleCount());
+  if (nodeCount)
+    Prof_WriteNode(out, 0, 0);
+}
+
+bool
+Prof_WriteCollapsedFile(char* path)
+{
+  FILE* fp;
+
+  fp = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+  if (!fp)
+    return false;
+  Prof_WriteCollapsed(fp);
+  if (fp != stdout)
+    return fclose(fp) == 0;
+  fflush(fp);
+  return true;
+}
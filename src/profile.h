@@ -0,0 +1,60 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+#pragma once
+
+
+#include "types.h"
+
+#include <stdio.h>
+
+
+/*
+  Guest profiler.
+
+  Before each instruction (through CPU_HOOK_PROFILE) the cycles spent
+  since the previous one are charged to the previous instruction's
+  address and to the function it was running in. Functions are found
+  by following calls: a CALL, conditional call, RST or interrupt that
+  pushed a return address enters a new frame at its target, and a
+  frame is left as soon as SP rises above the return address it
+  pushed. Working from SP rather than matching RETs keeps the shadow
+  stack right when a program pops its return address, switches stacks
+  with SPHL or returns through a pushed address.
+
+  Frames form a call tree, so every distinct call path has its own
+  node and the tree can be written out as collapsed stacks ('a;b;c
+  cycles' lines) for flame graph tools. Functions are named by their
+  entry address, with symbols when any are loaded.
+*/
+
+#define PROF_MAX_DEPTH      256
+#define PROF_MAX_NODES      (1 << 16)
+#define PROF_DEFAULT_TOP    20
+
+
+void
+Prof_SetEnabled(bool enabled);
+
+bool
+Prof_IsEnabled();
+
+void
+Prof_Reset();
+
+void
+Prof_BeginInstruction();
+
+void
+Prof_RecordInterrupt(byte_t rstOpcode);
+
+void
+Prof_PrintTop(FILE* out, u32 count);
+
+void
+Prof_WriteCollapsed(FILE* out);
+
+bool
+Prof_WriteCollapsedFile(char* path);
+
+
+#endif    /* __PROFILE_H__ */
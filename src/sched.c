@@ -0,0 +1,232 @@
+#include "cpu.h"
+#include "log.h"
+#include "sched.h"
+
+#include <string.h>
+
+
+
+/*
+  Events live in a fixed pool and are ordered by a binary min-heap of
+  pool indices. Events with the same deadline run in the order they
+  were added (by sequence number) so device timing stays
+  deterministic.
+
+  Cancelled events are left in the heap with a null callback and are
+  discarded when they reach the top.
+*/
+internal struct sched_event eventPool[SCHED_MAX_EVENTS];
+internal u8                 eventHeap[SCHED_MAX_EVENTS];
+internal u32                heapSize;
+internal u64                nextSequence;
+internal u32                nextGeneration;
+
+
+internal bool
+Sched_IsEarlier(u8 a, u8 b)
+{
+  struct sched_event* eventA = &eventPool[a];
+  struct sched_event* eventB = &eventPool[b];
+
+  if (eventA->cycle != eventB->cycle)
+    return eventA->cycle < eventB->cycle;
+  return eventA->sequence < eventB->sequence;
+}
+
+internal void
+Sched_SiftUp(u32 index)
+{
+  while (index > 0)
+  {
+    u32 parent = (index - 1) / 2;
+    if (!Sched_IsEarlier(eventHeap[index], eventHeap[parent]))
+      break;
+    SwapBytes(&eventHeap[index], &eventHeap[parent]);
+    index = parent;
+  }
+}
+
+internal void
+Sched_SiftDown(u32 index)
+{
+  for (;;)
+  {
+    u32 left     = index*2 + 1;
+    u32 right    = left + 1;
+    u32 earliest = index;
+
+    if (left < heapSize &&
+        Sched_IsEarlier(eventHeap[left], eventHeap[earliest]))
+      earliest = left;
+    if (right < heapSize &&
+        Sched_IsEarlier(eventHeap[right], eventHeap[earliest]))
+      earliest = right;
+    if (earliest == index)
+      break;
+    SwapBytes(&eventHeap[index], &eventHeap[earliest]);
+    index = earliest;
+  }
+}
+
+/*
+  Remove the event at the top of the heap and return its slot to the
+  pool.
+*/
+internal void
+Sched_PopTop()
+{
+  eventPool[eventHeap[0]].inUse = false;
+  eventHeap[0] = eventHeap[--heapSize];
+  if (heapSize)
+    Sched_SiftDown(0);
+}
+
+/*
+  Discard cancelled events sitting at the top of the heap so the top
+  is always a live event.
+*/
+internal void
+Sched_DropCancelled()
+{
+  while (heapSize && !eventPool[eventHeap[0]].callback)
+    Sched_PopTop();
+}
+
+void
+Sched_Init()
+{
+  u32 i;
+
+  for (i = 0; i < SCHED_MAX_EVENTS; ++i)
+    eventPool[i].inUse = false;
+  heapSize       = 0;
+  nextSequence   = 0;
+  nextGeneration = 1;
+}
+
+/*
+  Sched_AddEvent()
+
+  Schedule a callback to run when the cycle count reaches 'cycle'.
+  Returns an ID which can be passed to Sched_CancelEvent(), or
+  SCHED_INVALID_ID if the event pool is full.
+*/
+u32
+Sched_AddEvent(u64 cycle, sched_callback_t callback, void* userData)
+{
+  struct sched_event* event;
+  u32 slot;
+
+  for (slot = 0; slot < SCHED_MAX_EVENTS; ++slot)
+  {
+    if (!eventPool[slot].inUse)
+      break;
+  }
+  if (slot == SCHED_MAX_EVENTS)
+  {
+#ifdef _DEBUG
+    Log_Debug("Sched_AddEvent: event pool full");
+#endif
+    return SCHED_INVALID_ID;
+  }
+
+  event = &eventPool[slot];
+  event->cycle     = cycle;
+  event->sequence  = nextSequence++;
+  event->callback  = callback;
+  event->userData  = userData;
+  event->eventID   = (nextGeneration++ << 8) | slot;
+  event->inUse     = true;
+  if (event->eventID == SCHED_INVALID_ID)
+    event->eventID = (nextGeneration++ << 8) | slot;
+
+  eventHeap[heapSize] = slot;
+  Sched_SiftUp(heapSize++);
+
+  /* An event added while the CPU is mid-batch may be due before the
+     batch would otherwise end */
+  CPU_ClampDeadline(cycle);
+
+  return event->eventID;
+}
+
+bool
+Sched_CancelEvent(u32 eventID)
+{
+  struct sched_event* event;
+
+  if ((eventID & 0xff) >= SCHED_MAX_EVENTS)
+    return false;
+
+  event = &eventPool[eventID & 0xff];
+  if (!event->inUse ||
+      event->eventID != eventID)
+    return false;
+
+  event->callback = 0;
+  Sched_DropCancelled();
+  return true;
+}
+
+/*
+  Sched_SaveState()
+
+  Copy the whole queue, including the sequence and ID counters, so
+  that restoring it later schedules and numbers events exactly as
+  they were.
+*/
+void
+Sched_SaveState(struct sched_state* state)
+{
+  memcpy(state->pool, eventPool, sizeof(eventPool));
+  memcpy(state->heap, eventHeap, sizeof(eventHeap));
+  state->heapSize       = heapSize;
+  state->nextSequence   = nextSequence;
+  state->nextGeneration = nextGeneration;
+}
+
+void
+Sched_RestoreState(const struct sched_state* state)
+{
+  memcpy(eventPool, state->pool, sizeof(eventPool));
+  memcpy(eventHeap, state->heap, sizeof(eventHeap));
+  heapSize       = state->heapSize;
+  nextSequence   = state->nextSequence;
+  nextGeneration = state->nextGeneration;
+}
+
+/*
+  Return the cycle count of the earliest pending event, or
+  SCHED_NO_EVENT if none are scheduled.
+*/
+u64
+Sched_GetNextDeadline()
+{
+  if (!heapSize)
+    return SCHED_NO_EVENT;
+  return eventPool[eventHeap[0]].cycle;
+}
+
+/*
+  Sched_RunDue()
+
+  Run every event whose deadline is at or before 'now', in deadline
+  order. Callbacks may schedule further events; any that are already
+  due run in the same batch.
+*/
+void
+Sched_RunDue(u64 now)
+{
+  while (heapSize && eventPool[eventHeap[0]].cycle <= now)
+  {
+    struct sched_event* event = &eventPool[eventHeap[0]];
+    sched_callback_t callback = event->callback;
+    void*            userData = event->userData;
+    u64              cycle    = event->cycle;
+
+    Sched_PopTop();
+    if (callback)
+      callback(userData, cycle);
+    Sched_DropCancelled();
+  }
+}
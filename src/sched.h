@@ -0,0 +1,67 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  Cycle-based event scheduler.
+
+  Devices register callbacks to be run once the CPU's cycle count
+  reaches a given deadline. The CPU run loop only compares against the
+  earliest deadline and runs all due events in a batch, so no device
+  needs to be polled per-instruction.
+*/
+
+#define SCHED_MAX_EVENTS   64
+#define SCHED_NO_EVENT     0xffffffffffffffffULL
+#define SCHED_INVALID_ID   0
+
+typedef void (*sched_callback_t)(void* userData, u64 cycle);
+
+struct sched_event
+{
+  u64              cycle;
+  u64              sequence;
+  sched_callback_t callback;
+  void*            userData;
+  u32              eventID;
+  bool             inUse;
+};
+
+/* A copy of the queue, as taken by Sched_SaveState() */
+struct sched_state
+{
+  struct sched_event pool[SCHED_MAX_EVENTS];
+  u8                 heap[SCHED_MAX_EVENTS];
+  u32                heapSize;
+  u64                nextSequence;
+  u32                nextGeneration;
+};
+
+
+void
+Sched_Init();
+
+u32
+Sched_AddEvent(u64 cycle, sched_callback_t callback, void* userData);
+
+bool
+Sched_CancelEvent(u32 eventID);
+
+void
+Sched_SaveState(struct sched_state* state);
+
+void
+Sched_RestoreState(const struct sched_state* state);
+
+u64
+Sched_GetNextDeadline();
+
+void
+Sched_RunDue(u64 now);
+
+
+#endif    /* __SCHED_H__ */
@@ -0,0 +1,233 @@
+#include "cpu.h"
+#include "disas.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define STATS_NUM_TYPES    (INSTR_XTHL + 1)
+#define STATS_MAX_NAME     16
+
+extern struct instruction instruction_set[256];
+
+/* Per-opcode and per-type figures, gathered for one report */
+struct stats_row
+{
+  u64 executed;
+  u64 cycles;
+  u64 taken;
+};
+
+internal struct stats_row opcodeRows[256];
+internal struct stats_row typeRows[STATS_NUM_TYPES];
+internal u64              totalExecuted;
+internal u64              totalCycles;
+
+
+internal void
+Stats_Gather()
+{
+  const struct cpu_opcode_counts* counts = CPU_GetOpcodeCounts();
+  u32                             i;
+
+  memset(typeRows, 0, sizeof(typeRows));
+  totalExecuted = 0;
+  totalCycles   = 0;
+  for (i = 0; i < 256; ++i)
+  {
+    const struct instruction* instruction = &instruction_set[i];
+    struct stats_row*         row         = &opcodeRows[i];
+    struct stats_row*         typeRow     = &typeRows[instruction->executeParams.instructionType];
+
+    row->executed = counts[i].executed;
+    row->taken    = counts[i].taken;
+    row->cycles   = (row->executed - row->taken) * instruction->cycleCount[CYCLE_COUNT_SHORT] +
+                    row->taken * instruction->cycleCount[CYCLE_COUNT_LONG];
+
+    typeRow->executed += row->executed;
+    typeRow->cycles   += row->cycles;
+    typeRow->taken    += row->taken;
+    totalExecuted     += row->executed;
+    totalCycles       += row->cycles;
+  }
+}
+
+internal bool
+Stats_IsConditional(u8 instructionType)
+{
+  switch (instructionType)
+  {
+  case INSTR_JC:  case INSTR_JM:  case INSTR_JNC: case INSTR_JNZ:
+  case INSTR_JP:  case INSTR_JPE: case INSTR_JPO: case INSTR_JZ:
+  case INSTR_CC:  case INSTR_CM:  case INSTR_CNC: case INSTR_CNZ:
+  case INSTR_CP:  case INSTR_CPE: case INSTR_CPO: case INSTR_CZ:
+  case INSTR_RC:  case INSTR_RM:  case INSTR_RNC: case INSTR_RNZ:
+  case INSTR_RP:  case INSTR_RPE: case INSTR_RPO: case INSTR_RZ:
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+/* qsort() has no context argument, so the rows being sorted are kept
+   here */
+internal const struct stats_row* sortRows;
+
+internal int
+Stats_CompareRows(const void* a, const void* b)
+{
+  u64 left  = sortRows[*(const u16*)a].executed;
+  u64 right = sortRows[*(const u16*)b].executed;
+
+  if (left != right)
+    return (left > right) ? -1 : 1;
+  return *(const u16*)a - *(const u16*)b;
+}
+
+/* Indices of the rows that ran at all, busiest first */
+internal u32
+Stats_Sort(const struct stats_row* rows, u32 rowCount, u16* order)
+{
+  u32 used = 0;
+  u32 i;
+
+  for (i = 0; i < rowCount; ++i)
+  {
+    if (rows[i].executed)
+      order[used++] = i;
+  }
+  sortRows = rows;
+  qsort(order, used, sizeof(u16), Stats_CompareRows);
+  return used;
+}
+
+internal double
+Stats_Percent(u64 part, u64 whole)
+{
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+void
+Stats_Print(FILE* out)
+{
+  u16  order[256];
+  char name[STATS_MAX_NAME];
+  u32  used;
+  u32  i;
+
+  Stats_Gather();
+  fprintf(out, "Instructions: %llu  Cycles: %llu\n",
+          (unsigned long long)totalExecuted, (unsigned long long)totalCycles);
+  if (!totalExecuted)
+    return;
+
+  fprintf(out, "\nBy opcode:\n");
+  fprintf(out, "  op  instruction          count       %%          cycles       %%\n");
+  used = Stats_Sort(opcodeRows, 256, order);
+  for (i = 0; i < used; ++i)
+  {
+    const struct stats_row* row = &opcodeRows[order[i]];
+
+    Disas_GetOpcodeName(order[i], name);
+    fprintf(out, "  %02x  %-12s %12llu  %6.2f  %14llu  %6.2f\n", order[i], name,
+            (unsigned long long)row->executed, Stats_Percent(row->executed, totalExecuted),
+            (unsigned long long)row->cycles, Stats_Percent(row->cycles, totalCycles));
+  }
+
+  fprintf(out, "\nBy instruction:\n");
+  fprintf(out, "  instruction          count       %%          cycles       %%\n");
+  used = Stats_Sort(typeRows, STATS_NUM_TYPES, order);
+  for (i = 0; i < used; ++i)
+  {
+    const struct stats_row* row = &typeRows[order[i]];
+
+    fprintf(out, "  %-12s %12llu  %6.2f  %14llu  %6.2f\n", Disas_GetMnemonic(order[i]),
+            (unsigned long long)row->executed, Stats_Percent(row->executed, totalExecuted),
+            (unsigned long long)row->cycles, Stats_Percent(row->cycles, totalCycles));
+  }
+
+  fprintf(out, "\nConditional branches:\n");
+  fprintf(out, "  instruction          taken       not taken  %% taken\n");
+  for (i = 0; i < used; ++i)
+  {
+    const struct stats_row* row = &typeRows[order[i]];
+
+    if (!Stats_IsConditional(order[i]))
+      continue;
+    fprintf(out, "  %-12s %12llu  %14llu  %6.2f\n", Disas_GetMnemonic(order[i]),
+            (unsigned long long)row->taken, (unsigned long long)(row->executed - row->taken),
+            Stats_Percent(row->taken, row->executed));
+  }
+}
+
+void
+Stats_WriteJson(FILE* out)
+{
+  char name[STATS_MAX_NAME];
+  bool first;
+  u32  i;
+
+  Stats_Gather();
+  fprintf(out, "{\"instructions\":%llu,\"cycles\":%llu,\"opcodes\":[",
+          (unsigned long long)totalExecuted, (unsigned long long)totalCycles);
+  first = true;
+  for (i = 0; i < 256; ++i)
+  {
+    const struct stats_row* row = &opcodeRows[i];
+
+    if (!row->executed)
+      continue;
+    Disas_GetOpcodeName(i, name);
+    fprintf(out, "%s{\"opcode\":%u,\"name\":\"%s\",\"count\":%llu,\"cycles\":%llu",
+            first ? "" : ",", i, name,
+            (unsigned long long)row->executed, (unsigned long long)row->cycles);
+    if (Stats_IsConditional(instruction_set[i].executeParams.instructionType))
+      fprintf(out, ",\"taken\":%llu,\"not_taken\":%llu", (unsigned long long)row->taken,
+              (unsigned long long)(row->executed - row->taken));
+    fprintf(out, "}");
+    first = false;
+  }
+
+  fprintf(out, "],\"instructions_by_type\":{");
+  first = true;
+  for (i = 0; i < STATS_NUM_TYPES; ++i)
+  {
+    const struct stats_row* row = &typeRows[i];
+
+    if (!row->executed)
+      continue;
+    fprintf(out, "%s\"%s\":{\"count\":%llu,\"cycles\":%llu", first ? "" : ",",
+            Disas_GetMnemonic(i),
+            (unsigned long long)row->executed, (unsigned long long)row->cycles);
+    if (Stats_IsConditional(i))
+      fprintf(out, ",\"taken\":%llu,\"not_taken\":%llu", (unsigned long long)row->taken,
+              (unsigned long long)(row->executed - row->taken));
+    fprintf(out, "}");
+    first = false;
+  }
+  fprintf(out, "}}\n");
+}
+
+bool
+Stats_WriteJsonFile(char* path)
+{
+  FILE* fp;
+
+  fp = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w");
+  if (!fp)
+    return false;
+  Stats_WriteJson(fp);
+  if (fp != stdout)
+    return fclose(fp) == 0;
+  fflush(fp);
+  return true;
+}
+
+void
+Stats_Reset()
+{
+  CPU_ResetOpcodeCounts();
+}
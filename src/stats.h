@@ -0,0 +1,35 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+#pragma once
+
+
+#include "types.h"
+
+#include <stdio.h>
+
+
+/*
+  Instruction mix statistics.
+
+  The CPU counts executions of each opcode, and how often each
+  conditional jump, call and return took its action, on every
+  instruction (see CPU_GetOpcodeCounts()). Everything else is derived
+  here when a report is asked for: cycles from the opcodes' cycle
+  counts, and totals per instruction type by summing opcodes.
+*/
+
+
+void
+Stats_Print(FILE* out);
+
+void
+Stats_WriteJson(FILE* out);
+
+bool
+Stats_WriteJsonFile(char* path);
+
+void
+Stats_Reset();
+
+
+#endif    /* __STATS_H__ */
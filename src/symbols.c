@@ -0,0 +1,403 @@
+#include "symbols.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+
+#define SYM_MAX_TOKENS   16
+
+struct symbol
+{
+  word_t address;
+  char   name[SYM_MAX_NAME];
+};
+
+/* Sorted by address once loading is done */
+internal struct symbol* symbols;
+internal u32            symbolCount;
+internal u32            symbolCapacity;
+
+/* Name hash table of symbol indices plus one; 0 is an empty slot. The
+   size is a power of two at least twice the symbol count. */
+internal u32*           nameTable;
+internal u32            nameTableSize;
+
+
+internal u32
+Sym_HashName(const char* name)
+{
+  u32 hash = 2166136261u;
+
+  while (*name)
+  {
+    hash ^= (byte_t)*name++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+internal int
+Sym_Compare(const void* a, const void* b)
+{
+  const struct symbol* left  = (const struct symbol*)a;
+  const struct symbol* right = (const struct symbol*)b;
+
+  if (left->address != right->address)
+    return (left->address < right->address) ? -1 : 1;
+  return strcmp(left->name, right->name);
+}
+
+/*
+  Sym_Rebuild()
+
+  Sort the symbols and rebuild the name table after loading.
+*/
+internal void
+Sym_Rebuild()
+{
+  u32 i;
+
+  qsort(symbols, symbolCount, sizeof(struct symbol), Sym_Compare);
+
+  nameTableSize = 16;
+  while (nameTableSize < symbolCount * 2)
+    nameTableSize *= 2;
+  free(nameTable);
+  nameTable = (u32*)calloc(nameTableSize, sizeof(u32));
+
+  for (i = 0; i < symbolCount; ++i)
+  {
+    u32 slot = Sym_HashName(symbols[i].name) & (nameTableSize - 1);
+
+    /* The first of several symbols with the same name wins */
+    while (nameTable[slot] &&
+           strcmp(symbols[nameTable[slot] - 1].name, symbols[i].name) != 0)
+      slot = (slot + 1) & (nameTableSize - 1);
+    if (!nameTable[slot])
+      nameTable[slot] = i + 1;
+  }
+}
+
+internal void
+Sym_Add(const char* name, word_t address)
+{
+  struct symbol* symbol;
+
+  if (symbolCount == symbolCapacity)
+  {
+    symbolCapacity = symbolCapacity ? symbolCapacity * 2 : 256;
+    symbols = (struct symbol*)realloc(symbols, symbolCapacity * sizeof(struct symbol));
+  }
+  symbol = &symbols[symbolCount++];
+  symbol->address = address;
+  strncpy(symbol->name, name, SYM_MAX_NAME - 1);
+  symbol->name[SYM_MAX_NAME - 1] = '\0';
+}
+
+internal bool
+Sym_IsName(const char* token)
+{
+  if (!isalpha((byte_t)*token) && !strchr("_.?@", *token))
+    return false;
+  for (++token; *token; ++token)
+  {
+    if (!isalnum((byte_t)*token) && !strchr("_.?@$", *token))
+      return false;
+  }
+  return true;
+}
+
+/*
+  Sym_ParseNumber()
+
+  Parse 0x1234, $1234 or 1234h as hex. A bare number is hex unless
+  'bareIsDecimal' is set, as it is for EQU values.
+*/
+internal bool
+Sym_ParseNumber(const char* token, bool bareIsDecimal, word_t* value)
+{
+  char   digits[16];
+  u32    length;
+  int    base;
+  char*  end;
+  u32    number;
+
+  length = strlen(token);
+  base   = bareIsDecimal ? 10 : 16;
+  if (length >= 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+  {
+    token  += 2;
+    length -= 2;
+    base    = 16;
+  }
+  else if (token[0] == '$')
+  {
+    ++token;
+    --length;
+    base = 16;
+  }
+  else if (length >= 2 && (token[length - 1] == 'h' || token[length - 1] == 'H'))
+  {
+    --length;
+    base = 16;
+  }
+
+  if (length == 0 || length >= sizeof(digits))
+    return false;
+  memcpy(digits, token, length);
+  digits[length] = '\0';
+
+  number = strtoul(digits, &end, base);
+  if (*end || number > 0xffff)
+    return false;
+  *value = number;
+  return true;
+}
+
+internal u32
+Sym_Tokenize(char* line, char** tokens)
+{
+  u32   count;
+  char* token;
+
+  line[strcspn(line, ";\r\n")] = '\0';
+  count = 0;
+  for (token = strtok(line, " \t"); token && count < SYM_MAX_TOKENS; token = strtok(0, " \t"))
+    tokens[count++] = token;
+  return count;
+}
+
+/*
+  Sym_ParseEquate()
+
+  Handle 'name EQU value' and 'name = value' anywhere on a line.
+*/
+internal bool
+Sym_ParseEquate(char** tokens, u32 count)
+{
+  word_t value;
+  u32    i;
+
+  for (i = 1; i + 1 < count; ++i)
+  {
+    if (strcasecmp(tokens[i], "equ") != 0 &&
+        strcmp(tokens[i], "=") != 0)
+      continue;
+
+    tokens[i - 1][strcspn(tokens[i - 1], ":")] = '\0';
+    if (Sym_IsName(tokens[i - 1]) &&
+        Sym_ParseNumber(tokens[i + 1], true, &value))
+    {
+      Sym_Add(tokens[i - 1], value);
+      return true;
+    }
+  }
+  return false;
+}
+
+/* An address column: exactly four hex digits */
+internal bool
+Sym_ParseListingAddress(char* token, word_t* address)
+{
+  return strlen(token) == 4 && Sym_ParseNumber(token, false, address);
+}
+
+internal void
+Sym_ParseListingLine(char* line)
+{
+  char*  tokens[SYM_MAX_TOKENS];
+  u32    count;
+  u32    i;
+  word_t address;
+  word_t next;
+  bool   haveAddress;
+
+  count = Sym_Tokenize(line, tokens);
+  if (Sym_ParseEquate(tokens, count))
+    return;
+
+  /* The address is the first four digit hex field, unless that field
+     is a decimal line number directly followed by another one, as in
+     '1000 0100 C3 00 02 START: JMP GO' */
+  haveAddress = false;
+  for (i = 0; i < count; ++i)
+  {
+    u32 length = strlen(tokens[i]);
+
+    if (!haveAddress)
+    {
+      haveAddress = Sym_ParseListingAddress(tokens[i], &address);
+      if (haveAddress && i + 1 < count &&
+          strspn(tokens[i], "0123456789") == length &&
+          Sym_ParseListingAddress(tokens[i + 1], &next))
+      {
+        address = next;
+        ++i;
+      }
+      continue;
+    }
+    if (length > 1 && tokens[i][length - 1] == ':')
+    {
+      tokens[i][length - 1] = '\0';
+      if (Sym_IsName(tokens[i]))
+        Sym_Add(tokens[i], address);
+      return;
+    }
+  }
+}
+
+internal void
+Sym_ParsePairsLine(char* line)
+{
+  char*  tokens[SYM_MAX_TOKENS];
+  u32    count;
+  u32    i;
+  word_t address;
+
+  count = Sym_Tokenize(line, tokens);
+  if (Sym_ParseEquate(tokens, count))
+    return;
+
+  for (i = 0; i + 1 < count; i += 2)
+  {
+    tokens[i + 1][strcspn(tokens[i + 1], ":")] = '\0';
+    if (!Sym_ParseNumber(tokens[i], false, &address) ||
+        !Sym_IsName(tokens[i + 1]))
+      return;
+    Sym_Add(tokens[i + 1], address);
+  }
+}
+
+
+void
+Sym_Init()
+{
+  symbolCount = 0;
+  free(nameTable);
+  nameTable     = 0;
+  nameTableSize = 0;
+}
+
+/*
+  Sym_Load()
+
+  Add the symbols in 'path' to the table. The format is chosen by the
+  file's extension.
+*/
+bool
+Sym_Load(char* path)
+{
+  FILE*       fp;
+  char        line[512];
+  const char* extension;
+  bool        listing;
+
+  fp = fopen(path, "r");
+  if (!fp)
+    return false;
+
+  extension = strrchr(path, '.');
+  listing   = extension && strcasecmp(extension, ".lst") == 0;
+  while (fgets(line, sizeof(line), fp))
+  {
+    if (listing)
+      Sym_ParseListingLine(line);
+    else
+      Sym_ParsePairsLine(line);
+  }
+  fclose(fp);
+
+  Sym_Rebuild();
+  return true;
+}
+
+u32
+Sym_GetCount()
+{
+  return symbolCount;
+}
+
+/*
+  Sym_Lookup()
+
+  Return the name of the closest symbol at or below 'address', and how
+  far past it 'address' is, or null if there is none.
+*/
+const char*
+Sym_Lookup(word_t address, word_t* offset)
+{
+  u32 low;
+  u32 high;
+
+  if (!symbolCount || symbols[0].address > address)
+    return 0;
+
+  /* Find the last symbol whose address is <= 'address' */
+  low  = 0;
+  high = symbolCount;
+  while (high - low > 1)
+  {
+    u32 middle = (low + high) / 2;
+    if (symbols[middle].address <= address)
+      low = middle;
+    else
+      high = middle;
+  }
+  /* Of several symbols at the same address, use the first */
+  while (low && symbols[low - 1].address == symbols[low].address)
+    --low;
+
+  if (offset)
+    *offset = address - symbols[low].address;
+  return symbols[low].name;
+}
+
+bool
+Sym_FindAddress(const char* name, word_t* address)
+{
+  u32 slot;
+
+  if (!nameTableSize)
+    return false;
+
+  slot = Sym_HashName(name) & (nameTableSize - 1);
+  while (nameTable[slot])
+  {
+    struct symbol* symbol = &symbols[nameTable[slot] - 1];
+    if (strcmp(symbol->name, name) == 0)
+    {
+      *address = symbol->address;
+      return true;
+    }
+    slot = (slot + 1) & (nameTableSize - 1);
+  }
+  return false;
+}
+
+/*
+  Sym_Format()
+
+  Write 'address' as name or name+offset. Returns the length written,
+  or 0 if there is no symbol for it.
+*/
+u32
+Sym_Format(word_t address, char* out, u32 size)
+{
+  const char* name;
+  word_t      offset;
+  int         length;
+
+  name = Sym_Lookup(address, &offset);
+  if (!name || !size)
+    return 0;
+
+  if (offset)
+    length = snprintf(out, size, "%s+0x%x", name, offset);
+  else
+    length = snprintf(out, size, "%s", name);
+  return ((u32)length < size) ? (u32)length : size - 1;
+}
@@ -0,0 +1,51 @@
+#ifndef __SYMBOLS_H__
+#define __SYMBOLS_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  Symbol table.
+
+  Symbols are kept in an array sorted by address, so the symbol at or
+  below an address is found with a binary search, and in an
+  open-addressed hash table of names for looking addresses up by name.
+
+  Sym_Load() reads three kinds of file:
+
+    .lst   assembler listings; a line starting with an address,
+           optionally after a line number, and containing a 'label:'
+           defines label at that address
+    .sym   and anything else: whitespace separated 'address name'
+           pairs, any number per line, as written by CP/M assemblers
+
+  In every format 'name EQU value' and 'name = value' lines are also
+  understood. Addresses are hex, optionally written 0x1234, $1234 or
+  1234h. Text after a ';' is a comment.
+*/
+
+#define SYM_MAX_NAME    32
+
+
+void
+Sym_Init();
+
+bool
+Sym_Load(char* path);
+
+u32
+Sym_GetCount();
+
+const char*
+Sym_Lookup(word_t address, word_t* offset);
+
+bool
+Sym_FindAddress(const char* name, word_t* address);
+
+u32
+Sym_Format(word_t address, char* out, u32 size);
+
+
+#endif    /* __SYMBOLS_H__ */
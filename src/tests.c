@@ -89,12 +89,67 @@ Test_CheckByteParity()
   return true;
 }
 
+/*
+  Run 'program' from address 0 with the stack at 0x1000 until it
+  halts, leaving the final state in 'state'.
+*/
+void
+Test_RunProgram(const byte_t* program, u32 size, struct cpu_state* state)
+{
+  byte_t* memory = Mem_Init(0x10000);
+
+  memcpy(memory, program, size);
+  CPU_Init(memory);
+  memset(state, 0, sizeof(*state));
+  state->regs.F  = 0x02;
+  state->regs.SP = 0x1000;
+  CPU_RestoreState(state);
+  CPU_Run(CPU_NO_CYCLELIMIT);
+  CPU_SaveState(state);
+}
+
+/*
+  A return address must be stored high byte first, at SP+1, like any
+  other word, so that it can be popped into a register pair and a
+  pushed pair can be returned to.
+*/
+bool
+Test_CallReturnStack()
+{
+  /* CALL 0x0003; POP H; HLT */
+  const byte_t callPop[] = { 0xcd, 0x03, 0x00, 0xe1, 0x76 };
+  /* LXI H,0x0007; PUSH H; RET; HLT; MVI A,0x42; HLT */
+  const byte_t pushRet[] = { 0x21, 0x07, 0x00, 0xe5, 0xc9, 0x76, 0x76, 0x3e, 0x42, 0x76 };
+  struct cpu_state state;
+
+  fprintf(stderr, "Testing CALL/POP and PUSH/RET...\n");
+  Test_RunProgram(callPop, sizeof(callPop), &state);
+  if (state.regs.H != 0x00 || state.regs.L != 0x03)
+  {
+    fprintf(stderr, "TEST FAILED: CALL pushed 0x%02x%02x, not 0x0003\n",
+            state.regs.H, state.regs.L);
+    return false;
+  }
+
+  Test_RunProgram(pushRet, sizeof(pushRet), &state);
+  if (state.regs.PC != 0x000a || state.regs.A != 0x42)
+  {
+    fprintf(stderr, "TEST FAILED: RET to a pushed 0x0007 halted at 0x%04x\n",
+            state.regs.PC);
+    return false;
+  }
+
+  fprintf(stderr, "CALL/POP and PUSH/RET: All tests passed!\n\n");
+  return true;
+}
+
 void
 RunTests()
 {
   fprintf(stderr, "\nRunning tests...\n\n");
   if (!Test_ALU_Adder()) return;
   if (!Test_CheckByteParity()) return;
+  if (!Test_CallReturnStack()) return;
 }
 
 
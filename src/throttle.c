@@ -0,0 +1,123 @@
+#include "cpu.h"
+#include "log.h"
+#include "throttle.h"
+
+#include <time.h>
+
+
+
+internal bool   throttleEnabled;
+internal u32    clockRate;
+internal double turbo;
+
+
+internal u64
+Throttle_GetTimeNs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+internal void
+Throttle_SleepUntil(u64 deadlineNs)
+{
+  struct timespec deadline;
+
+  deadline.tv_sec  = deadlineNs / 1000000000ULL;
+  deadline.tv_nsec = deadlineNs % 1000000000ULL;
+
+  /* A signal (e.g. a stop request) cuts the sleep short; the caller
+     notices the stop on its next CPU_Run() */
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, 0);
+}
+
+/*
+  Throttle_Init()
+
+  Set the emulated clock rate in Hz. The turbo factor scales the rate
+  (2.0 runs twice as fast as the real CPU). Throttling starts out
+  disabled.
+*/
+void
+Throttle_Init(u32 clockRateHz, double turboFactor)
+{
+  clockRate       = clockRateHz ? clockRateHz : THROTTLE_DEFAULT_CLOCK_HZ;
+  turbo           = (turboFactor > 0) ? turboFactor : 1.0;
+  throttleEnabled = false;
+}
+
+void
+Throttle_SetEnabled(bool enabled)
+{
+  throttleEnabled = enabled;
+}
+
+bool
+Throttle_IsEnabled()
+{
+  return throttleEnabled;
+}
+
+/*
+  Throttle_Run()
+
+  Run the CPU until 'cycleLimit' is reached or CPU_Run() stops for
+  another reason, which is returned. With throttling disabled this is
+  just CPU_Run().
+*/
+u8
+Throttle_Run(u64 cycleLimit)
+{
+  double cyclesPerSlice;
+  double cycleCredit;
+  u64    targetCycle;
+  u64    deadlineNs;
+
+  if (!throttleEnabled)
+    return CPU_Run(cycleLimit);
+
+  cyclesPerSlice = (double)clockRate * turbo * THROTTLE_SLICE_NS / 1e9;
+  cycleCredit    = 0;
+  targetCycle    = CPU_GetCycleCount();
+  deadlineNs     = Throttle_GetTimeNs();
+
+  for (;;)
+  {
+    u64 sliceCycles;
+    u64 nowNs;
+    u8  stopReason;
+
+    /* Carry fractional cycles between slices so the guest clock
+       matches the requested rate exactly over time. The target is
+       advanced from the ideal, not from where the last instruction
+       happened to end. */
+    cycleCredit += cyclesPerSlice;
+    sliceCycles  = (u64)cycleCredit;
+    cycleCredit -= sliceCycles;
+    targetCycle += sliceCycles;
+    if (targetCycle > cycleLimit)
+      targetCycle = cycleLimit;
+
+    stopReason = CPU_Run(targetCycle);
+    if (stopReason != CPU_STOP_CYCLELIMIT ||
+        CPU_GetCycleCount() >= cycleLimit)
+      return stopReason;
+
+    deadlineNs += THROTTLE_SLICE_NS;
+    nowNs = Throttle_GetTimeNs();
+    if (nowNs < deadlineNs)
+    {
+      Throttle_SleepUntil(deadlineNs);
+    }
+    else if (nowNs - deadlineNs > THROTTLE_MAX_LAG_NS)
+    {
+#ifdef _DEBUG
+      Log_Debug("Throttle_Run: dropping %llu ns of lag",
+                (unsigned long long)(nowNs - deadlineNs));
+#endif
+      deadlineNs = nowNs;
+    }
+    /* Otherwise run the next slice straight away to catch up */
+  }
+}
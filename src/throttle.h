@@ -0,0 +1,39 @@
+#ifndef __THROTTLE_H__
+#define __THROTTLE_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  Real-time throttling.
+
+  When enabled, the CPU is run in fixed time slices of guest cycles;
+  after each slice the host thread sleeps until the slice's absolute
+  wall clock deadline. Since deadlines are absolute and the guest
+  cycle target accumulates exactly, neither clock drifts over long
+  runs.
+*/
+
+#define THROTTLE_DEFAULT_CLOCK_HZ   2000000
+#define THROTTLE_SLICE_NS           1000000ULL
+/* If the host falls further behind than this, the missed time is
+   dropped instead of being made up in a burst */
+#define THROTTLE_MAX_LAG_NS        50000000ULL
+
+
+void
+Throttle_Init(u32 clockRateHz, double turboFactor);
+
+void
+Throttle_SetEnabled(bool enabled);
+
+bool
+Throttle_IsEnabled();
+
+u8
+Throttle_Run(u64 cycleLimit);
+
+
+#endif    /* __THROTTLE_H__ */
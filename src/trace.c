@@ -0,0 +1,493 @@
+#include "cpu.h"
+#include "memory.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+
+
+/* Room for a block's entries, with margin for the largest entry */
+#define TRACE_BLOCK_BUFFER    (1 << 20)
+#define TRACE_MAX_ENTRY       256
+
+extern struct instruction instruction_set[256];
+
+internal u8                   format;
+internal bool                 isOpen;
+internal const byte_t*        memory;
+internal u32                  memSize;
+
+/* Ring format */
+internal struct trace_header* header;
+internal struct trace_record* records;
+internal u64                  mappedSize;
+internal u64                  capacity;
+internal u64                  count;
+
+/* Delta format */
+internal int                  deltaFd;
+internal struct trace_delta_header deltaHeader;
+internal struct trace_block   block;
+internal bool                 blockOpen;
+internal u64                  blockCount;
+internal byte_t*              blockMemory;
+internal byte_t*              payload;
+internal u32                  payloadUsed;
+internal u64                  instructionCount;
+internal bool                 forceMemory;
+
+/* The instruction whose entry is written at the next hook, and the
+   state before it */
+internal bool                 pending;
+internal struct registers     previous;
+internal u64                  previousCycle;
+internal byte_t               previousOpcode;
+internal bool                 previousInterrupt;
+
+internal word_t               writes[TRACE_MAX_WRITES];
+internal u32                  writeCount;
+internal word_t               lastWriteAddress;
+
+
+internal byte_t*
+Trace_PutVarint(byte_t* out, u64 value)
+{
+  while (value >= 0x80)
+  {
+    *out++ = (byte_t)value | 0x80;
+    value >>= 7;
+  }
+  *out++ = (byte_t)value;
+  return out;
+}
+
+/* Store a 16-bit difference so small moves either way are short */
+internal byte_t*
+Trace_PutDelta(byte_t* out, word_t from, word_t to)
+{
+  i16 delta = (i16)(word_t)(to - from);
+  return Trace_PutVarint(out, ((u32)delta << 1) ^ (u32)(delta >> 15));
+}
+
+internal bool
+Trace_WriteAll(const struct iovec* vectors, int vectorCount)
+{
+  struct iovec parts[3];
+  int          first;
+
+  memcpy(parts, vectors, vectorCount * sizeof(struct iovec));
+  first = 0;
+  while (first < vectorCount)
+  {
+    ssize_t written = writev(deltaFd, parts + first, vectorCount - first);
+    if (written < 0)
+      return false;
+
+    while (first < vectorCount && (size_t)written >= parts[first].iov_len)
+      written -= parts[first++].iov_len;
+    if (first < vectorCount)
+    {
+      parts[first].iov_base  = (byte_t*)parts[first].iov_base + written;
+      parts[first].iov_len  -= written;
+    }
+  }
+  return true;
+}
+
+internal void
+Trace_BeginBlock(const struct registers* regs, u64 cycle)
+{
+  memset(&block, 0, sizeof(block));
+  block.firstInstruction = instructionCount;
+  block.cycle            = cycle;
+  block.pc               = regs->PC;
+  block.sp               = regs->SP;
+  block.a                = regs->A;
+  block.f                = regs->F;
+  block.b                = regs->B;
+  block.c                = regs->C;
+  block.d                = regs->D;
+  block.e                = regs->E;
+  block.h                = regs->H;
+  block.l                = regs->L;
+
+  if (forceMemory || blockCount % TRACE_MEMORY_INTERVAL == 0)
+  {
+    block.flags |= TRACE_BLOCK_MEMORY;
+    memcpy(blockMemory, memory, memSize);
+  }
+  forceMemory      = false;
+  payloadUsed      = 0;
+  lastWriteAddress = 0;
+  blockOpen        = true;
+}
+
+internal void
+Trace_FlushBlock()
+{
+  struct iovec vectors[3];
+  int          vectorCount;
+
+  if (!blockOpen)
+    return;
+
+  block.payloadSize = payloadUsed;
+  vectorCount = 0;
+  vectors[vectorCount].iov_base   = &block;
+  vectors[vectorCount++].iov_len  = sizeof(block);
+  if (block.flags & TRACE_BLOCK_MEMORY)
+  {
+    vectors[vectorCount].iov_base  = blockMemory;
+    vectors[vectorCount++].iov_len = memSize;
+  }
+  vectors[vectorCount].iov_base    = payload;
+  vectors[vectorCount++].iov_len   = payloadUsed;
+  if (!Trace_WriteAll(vectors, vectorCount))
+    fprintf(stderr, "trace: write failed; trace is incomplete\n");
+
+  ++blockCount;
+  blockOpen = false;
+}
+
+/*
+  Trace_EncodeEntry()
+
+  Append the entry for the pending instruction: how 'regs' and 'cycle'
+  differ from the state before it, and what it wrote.
+*/
+internal void
+Trace_EncodeEntry(const struct registers* regs, u64 cycle)
+{
+  byte_t* start = payload + payloadUsed;
+  byte_t* out   = start + 2;
+  byte_t  mask0 = 0;
+  byte_t  mask1 = 0;
+  word_t  predictedPC;
+  u64     predictedCycles;
+
+  if (previousInterrupt)
+  {
+    mask1 |= TRACE_DELTA_INTERRUPT;
+    *out++ = previousOpcode;
+  }
+
+#define TRACE_DELTA_REG(reg, mask, bit) \
+  if (regs->reg != previous.reg)        \
+  {                                     \
+    mask  |= bit;                       \
+    *out++ = regs->reg;                 \
+  }
+  TRACE_DELTA_REG(A, mask0, TRACE_DELTA_A);
+  TRACE_DELTA_REG(F, mask0, TRACE_DELTA_F);
+  TRACE_DELTA_REG(B, mask1, TRACE_DELTA_B);
+  TRACE_DELTA_REG(C, mask1, TRACE_DELTA_C);
+  TRACE_DELTA_REG(D, mask1, TRACE_DELTA_D);
+  TRACE_DELTA_REG(E, mask1, TRACE_DELTA_E);
+  TRACE_DELTA_REG(H, mask0, TRACE_DELTA_H);
+  TRACE_DELTA_REG(L, mask0, TRACE_DELTA_L);
+#undef TRACE_DELTA_REG
+
+  if (regs->SP != previous.SP)
+  {
+    mask0 |= TRACE_DELTA_SP;
+    out = Trace_PutDelta(out, previous.SP, regs->SP);
+  }
+
+  predictedPC = previousInterrupt ? (previousOpcode & 0x38)
+                                  : previous.PC + deltaHeader.lengths[previousOpcode];
+  if (regs->PC != predictedPC)
+  {
+    mask0 |= TRACE_DELTA_PC;
+    out = Trace_PutDelta(out, predictedPC, regs->PC);
+  }
+
+  predictedCycles = deltaHeader.cycles[previousOpcode];
+  if (cycle - previousCycle != predictedCycles)
+  {
+    mask1 |= TRACE_DELTA_CYCLES;
+    out = Trace_PutVarint(out, cycle - previousCycle);
+  }
+
+  if (writeCount)
+  {
+    u32 i;
+
+    mask0 |= TRACE_DELTA_WRITES;
+    out = Trace_PutVarint(out, writeCount);
+    for (i = 0; i < writeCount; ++i)
+    {
+      out = Trace_PutDelta(out, lastWriteAddress, writes[i]);
+      *out++ = (writes[i] < memSize) ? memory[writes[i]] : 0;
+      lastWriteAddress = writes[i];
+    }
+  }
+
+  /* Most entries need only the first mask byte */
+  if (mask1)
+  {
+    mask0   |= TRACE_DELTA_EXTENDED;
+    start[0] = mask0;
+    start[1] = mask1;
+  }
+  else
+  {
+    memmove(start + 1, start + 2, out - (start + 2));
+    start[0] = mask0;
+    --out;
+  }
+
+  payloadUsed = out - payload;
+  ++block.instructionCount;
+  ++instructionCount;
+  writeCount = 0;
+}
+
+internal void
+Trace_DeltaStep(bool interrupt, byte_t opcode)
+{
+  const struct registers* regs  = CPU_GetRegisters();
+  u64                     cycle = CPU_GetCycleCount();
+
+  if (pending)
+  {
+    Trace_EncodeEntry(regs, cycle);
+    if (block.instructionCount == TRACE_BLOCK_INSTRUCTIONS ||
+        payloadUsed + TRACE_MAX_ENTRY > TRACE_BLOCK_BUFFER ||
+        forceMemory)
+      Trace_FlushBlock();
+  }
+  if (!blockOpen)
+    Trace_BeginBlock(regs, cycle);
+
+  previous          = *regs;
+  previousCycle     = cycle;
+  previousOpcode    = opcode;
+  previousInterrupt = interrupt;
+  pending           = true;
+}
+
+internal bool
+Trace_OpenDelta(char* path)
+{
+  u32 i;
+
+  deltaFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (deltaFd < 0)
+    return false;
+
+  memset(&deltaHeader, 0, sizeof(deltaHeader));
+  memcpy(deltaHeader.magic, TRACE_DELTA_MAGIC, sizeof(deltaHeader.magic));
+  deltaHeader.version           = TRACE_DELTA_VERSION;
+  deltaHeader.blockInstructions = TRACE_BLOCK_INSTRUCTIONS;
+  deltaHeader.memoryInterval    = TRACE_MEMORY_INTERVAL;
+  deltaHeader.memorySize        = memSize;
+  for (i = 0; i < 256; ++i)
+  {
+    deltaHeader.lengths[i] = instruction_set[i].byteCount;
+    deltaHeader.cycles[i]  = instruction_set[i].cycleCount[CYCLE_COUNT_SHORT];
+  }
+  if (write(deltaFd, &deltaHeader, sizeof(deltaHeader)) != sizeof(deltaHeader))
+  {
+    close(deltaFd);
+    return false;
+  }
+
+  if (!payload)
+    payload = (byte_t*)malloc(TRACE_BLOCK_BUFFER);
+  free(blockMemory);
+  blockMemory = (byte_t*)malloc(memSize);
+
+  blockOpen        = false;
+  blockCount       = 0;
+  instructionCount = 0;
+  forceMemory      = false;
+  pending          = false;
+  writeCount       = 0;
+
+  Mem_EnableWriteHook(MEM_HOOK_TRACE, true);
+  return true;
+}
+
+internal bool
+Trace_OpenRing(char* path, u64 ringCapacity)
+{
+  void* mapping;
+  int   fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+
+  mappedSize = sizeof(struct trace_header) + ringCapacity * sizeof(struct trace_record);
+  if (ftruncate(fd, mappedSize) != 0)
+  {
+    close(fd);
+    return false;
+  }
+  mapping = mmap(0, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  /* The mapping keeps the file open */
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+
+  header  = (struct trace_header*)mapping;
+  records = (struct trace_record*)(header + 1);
+  memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  header->version    = TRACE_VERSION;
+  header->recordSize = sizeof(struct trace_record);
+  header->capacity   = ringCapacity;
+  header->count      = 0;
+
+  capacity = ringCapacity;
+  count    = 0;
+  return true;
+}
+
+/*
+  Trace_Open()
+
+  Create the trace file at 'path' and start tracing. 'ringCapacity' is
+  the number of records kept by the ring format.
+*/
+bool
+Trace_Open(char* path, u8 traceFormat, u64 ringCapacity)
+{
+  internal bool atExitRegistered;
+  bool          opened;
+
+  if (isOpen)
+    Trace_Close();
+  if (!ringCapacity)
+    ringCapacity = TRACE_DEFAULT_RECORDS;
+
+  format  = traceFormat;
+  memory  = Mem_GetBase();
+  memSize = Mem_GetSize();
+  if (format == TRACE_FORMAT_DELTA)
+    opened = Trace_OpenDelta(path);
+  else
+    opened = Trace_OpenRing(path, ringCapacity);
+  if (!opened)
+    return false;
+
+  /* The delta format's last block is only written on close */
+  if (!atExitRegistered)
+  {
+    atexit(Trace_Close);
+    atExitRegistered = true;
+  }
+
+  isOpen = true;
+  CPU_EnableHook(CPU_HOOK_TRACE, true);
+  return true;
+}
+
+void
+Trace_Close()
+{
+  if (!isOpen)
+    return;
+
+  CPU_EnableHook(CPU_HOOK_TRACE, false);
+  if (format == TRACE_FORMAT_DELTA)
+  {
+    /* The last instruction's effects are only known now */
+    if (pending)
+      Trace_EncodeEntry(CPU_GetRegisters(), CPU_GetCycleCount());
+    Trace_FlushBlock();
+    Mem_EnableWriteHook(MEM_HOOK_TRACE, false);
+    close(deltaFd);
+    pending = false;
+  }
+  else
+  {
+    munmap(header, mappedSize);
+    header  = 0;
+    records = 0;
+  }
+  isOpen = false;
+}
+
+internal void
+Trace_Record(byte_t flags, byte_t opcode)
+{
+  const struct registers* regs   = CPU_GetRegisters();
+  struct trace_record*    record = &records[count % capacity];
+  word_t                  pc     = regs->PC;
+
+  record->cycle  = CPU_GetCycleCount();
+  record->pc     = pc;
+  record->sp     = regs->SP;
+  record->opcode = opcode;
+  if (pc + 2u < memSize)
+  {
+    record->operands[0] = memory[pc + 1];
+    record->operands[1] = memory[pc + 2];
+  }
+  else
+  {
+    record->operands[0] = Mem_ReadByte(pc + 1);
+    record->operands[1] = Mem_ReadByte(pc + 2);
+  }
+  record->flags = flags;
+  record->a     = regs->A;
+  record->f     = regs->F;
+  record->b     = regs->B;
+  record->c     = regs->C;
+  record->d     = regs->D;
+  record->e     = regs->E;
+  record->h     = regs->H;
+  record->l     = regs->L;
+
+  header->count = ++count;
+}
+
+void
+Trace_RecordInstruction()
+{
+  word_t pc     = CPU_GetProgramCounter();
+  byte_t opcode = (pc < memSize) ? memory[pc] : Mem_ReadByte(pc);
+
+  if (format == TRACE_FORMAT_DELTA)
+    Trace_DeltaStep(false, opcode);
+  else
+    Trace_Record(0, opcode);
+}
+
+void
+Trace_RecordInterrupt(byte_t rstOpcode)
+{
+  if (format == TRACE_FORMAT_DELTA)
+    Trace_DeltaStep(true, rstOpcode);
+  else
+    Trace_Record(TRACE_FLAG_INTERRUPT, rstOpcode);
+}
+
+/*
+  Trace_NoteWrite()
+
+  Called through MEM_HOOK_TRACE for each byte about to be written, and
+  by Mem_MarkModified() for bulk changes. The values are read when the
+  instruction's entry is written. More writes than an entry can hold
+  end the block and give the next one a copy of memory instead.
+*/
+void
+Trace_NoteWrite(word_t address, u32 length)
+{
+  if (!pending || forceMemory)
+    return;
+
+  if (writeCount + length > TRACE_MAX_WRITES)
+  {
+    forceMemory = true;
+    return;
+  }
+  while (length--)
+    writes[writeCount++] = address++;
+}
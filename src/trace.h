@@ -0,0 +1,179 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+#pragma once
+
+
+#include "types.h"
+
+
+/*
+  Binary instruction trace.
+
+  In the ring format, before each instruction a fixed-size record of
+  the CPU state is written into a ring of TRACE_DEFAULT_RECORDS (or the requested
+  number of) records in a file mapped into memory, so tracing costs a
+  few stores per instruction and no system calls. Once the ring is
+  full the oldest records are overwritten.
+
+  The header's record count is updated with every record, so the file
+  is consistent at any moment and still readable if the emulator is
+  killed. Both formats are in host byte order; build/tracedump decodes
+  them.
+
+  For long runs the delta format instead appends blocks to a file that
+  grows without limit. Each block starts with a keyframe holding the
+  full register state, and every TRACE_MEMORY_INTERVAL blocks (or
+  after writes it could not follow) a copy of memory too, so a reader
+  can start at any block with memory. The block is followed by one
+  entry per instruction recording only what the instruction changed:
+
+    mask        TRACE_DELTA_* bits, then a second mask byte if
+                TRACE_DELTA_EXTENDED is set
+    rst         the RST opcode, for an interrupt
+    A F B C D E H L
+                new value of each changed register, in that order
+    SP          zigzag varint of the change in SP
+    PC          zigzag varint of the difference from the fallthrough
+                address (or the RST vector for an interrupt)
+    cycles      varint cycle count, when it differs from the opcode's
+                untaken count in the file header
+    writes      varint count, then for each a zigzag varint of the
+                address relative to the previous write in the block
+                and the byte written
+
+  The opcode of each instruction is not stored; readers fetch it from
+  the memory they rebuild from the keyframes and writes. Entries are
+  a little under three bytes on average. Blocks are written with one
+  write() each.
+
+  This header is shared with the tracedump tool and must not depend on
+  the rest of the emulator.
+*/
+
+#define TRACE_MAGIC             "I80TRACE"
+#define TRACE_VERSION           1
+#define TRACE_DEFAULT_RECORDS   (1 << 22)
+
+#define TRACE_DELTA_MAGIC       "I80DELTA"
+#define TRACE_DELTA_VERSION     1
+#define TRACE_BLOCK_INSTRUCTIONS (1 << 16)
+#define TRACE_MEMORY_INTERVAL   16
+/* Writes followed per instruction before a memory keyframe is forced */
+#define TRACE_MAX_WRITES        32
+
+enum
+{
+  TRACE_FORMAT_RING,
+  TRACE_FORMAT_DELTA
+};
+
+/* First entry mask byte */
+#define TRACE_DELTA_A           0x01
+#define TRACE_DELTA_F           0x02
+#define TRACE_DELTA_L           0x04
+#define TRACE_DELTA_H           0x08
+#define TRACE_DELTA_PC          0x10
+#define TRACE_DELTA_WRITES      0x20
+#define TRACE_DELTA_SP          0x40
+#define TRACE_DELTA_EXTENDED    0x80
+/* Second entry mask byte */
+#define TRACE_DELTA_B           0x01
+#define TRACE_DELTA_C           0x02
+#define TRACE_DELTA_D           0x04
+#define TRACE_DELTA_E           0x08
+#define TRACE_DELTA_CYCLES      0x10
+#define TRACE_DELTA_INTERRUPT   0x20
+
+/* trace_block.flags */
+#define TRACE_BLOCK_MEMORY      0x01
+
+/* trace_record.flags */
+#define TRACE_FLAG_INTERRUPT    0x01
+
+struct trace_header
+{
+  char magic[8];
+  u32  version;
+  u32  recordSize;
+  /* Ring size in records */
+  u64  capacity;
+  /* Records written since the trace began; the oldest record still in
+     the ring is number max(0, count - capacity) */
+  u64  count;
+  u8   reserved[32];
+};
+
+/* CPU state before an instruction runs */
+struct trace_record
+{
+  u64    cycle;
+  word_t pc;
+  word_t sp;
+  /* The opcode and the two bytes after it, whether or not they are
+     operands; for an interrupt, the RST opcode the device supplied */
+  byte_t opcode;
+  byte_t operands[2];
+  byte_t flags;
+  byte_t a;
+  byte_t f;
+  byte_t b;
+  byte_t c;
+  byte_t d;
+  byte_t e;
+  byte_t h;
+  byte_t l;
+};
+
+struct trace_delta_header
+{
+  char   magic[8];
+  u32    version;
+  u32    blockInstructions;
+  u32    memoryInterval;
+  u32    memorySize;
+  /* Opcode lengths and untaken cycle counts, for predicting the next
+     PC and cycle count without the CPU's tables */
+  byte_t lengths[256];
+  byte_t cycles[256];
+};
+
+/* Keyframe at the start of each block; the CPU state before its first
+   instruction. A copy of memory follows if TRACE_BLOCK_MEMORY is set,
+   then 'payloadSize' bytes of entries. */
+struct trace_block
+{
+  u64    firstInstruction;
+  u64    cycle;
+  u32    payloadSize;
+  u32    instructionCount;
+  u32    flags;
+  word_t pc;
+  word_t sp;
+  byte_t a;
+  byte_t f;
+  byte_t b;
+  byte_t c;
+  byte_t d;
+  byte_t e;
+  byte_t h;
+  byte_t l;
+};
+
+
+bool
+Trace_Open(char* path, u8 format, u64 capacity);
+
+void
+Trace_Close();
+
+void
+Trace_RecordInstruction();
+
+void
+Trace_RecordInterrupt(byte_t rstOpcode);
+
+void
+Trace_NoteWrite(word_t address, u32 length);
+
+
+#endif    /* __TRACE_H__ */
@@ -0,0 +1,193 @@
+/*
+  Name: tracedump
+  Purpose: Print and filter binary instruction traces written by
+           'main --trace=FILE'
+*/
+
+#include "tracefile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define OUTPUT_BUFFER_SIZE  (1 << 16)
+
+struct filter
+{
+  u32 pcLow;
+  u32 pcHigh;
+  /* -1 matches any opcode */
+  i32 opcode;
+  u64 fromCycle;
+  u64 toCycle;
+  u64 limit;
+  bool interruptsOnly;
+  bool showWrites;
+};
+
+
+void
+PrintUsage(char* exeName)
+{
+  fprintf(stderr, "%s [options] tracefile\n", exeName);
+  fprintf(stderr, "  --pc=ADDR[-ADDR]   only instructions at ADDR or in the range\n");
+  fprintf(stderr, "  --opcode=OP        only instructions with opcode OP\n");
+  fprintf(stderr, "  --from=CYCLE       skip records before CYCLE\n");
+  fprintf(stderr, "  --to=CYCLE         stop at records after CYCLE\n");
+  fprintf(stderr, "  --limit=N          print at most N records\n");
+  fprintf(stderr, "  --interrupts       only interrupts\n");
+  fprintf(stderr, "  --writes           show the bytes each instruction wrote (delta traces)\n");
+  fprintf(stderr, "  --summary          print the header only\n");
+}
+
+internal bool
+ParseRange(char* string, u32* low, u32* high)
+{
+  char* end;
+
+  *low = strtoul(string, &end, 0);
+  if (*end == '-')
+    *high = strtoul(end + 1, &end, 0);
+  else
+    *high = *low;
+  return !*end && *low <= *high;
+}
+
+internal bool
+Matches(const struct trace_record* record, const struct filter* filter)
+{
+  if (record->pc < filter->pcLow || record->pc > filter->pcHigh)
+    return false;
+  if (filter->opcode >= 0 && record->opcode != filter->opcode)
+    return false;
+  if (filter->interruptsOnly && !(record->flags & TRACE_FLAG_INTERRUPT))
+    return false;
+  return true;
+}
+
+internal void
+PrintRecord(const struct trace_record* record, bool showWrites)
+{
+  TraceFile_PrintRecord(stdout, record);
+
+  if (showWrites)
+  {
+    const word_t* addresses;
+    const byte_t* values;
+    u32           count;
+
+    count = TraceFile_GetWrites(&addresses, &values);
+    for (u32 i = 0; i < count; ++i)
+      printf(" [%04x]=%02x", addresses[i], values[i]);
+  }
+  printf("\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+  struct filter       filter;
+  struct trace_record record;
+  char*               path;
+  bool                summaryOnly;
+  u64                 printed;
+
+  memset(&filter, 0, sizeof(filter));
+  filter.pcHigh  = 0xffff;
+  filter.opcode  = -1;
+  filter.toCycle = ~0ULL;
+  filter.limit   = ~0ULL;
+  path        = 0;
+  summaryOnly = false;
+  for (int argi = 1; argi < argc; ++argi)
+  {
+    if (argv[argi][0] != '-' && !path)
+      path = argv[argi];
+
+    else if (strncmp(argv[argi], "--pc=", 5) == 0)
+    {
+      if (!ParseRange(argv[argi] + 5, &filter.pcLow, &filter.pcHigh))
+      {
+        fprintf(stderr, "invalid address range: %s\n", argv[argi] + 5);
+        return 1;
+      }
+    }
+
+    else if (strncmp(argv[argi], "--opcode=", 9) == 0)
+      filter.opcode = strtoul(argv[argi] + 9, 0, 16) & 0xff;
+
+    else if (strncmp(argv[argi], "--from=", 7) == 0)
+      filter.fromCycle = strtoull(argv[argi] + 7, 0, 0);
+
+    else if (strncmp(argv[argi], "--to=", 5) == 0)
+      filter.toCycle = strtoull(argv[argi] + 5, 0, 0);
+
+    else if (strncmp(argv[argi], "--limit=", 8) == 0)
+      filter.limit = strtoull(argv[argi] + 8, 0, 0);
+
+    else if (strcmp(argv[argi], "--interrupts") == 0)
+      filter.interruptsOnly = true;
+
+    else if (strcmp(argv[argi], "--writes") == 0)
+      filter.showWrites = true;
+
+    else if (strcmp(argv[argi], "--summary") == 0)
+      summaryOnly = true;
+
+    else
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!path)
+  {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  if (!TraceFile_Open(path))
+  {
+    fprintf(stderr, "%s: cannot open as a trace file\n", path);
+    return 1;
+  }
+
+  if (summaryOnly)
+  {
+    u64 first = TraceFile_GetFirstInstruction();
+    u64 end   = TraceFile_GetEndInstruction();
+
+    printf("format: %s\n", (TraceFile_GetFormat() == TRACE_FORMAT_DELTA) ? "delta" : "ring");
+    printf("instructions: %llu to %llu\n",
+           (unsigned long long)first, (unsigned long long)end);
+    if (end > first)
+      printf("bytes per instruction: %.2f\n",
+             (double)TraceFile_GetFileSize() / (end - first));
+    TraceFile_Close();
+    return 0;
+  }
+
+  setvbuf(stdout, 0, _IOFBF, OUTPUT_BUFFER_SIZE);
+  if (filter.fromCycle)
+    TraceFile_SeekCycle(filter.fromCycle);
+
+  printed = 0;
+  while (printed < filter.limit && TraceFile_Next(&record))
+  {
+    if (record.cycle < filter.fromCycle)
+      continue;
+    if (record.cycle > filter.toCycle)
+      break;
+    if (!Matches(&record, &filter))
+      continue;
+
+    PrintRecord(&record, filter.showWrites);
+    ++printed;
+  }
+
+  TraceFile_Close();
+  return 0;
+}
@@ -0,0 +1,524 @@
+#include "tracefile.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+internal u8         format;
+internal byte_t*    mapping;
+internal u64        fileSize;
+/* Number of the next instruction Next() returns */
+internal u64        nextIndex;
+
+/* Ring format */
+internal const struct trace_header* ringHeader;
+internal const struct trace_record* ringRecords;
+
+/* Delta format */
+internal const struct trace_delta_header* deltaHeader;
+internal const struct trace_block** blocks;
+internal u64        blockCount;
+internal u64        currentBlock;
+internal const byte_t* entry;
+internal const byte_t* payloadEnd;
+internal u32        entriesLeft;
+internal struct trace_record state;
+internal byte_t*    memory;
+internal word_t     lastWriteAddress;
+
+internal word_t     writeAddresses[TRACE_MAX_WRITES];
+internal byte_t     writeValues[TRACE_MAX_WRITES];
+internal u32        writeCount;
+
+
+internal bool
+TraceFile_GetVarint(u64* value)
+{
+  u32 shift = 0;
+
+  *value = 0;
+  while (entry < payloadEnd && shift < 64)
+  {
+    byte_t b = *entry++;
+    *value |= (u64)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+    shift += 7;
+  }
+  return false;
+}
+
+internal bool
+TraceFile_GetDelta(word_t from, word_t* to)
+{
+  u64 zigzag;
+
+  if (!TraceFile_GetVarint(&zigzag))
+    return false;
+  *to = from + (word_t)((zigzag >> 1) ^ -(i64)(zigzag & 1));
+  return true;
+}
+
+/*
+  TraceFile_ScanBlocks()
+
+  Find every block in a delta trace. A block cut short by the emulator
+  being killed ends the list.
+*/
+internal bool
+TraceFile_ScanBlocks()
+{
+  u64 capacity = 0;
+  u64 offset   = sizeof(struct trace_delta_header);
+
+  blockCount = 0;
+  while (offset + sizeof(struct trace_block) <= fileSize)
+  {
+    const struct trace_block* block = (const struct trace_block*)(mapping + offset);
+    u64                       size;
+
+    size = sizeof(struct trace_block) + block->payloadSize;
+    if (block->flags & TRACE_BLOCK_MEMORY)
+      size += deltaHeader->memorySize;
+    if (offset + size > fileSize)
+      break;
+    /* Seeking needs somewhere to start */
+    if (blockCount == 0 && !(block->flags & TRACE_BLOCK_MEMORY))
+      return false;
+
+    if (blockCount == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 1024;
+      blocks = (const struct trace_block**)realloc(blocks, capacity * sizeof(*blocks));
+    }
+    blocks[blockCount++] = block;
+    offset += size;
+  }
+  return true;
+}
+
+internal void
+TraceFile_EnterBlock(u64 index)
+{
+  const struct trace_block* block = blocks[index];
+  const byte_t*             data  = (const byte_t*)(block + 1);
+
+  if (block->flags & TRACE_BLOCK_MEMORY)
+  {
+    memcpy(memory, data, deltaHeader->memorySize);
+    data += deltaHeader->memorySize;
+  }
+
+  memset(&state, 0, sizeof(state));
+  state.cycle = block->cycle;
+  state.pc    = block->pc;
+  state.sp    = block->sp;
+  state.a     = block->a;
+  state.f     = block->f;
+  state.b     = block->b;
+  state.c     = block->c;
+  state.d     = block->d;
+  state.e     = block->e;
+  state.h     = block->h;
+  state.l     = block->l;
+
+  currentBlock     = index;
+  entry            = data;
+  payloadEnd       = data + block->payloadSize;
+  entriesLeft      = block->instructionCount;
+  lastWriteAddress = 0;
+  nextIndex        = block->firstInstruction;
+}
+
+internal byte_t
+TraceFile_ReadMemory(u32 address)
+{
+  return (address < deltaHeader->memorySize) ? memory[address] : 0;
+}
+
+/*
+  TraceFile_NextDelta()
+
+  Decode the next entry: fill in 'record' from the state before it,
+  then apply it.
+*/
+internal bool
+TraceFile_NextDelta(struct trace_record* record)
+{
+  byte_t mask0;
+  byte_t mask1;
+  word_t predictedPC;
+  u64    cycles;
+
+  while (!entriesLeft)
+  {
+    if (currentBlock + 1 >= blockCount)
+      return false;
+    TraceFile_EnterBlock(currentBlock + 1);
+  }
+  if (entry >= payloadEnd)
+    return false;
+
+  mask0 = *entry++;
+  mask1 = 0;
+  if ((mask0 & TRACE_DELTA_EXTENDED) && entry < payloadEnd)
+    mask1 = *entry++;
+
+  *record = state;
+  if (mask1 & TRACE_DELTA_INTERRUPT)
+  {
+    if (entry >= payloadEnd)
+      return false;
+    record->opcode = *entry++;
+    record->flags  = TRACE_FLAG_INTERRUPT;
+  }
+  else
+    record->opcode = TraceFile_ReadMemory(state.pc);
+  record->operands[0] = TraceFile_ReadMemory(state.pc + 1);
+  record->operands[1] = TraceFile_ReadMemory(state.pc + 2);
+
+#define TRACEFILE_DELTA_REG(reg, mask, bit)   \
+  if (mask & bit)                             \
+  {                                           \
+    if (entry >= payloadEnd)                  \
+      return false;                           \
+    state.reg = *entry++;                     \
+  }
+  TRACEFILE_DELTA_REG(a, mask0, TRACE_DELTA_A);
+  TRACEFILE_DELTA_REG(f, mask0, TRACE_DELTA_F);
+  TRACEFILE_DELTA_REG(b, mask1, TRACE_DELTA_B);
+  TRACEFILE_DELTA_REG(c, mask1, TRACE_DELTA_C);
+  TRACEFILE_DELTA_REG(d, mask1, TRACE_DELTA_D);
+  TRACEFILE_DELTA_REG(e, mask1, TRACE_DELTA_E);
+  TRACEFILE_DELTA_REG(h, mask0, TRACE_DELTA_H);
+  TRACEFILE_DELTA_REG(l, mask0, TRACE_DELTA_L);
+#undef TRACEFILE_DELTA_REG
+
+  if ((mask0 & TRACE_DELTA_SP) &&
+      !TraceFile_GetDelta(state.sp, &state.sp))
+    return false;
+
+  if (record->flags & TRACE_FLAG_INTERRUPT)
+    predictedPC = record->opcode & 0x38;
+  else
+    predictedPC = state.pc + deltaHeader->lengths[record->opcode];
+  state.pc = predictedPC;
+  if ((mask0 & TRACE_DELTA_PC) &&
+      !TraceFile_GetDelta(predictedPC, &state.pc))
+    return false;
+
+  cycles = deltaHeader->cycles[record->opcode];
+  if ((mask1 & TRACE_DELTA_CYCLES) &&
+      !TraceFile_GetVarint(&cycles))
+    return false;
+  state.cycle += cycles;
+
+  writeCount = 0;
+  if (mask0 & TRACE_DELTA_WRITES)
+  {
+    u64 count;
+
+    if (!TraceFile_GetVarint(&count) || count > TRACE_MAX_WRITES)
+      return false;
+    while (count--)
+    {
+      word_t address;
+
+      if (!TraceFile_GetDelta(lastWriteAddress, &address) ||
+          entry >= payloadEnd)
+        return false;
+      writeAddresses[writeCount] = address;
+      writeValues[writeCount]    = *entry++;
+      if (address < deltaHeader->memorySize)
+        memory[address] = writeValues[writeCount];
+      lastWriteAddress = address;
+      ++writeCount;
+    }
+  }
+
+  --entriesLeft;
+  ++nextIndex;
+  return true;
+}
+
+bool
+TraceFile_Open(char* path)
+{
+  struct stat info;
+  int         fd;
+
+  TraceFile_Close();
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (fstat(fd, &info) != 0 || (u64)info.st_size < 8)
+  {
+    close(fd);
+    return false;
+  }
+  fileSize = info.st_size;
+  mapping  = (byte_t*)mmap(0, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    mapping = 0;
+    return false;
+  }
+  madvise(mapping, fileSize, MADV_SEQUENTIAL);
+
+  if (memcmp(mapping, TRACE_MAGIC, 8) == 0)
+  {
+    ringHeader  = (const struct trace_header*)mapping;
+    ringRecords = (const struct trace_record*)(ringHeader + 1);
+    if (fileSize < sizeof(struct trace_header) ||
+        ringHeader->version != TRACE_VERSION ||
+        ringHeader->recordSize != sizeof(struct trace_record) ||
+        sizeof(struct trace_header) + ringHeader->capacity * ringHeader->recordSize > fileSize)
+    {
+      TraceFile_Close();
+      return false;
+    }
+    format    = TRACE_FORMAT_RING;
+    nextIndex = TraceFile_GetFirstInstruction();
+    return true;
+  }
+
+  if (memcmp(mapping, TRACE_DELTA_MAGIC, 8) == 0)
+  {
+    deltaHeader = (const struct trace_delta_header*)mapping;
+    if (fileSize < sizeof(struct trace_delta_header) ||
+        deltaHeader->version != TRACE_DELTA_VERSION ||
+        !TraceFile_ScanBlocks())
+    {
+      TraceFile_Close();
+      return false;
+    }
+    format = TRACE_FORMAT_DELTA;
+    memory = (byte_t*)calloc(deltaHeader->memorySize ? deltaHeader->memorySize : 1, 1);
+    if (blockCount)
+      TraceFile_EnterBlock(0);
+    return true;
+  }
+
+  TraceFile_Close();
+  return false;
+}
+
+void
+TraceFile_Close()
+{
+  if (mapping)
+    munmap(mapping, fileSize);
+  mapping     = 0;
+  ringHeader  = 0;
+  deltaHeader = 0;
+  free(blocks);
+  blocks      = 0;
+  blockCount  = 0;
+  free(memory);
+  memory      = 0;
+  entriesLeft = 0;
+  writeCount  = 0;
+  nextIndex   = 0;
+}
+
+u8
+TraceFile_GetFormat()
+{
+  return format;
+}
+
+u64
+TraceFile_GetFirstInstruction()
+{
+  if (ringHeader)
+  {
+    return (ringHeader->count > ringHeader->capacity) ?
+      ringHeader->count - ringHeader->capacity : 0;
+  }
+  return 0;
+}
+
+/* One past the number of the last instruction in the trace */
+u64
+TraceFile_GetEndInstruction()
+{
+  if (ringHeader)
+    return ringHeader->count;
+  if (blockCount)
+    return blocks[blockCount - 1]->firstInstruction + blocks[blockCount - 1]->instructionCount;
+  return 0;
+}
+
+u64
+TraceFile_GetFileSize()
+{
+  return fileSize;
+}
+
+/*
+  TraceFile_SeekInstruction()
+
+  Make 'index' the next instruction Next() returns.
+*/
+bool
+TraceFile_SeekInstruction(u64 index)
+{
+  u64 low;
+  u64 high;
+  u64 start;
+
+  if (index < TraceFile_GetFirstInstruction() ||
+      index > TraceFile_GetEndInstruction())
+    return false;
+
+  if (ringHeader)
+  {
+    nextIndex  = index;
+    writeCount = 0;
+    return true;
+  }
+  if (!blockCount)
+    return false;
+
+  /* The last block starting at or before 'index' */
+  low  = 0;
+  high = blockCount;
+  while (high - low > 1)
+  {
+    u64 middle = (low + high) / 2;
+    if (blocks[middle]->firstInstruction <= index)
+      low = middle;
+    else
+      high = middle;
+  }
+
+  /* Memory is only known from a keyframe that has a copy of it.
+     Decoding on from where the reader is saves going back to one, so
+     visiting instructions in order costs no more than a single pass */
+  start = low;
+  while (!(blocks[start]->flags & TRACE_BLOCK_MEMORY))
+    --start;
+  if (index < nextIndex || start > currentBlock)
+    TraceFile_EnterBlock(start);
+
+  while (nextIndex < index)
+  {
+    struct trace_record skipped;
+    if (!TraceFile_NextDelta(&skipped))
+      return false;
+  }
+  /* Stopping at the end of a block is the same as its successor's
+     start, but only the latter can be stepped through */
+  if (!entriesLeft && currentBlock + 1 < blockCount)
+    TraceFile_EnterBlock(currentBlock + 1);
+  return true;
+}
+
+/*
+  TraceFile_SeekCycle()
+
+  Move to the first instruction that starts at or after 'cycle'.
+*/
+bool
+TraceFile_SeekCycle(u64 cycle)
+{
+  u64 low;
+  u64 high;
+
+  low  = TraceFile_GetFirstInstruction();
+  high = TraceFile_GetEndInstruction();
+
+  if (ringHeader)
+  {
+    /* Records are in cycle order around the ring */
+    while (low < high)
+    {
+      u64 middle = low + (high - low) / 2;
+      if (ringRecords[middle % ringHeader->capacity].cycle < cycle)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    return TraceFile_SeekInstruction(low);
+  }
+
+  if (!blockCount)
+    return false;
+
+  /* Start in the last block beginning at or before 'cycle', then step
+     through it */
+  low  = 0;
+  high = blockCount;
+  while (high - low > 1)
+  {
+    u64 middle = (low + high) / 2;
+    if (blocks[middle]->cycle <= cycle)
+      low = middle;
+    else
+      high = middle;
+  }
+  if (!TraceFile_SeekInstruction(blocks[low]->firstInstruction))
+    return false;
+  while (entriesLeft && state.cycle < cycle)
+  {
+    struct trace_record skipped;
+    if (!TraceFile_NextDelta(&skipped))
+      return false;
+  }
+  return true;
+}
+
+bool
+TraceFile_Next(struct trace_record* record)
+{
+  if (ringHeader)
+  {
+    if (nextIndex >= ringHeader->count)
+      return false;
+    *record = ringRecords[nextIndex++ % ringHeader->capacity];
+    return true;
+  }
+  if (deltaHeader)
+    return TraceFile_NextDelta(record);
+  return false;
+}
+
+void
+TraceFile_PrintRecord(FILE* out, const struct trace_record* record)
+{
+  fprintf(out, "%12llu %04x%c %02x %02x %02x  A=%02x F=%02x B=%02x C=%02x D=%02x E=%02x H=%02x L=%02x SP=%04x",
+          (unsigned long long)record->cycle, record->pc,
+          (record->flags & TRACE_FLAG_INTERRUPT) ? '!' : ':',
+          record->opcode, record->operands[0], record->operands[1],
+          record->a, record->f, record->b, record->c,
+          record->d, record->e, record->h, record->l, record->sp);
+}
+
+/* Number of the instruction Next() returned last */
+u64
+TraceFile_GetIndex()
+{
+  return nextIndex - 1;
+}
+
+/*
+  TraceFile_GetWrites()
+
+  The bytes written by the instruction Next() returned last. Ring
+  traces do not record writes.
+*/
+u32
+TraceFile_GetWrites(const word_t** addresses, const byte_t** values)
+{
+  *addresses = writeAddresses;
+  *values    = writeValues;
+  return writeCount;
+}
@@ -0,0 +1,63 @@
+#ifndef __TRACEFILE_H__
+#define __TRACEFILE_H__
+#pragma once
+
+
+#include "trace.h"
+
+#include <stdio.h>
+
+
+/*
+  Trace file reader, for the offline trace tools.
+
+  Opens either trace format (see trace.h) and returns the recorded
+  instructions in order as trace_records, the CPU state before each
+  one. For delta traces the reader rebuilds memory as it goes, which
+  supplies each instruction's opcode and operand bytes, and reports
+  the bytes each instruction wrote. Seeking starts from the nearest
+  keyframe with a copy of memory and decodes forward from there.
+
+  Instructions are numbered from the start of the trace, so in a ring
+  trace that has wrapped the first one kept is not number 0.
+*/
+
+
+bool
+TraceFile_Open(char* path);
+
+void
+TraceFile_Close();
+
+u8
+TraceFile_GetFormat();
+
+u64
+TraceFile_GetFirstInstruction();
+
+u64
+TraceFile_GetEndInstruction();
+
+bool
+TraceFile_SeekInstruction(u64 index);
+
+bool
+TraceFile_SeekCycle(u64 cycle);
+
+bool
+TraceFile_Next(struct trace_record* record);
+
+u64
+TraceFile_GetIndex();
+
+u32
+TraceFile_GetWrites(const word_t** addresses, const byte_t** values);
+
+u64
+TraceFile_GetFileSize();
+
+void
+TraceFile_PrintRecord(FILE* out, const struct trace_record* record);
+
+
+#endif    /* __TRACEFILE_H__ */
@@ -0,0 +1,302 @@
+#include "traceindex.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+/* A posting list while it is being built */
+struct builder_list
+{
+  byte_t* data;
+  u64     size;
+  u64     capacity;
+  u64     count;
+  u64     last;
+};
+
+internal byte_t*                          mapping;
+internal u64                              mappedSize;
+internal const struct trace_index_header* header;
+
+
+internal void
+TraceIndex_Append(struct builder_list* list, u64 instruction)
+{
+  u64 delta;
+
+  /* An instruction writing the same byte twice is listed once */
+  if (list->count && instruction == list->last)
+    return;
+
+  if (list->size + 10 > list->capacity)
+  {
+    list->capacity = list->capacity ? list->capacity * 2 : 16;
+    list->data = (byte_t*)realloc(list->data, list->capacity);
+    if (!list->data)
+    {
+      fprintf(stderr, "out of memory indexing the trace\n");
+      exit(1);
+    }
+  }
+
+  delta = list->count ? instruction - list->last : instruction;
+  while (delta >= 0x80)
+  {
+    list->data[list->size++] = (byte_t)delta | 0x80;
+    delta >>= 7;
+  }
+  list->data[list->size++] = (byte_t)delta;
+
+  list->last = instruction;
+  ++list->count;
+}
+
+internal void
+TraceIndex_Summarize(struct trace_index_summary* summary, const struct trace_record* record)
+{
+  byte_t values[TRACE_INDEX_REGS];
+  u32    i;
+
+  values[TRACE_INDEX_A] = record->a;
+  values[TRACE_INDEX_F] = record->f;
+  values[TRACE_INDEX_B] = record->b;
+  values[TRACE_INDEX_C] = record->c;
+  values[TRACE_INDEX_D] = record->d;
+  values[TRACE_INDEX_E] = record->e;
+  values[TRACE_INDEX_H] = record->h;
+  values[TRACE_INDEX_L] = record->l;
+  for (i = 0; i < TRACE_INDEX_REGS; ++i)
+    summary->values[i][values[i] >> 3] |= 1 << (values[i] & 7);
+}
+
+/*
+  TraceIndex_Build()
+
+  Read the whole trace at 'tracePath' and write its index to
+  'indexPath'.
+*/
+bool
+TraceIndex_Build(char* tracePath, char* indexPath)
+{
+  struct trace_index_header   newHeader;
+  struct trace_index_list*    directory;
+  struct trace_index_summary* summaries;
+  struct builder_list*        lists[TRACE_INDEX_NUMLISTS];
+  struct trace_record         record;
+  FILE*                       fp;
+  u64                         offset;
+  u32                         kind;
+  u32                         key;
+  bool                        ok;
+
+  if (!TraceFile_Open(tracePath))
+    return false;
+
+  memset(&newHeader, 0, sizeof(newHeader));
+  memcpy(newHeader.magic, TRACE_INDEX_MAGIC, sizeof(newHeader.magic));
+  newHeader.version           = TRACE_INDEX_VERSION;
+  newHeader.chunkInstructions = TRACE_INDEX_CHUNK_INSTRUCTIONS;
+  newHeader.traceSize         = TraceFile_GetFileSize();
+  newHeader.firstInstruction  = TraceFile_GetFirstInstruction();
+  newHeader.endInstruction    = TraceFile_GetEndInstruction();
+  newHeader.chunkCount        = (newHeader.endInstruction - newHeader.firstInstruction +
+                                 TRACE_INDEX_CHUNK_INSTRUCTIONS - 1) / TRACE_INDEX_CHUNK_INSTRUCTIONS;
+
+  for (kind = 0; kind < TRACE_INDEX_NUMLISTS; ++kind)
+    lists[kind] = (struct builder_list*)calloc(TRACE_INDEX_KEYS, sizeof(struct builder_list));
+  summaries = (struct trace_index_summary*)calloc(newHeader.chunkCount ? newHeader.chunkCount : 1,
+                                                  sizeof(struct trace_index_summary));
+
+  while (TraceFile_Next(&record))
+  {
+    u64           instruction = TraceFile_GetIndex();
+    u64           chunk       = (instruction - newHeader.firstInstruction) / TRACE_INDEX_CHUNK_INSTRUCTIONS;
+    const word_t* addresses;
+    const byte_t* values;
+    u32           writeCount;
+    u32           i;
+
+    TraceIndex_Append(&lists[TRACE_INDEX_PC][record.pc], instruction);
+    writeCount = TraceFile_GetWrites(&addresses, &values);
+    for (i = 0; i < writeCount; ++i)
+      TraceIndex_Append(&lists[TRACE_INDEX_WRITE][addresses[i]], instruction);
+    if (chunk < newHeader.chunkCount)
+      TraceIndex_Summarize(&summaries[chunk], &record);
+  }
+  TraceFile_Close();
+
+  /* Header, both directories, the lists, then the summaries */
+  directory = (struct trace_index_list*)calloc(TRACE_INDEX_KEYS, sizeof(struct trace_index_list));
+  offset    = sizeof(newHeader) + TRACE_INDEX_NUMLISTS * TRACE_INDEX_KEYS * sizeof(struct trace_index_list);
+  for (kind = 0; kind < TRACE_INDEX_NUMLISTS; ++kind)
+  {
+    newHeader.directoryOffset[kind] = sizeof(newHeader) +
+      kind * TRACE_INDEX_KEYS * sizeof(struct trace_index_list);
+    for (key = 0; key < TRACE_INDEX_KEYS; ++key)
+      offset += lists[kind][key].size;
+  }
+  newHeader.summaryOffset = offset;
+
+  ok = false;
+  fp = fopen(indexPath, "wb");
+  if (fp)
+  {
+    ok = fwrite(&newHeader, sizeof(newHeader), 1, fp) == 1;
+
+    offset = sizeof(newHeader) + TRACE_INDEX_NUMLISTS * TRACE_INDEX_KEYS * sizeof(struct trace_index_list);
+    for (kind = 0; kind < TRACE_INDEX_NUMLISTS; ++kind)
+    {
+      for (key = 0; key < TRACE_INDEX_KEYS; ++key)
+      {
+        directory[key].offset = offset;
+        directory[key].count  = lists[kind][key].count;
+        directory[key].size   = lists[kind][key].size;
+        offset += lists[kind][key].size;
+      }
+      ok = ok && fwrite(directory, sizeof(struct trace_index_list), TRACE_INDEX_KEYS, fp) == TRACE_INDEX_KEYS;
+    }
+
+    for (kind = 0; kind < TRACE_INDEX_NUMLISTS; ++kind)
+    {
+      for (key = 0; key < TRACE_INDEX_KEYS; ++key)
+      {
+        if (lists[kind][key].size)
+          ok = ok && fwrite(lists[kind][key].data, 1, lists[kind][key].size, fp) == lists[kind][key].size;
+      }
+    }
+
+    ok = ok && fwrite(summaries, sizeof(struct trace_index_summary), newHeader.chunkCount, fp) == newHeader.chunkCount;
+    ok = (fclose(fp) == 0) && ok;
+  }
+
+  for (kind = 0; kind < TRACE_INDEX_NUMLISTS; ++kind)
+  {
+    for (key = 0; key < TRACE_INDEX_KEYS; ++key)
+      free(lists[kind][key].data);
+    free(lists[kind]);
+  }
+  free(directory);
+  free(summaries);
+  return ok;
+}
+
+bool
+TraceIndex_Open(char* indexPath)
+{
+  struct stat info;
+  int         fd;
+
+  TraceIndex_Close();
+
+  fd = open(indexPath, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (fstat(fd, &info) != 0 || (u64)info.st_size < sizeof(struct trace_index_header))
+  {
+    close(fd);
+    return false;
+  }
+  mappedSize = info.st_size;
+  mapping    = (byte_t*)mmap(0, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    mapping = 0;
+    return false;
+  }
+
+  header = (const struct trace_index_header*)mapping;
+  if (memcmp(header->magic, TRACE_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != TRACE_INDEX_VERSION ||
+      header->summaryOffset + header->chunkCount * sizeof(struct trace_index_summary) > mappedSize)
+  {
+    TraceIndex_Close();
+    return false;
+  }
+  return true;
+}
+
+void
+TraceIndex_Close()
+{
+  if (mapping)
+    munmap(mapping, mappedSize);
+  mapping = 0;
+  header  = 0;
+}
+
+const struct trace_index_header*
+TraceIndex_GetHeader()
+{
+  return header;
+}
+
+internal const struct trace_index_list*
+TraceIndex_GetEntry(u8 kind, word_t address)
+{
+  const struct trace_index_list* directory;
+
+  directory = (const struct trace_index_list*)(mapping + header->directoryOffset[kind]);
+  return &directory[address];
+}
+
+u64
+TraceIndex_GetListLength(u8 kind, word_t address)
+{
+  return TraceIndex_GetEntry(kind, address)->count;
+}
+
+/*
+  TraceIndex_GetList()
+
+  Decode up to 'maxCount' instruction numbers from the list of 'kind'
+  for 'address'. Returns how many were stored.
+*/
+u64
+TraceIndex_GetList(u8 kind, word_t address, u64* instructions, u64 maxCount)
+{
+  const struct trace_index_list* entry = TraceIndex_GetEntry(kind, address);
+  const byte_t*                  data  = mapping + entry->offset;
+  const byte_t*                  end   = data + entry->size;
+  u64                            instruction;
+  u64                            n;
+
+  if (entry->offset > mappedSize || entry->size > mappedSize - entry->offset)
+    return 0;
+
+  instruction = 0;
+  for (n = 0; n < entry->count && n < maxCount; ++n)
+  {
+    u64 delta = 0;
+    u32 shift = 0;
+
+    while (data < end)
+    {
+      byte_t b = *data++;
+      delta |= (u64)(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80))
+        break;
+    }
+    instruction += delta;
+    instructions[n] = instruction;
+  }
+  return n;
+}
+
+bool
+TraceIndex_ChunkMayContain(u64 chunk, u8 reg, byte_t value)
+{
+  const struct trace_index_summary* summaries;
+
+  if (chunk >= header->chunkCount)
+    return false;
+  summaries = (const struct trace_index_summary*)(mapping + header->summaryOffset);
+  return (summaries[chunk].values[reg][value >> 3] >> (value & 7)) & 1;
+}
@@ -0,0 +1,104 @@
+#ifndef __TRACEINDEX_H__
+#define __TRACEINDEX_H__
+#pragma once
+
+
+#include "tracefile.h"
+
+
+/*
+  Trace index.
+
+  Built in one pass over a trace and stored next to it as TRACE.idx.
+  It holds, for every address, a posting list of the instructions
+  executed there and one of the instructions that wrote to it, each a
+  sorted list of instruction numbers stored as varint deltas. Ring
+  traces do not record writes, so their write lists are empty.
+
+  The index also splits the trace into chunks of
+  TRACE_INDEX_CHUNK_INSTRUCTIONS and records which values each 8-bit
+  register took in each chunk, so a search for a register value only
+  decodes the chunks that can contain it.
+*/
+
+#define TRACE_INDEX_MAGIC               "I80INDEX"
+#define TRACE_INDEX_VERSION             2
+#define TRACE_INDEX_CHUNK_INSTRUCTIONS  (1 << 16)
+#define TRACE_INDEX_KEYS                0x10000
+#define TRACE_INDEX_REGS                8
+
+/* Posting list kinds */
+enum
+{
+  TRACE_INDEX_PC,
+  TRACE_INDEX_WRITE,
+  TRACE_INDEX_NUMLISTS
+};
+
+/* Register order in the value summaries */
+enum
+{
+  TRACE_INDEX_A,
+  TRACE_INDEX_F,
+  TRACE_INDEX_B,
+  TRACE_INDEX_C,
+  TRACE_INDEX_D,
+  TRACE_INDEX_E,
+  TRACE_INDEX_H,
+  TRACE_INDEX_L
+};
+
+struct trace_index_header
+{
+  char magic[8];
+  u32  version;
+  u32  chunkInstructions;
+  /* The trace the index was built from, to notice when it changes */
+  u64  traceSize;
+  u64  firstInstruction;
+  u64  endInstruction;
+  u64  chunkCount;
+  /* File offsets of the list directories, the posting data and the
+     chunk summaries */
+  u64  directoryOffset[TRACE_INDEX_NUMLISTS];
+  u64  summaryOffset;
+};
+
+/* One per address in each directory */
+struct trace_index_list
+{
+  u64 offset;
+  u64 count;
+  u64 size;
+};
+
+/* Values seen in one chunk, as a 256-bit set per register */
+struct trace_index_summary
+{
+  u8 values[TRACE_INDEX_REGS][32];
+};
+
+
+bool
+TraceIndex_Build(char* tracePath, char* indexPath);
+
+bool
+TraceIndex_Open(char* indexPath);
+
+void
+TraceIndex_Close();
+
+const struct trace_index_header*
+TraceIndex_GetHeader();
+
+u64
+TraceIndex_GetList(u8 kind, word_t address, u64* instructions, u64 maxCount);
+
+u64
+TraceIndex_GetListLength(u8 kind, word_t address);
+
+bool
+TraceIndex_ChunkMayContain(u64 chunk, u8 reg, byte_t value);
+
+
+#endif    /* __TRACEINDEX_H__ */
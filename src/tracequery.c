@@ -0,0 +1,287 @@
+/*
+  Name: tracequery
+  Purpose: Index instruction traces and answer questions about them
+           without replaying the program
+*/
+
+#include "traceindex.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+#define OUTPUT_BUFFER_SIZE  (1 << 16)
+#define MAX_PATH_LENGTH     4096
+
+
+internal const char* regNames[TRACE_INDEX_REGS] = { "a", "f", "b", "c", "d", "e", "h", "l" };
+
+
+void
+PrintUsage(char* exeName)
+{
+  fprintf(stderr, "%s index TRACE            build TRACE.idx\n", exeName);
+  fprintf(stderr, "%s TRACE pc ADDR          instructions executed at ADDR\n", exeName);
+  fprintf(stderr, "%s TRACE writes ADDR      instructions that wrote to ADDR\n", exeName);
+  fprintf(stderr, "%s TRACE at CYCLE         CPU state at CYCLE\n", exeName);
+  fprintf(stderr, "%s TRACE first REG=VALUE  first instruction with REG (a-l) equal to VALUE\n", exeName);
+  fprintf(stderr, "  --limit=N   print at most N results\n");
+}
+
+internal bool
+ParseNumber(char* string, u64 maxValue, u64* value)
+{
+  char* end;
+
+  if (!*string)
+    return false;
+  *value = strtoull(string, &end, 0);
+  return !*end && *value <= maxValue;
+}
+
+internal void
+PrintResult(const struct trace_record* record)
+{
+  printf("#%-10llu ", (unsigned long long)TraceFile_GetIndex());
+  TraceFile_PrintRecord(stdout, record);
+}
+
+/*
+  Seek to each instruction in 'instructions' in turn and print it.
+  The list is sorted, so the reader only moves forward.
+*/
+internal void
+PrintInstructions(const u64* instructions, u64 count, u32 writeAddress, bool showWrite)
+{
+  struct trace_record record;
+  u64                 n;
+
+  for (n = 0; n < count; ++n)
+  {
+    if (!TraceFile_SeekInstruction(instructions[n]) ||
+        !TraceFile_Next(&record))
+    {
+      fprintf(stderr, "trace ends before instruction %llu\n",
+              (unsigned long long)instructions[n]);
+      return;
+    }
+    PrintResult(&record);
+
+    if (showWrite)
+    {
+      const word_t* addresses;
+      const byte_t* values;
+      u32           writeCount;
+      u32           i;
+
+      writeCount = TraceFile_GetWrites(&addresses, &values);
+      for (i = 0; i < writeCount; ++i)
+      {
+        if (addresses[i] == writeAddress)
+          printf(" [%04x]=%02x", addresses[i], values[i]);
+      }
+    }
+    printf("\n");
+  }
+}
+
+internal int
+QueryList(u8 kind, char* argument, u64 limit)
+{
+  u64  address;
+  u64* instructions;
+  u64  count;
+
+  if (!ParseNumber(argument, 0xffff, &address))
+  {
+    fprintf(stderr, "invalid address: %s\n", argument);
+    return 1;
+  }
+
+  count = TraceIndex_GetListLength(kind, address);
+  if (count > limit)
+    count = limit;
+  instructions = (u64*)malloc((count ? count : 1) * sizeof(u64));
+  count = TraceIndex_GetList(kind, address, instructions, count);
+
+  if (kind == TRACE_INDEX_WRITE && TraceFile_GetFormat() == TRACE_FORMAT_RING)
+    fprintf(stderr, "ring traces do not record writes; use --trace-format=delta\n");
+  PrintInstructions(instructions, count, address, kind == TRACE_INDEX_WRITE);
+  free(instructions);
+  return 0;
+}
+
+internal int
+QueryCycle(char* argument)
+{
+  struct trace_record record;
+  u64                 cycle;
+
+  if (!ParseNumber(argument, ~0ULL, &cycle))
+  {
+    fprintf(stderr, "invalid cycle: %s\n", argument);
+    return 1;
+  }
+  if (!TraceFile_SeekCycle(cycle) || !TraceFile_Next(&record))
+  {
+    fprintf(stderr, "cycle %llu is not in the trace\n", (unsigned long long)cycle);
+    return 1;
+  }
+  PrintResult(&record);
+  printf("\n");
+  return 0;
+}
+
+internal byte_t
+GetRegister(const struct trace_record* record, u8 reg)
+{
+  switch (reg)
+  {
+  case TRACE_INDEX_A: { return record->a; }
+  case TRACE_INDEX_F: { return record->f; }
+  case TRACE_INDEX_B: { return record->b; }
+  case TRACE_INDEX_C: { return record->c; }
+  case TRACE_INDEX_D: { return record->d; }
+  case TRACE_INDEX_E: { return record->e; }
+  case TRACE_INDEX_H: { return record->h; }
+  default:            { return record->l; }
+  }
+}
+
+/*
+  QueryFirst()
+
+  Find the first instruction where 'REG=VALUE' (or 'REG==VALUE') holds,
+  decoding only the chunks whose summaries contain the value.
+*/
+internal int
+QueryFirst(char* argument)
+{
+  const struct trace_index_header* header = TraceIndex_GetHeader();
+  struct trace_record              record;
+  char*                            equals;
+  u64                              value;
+  u8                               reg;
+  u64                              chunk;
+
+  equals = strchr(argument, '=');
+  if (!equals)
+  {
+    fprintf(stderr, "expected REG=VALUE: %s\n", argument);
+    return 1;
+  }
+  *equals = '\0';
+  for (reg = 0; reg < TRACE_INDEX_REGS; ++reg)
+  {
+    if (strlen(argument) == 1 && tolower(argument[0]) == regNames[reg][0])
+      break;
+  }
+  equals += (equals[1] == '=') ? 2 : 1;
+  if (reg == TRACE_INDEX_REGS || !ParseNumber(equals, 0xff, &value))
+  {
+    fprintf(stderr, "expected a register a-l and a byte value\n");
+    return 1;
+  }
+
+  for (chunk = 0; chunk < header->chunkCount; ++chunk)
+  {
+    u64 start = header->firstInstruction + chunk * header->chunkInstructions;
+    u64 end   = start + header->chunkInstructions;
+
+    if (!TraceIndex_ChunkMayContain(chunk, reg, value))
+      continue;
+    if (!TraceFile_SeekInstruction(start))
+      break;
+    while (TraceFile_GetIndex() + 1 < end && TraceFile_Next(&record))
+    {
+      if (GetRegister(&record, reg) == value)
+      {
+        PrintResult(&record);
+        printf("\n");
+        return 0;
+      }
+    }
+  }
+  fprintf(stderr, "%s is never 0x%02x\n", regNames[reg], (u32)value);
+  return 1;
+}
+
+int
+main(int argc, char* argv[])
+{
+  const struct trace_index_header* header;
+  char*                            args[3];
+  u32                              argCount;
+  u64                              limit;
+  char                             indexPath[MAX_PATH_LENGTH];
+  int                              result;
+
+  argCount = 0;
+  limit    = ~0U;
+  for (int argi = 1; argi < argc; ++argi)
+  {
+    if (strncmp(argv[argi], "--limit=", 8) == 0)
+      limit = strtoull(argv[argi] + 8, 0, 0);
+    else if (argv[argi][0] != '-' && argCount < 3)
+      args[argCount++] = argv[argi];
+    else
+    {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argCount == 2 && strcmp(args[0], "index") == 0)
+  {
+    snprintf(indexPath, sizeof(indexPath), "%s.idx", args[1]);
+    if (!TraceIndex_Build(args[1], indexPath))
+    {
+      fprintf(stderr, "cannot index %s\n", args[1]);
+      return 1;
+    }
+    return 0;
+  }
+  if (argCount != 3)
+  {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  snprintf(indexPath, sizeof(indexPath), "%s.idx", args[0]);
+  if (!TraceFile_Open(args[0]))
+  {
+    fprintf(stderr, "%s: cannot open as a trace file\n", args[0]);
+    return 1;
+  }
+  header = TraceIndex_Open(indexPath) ? TraceIndex_GetHeader() : 0;
+  if (!header ||
+      header->traceSize != TraceFile_GetFileSize() ||
+      header->endInstruction != TraceFile_GetEndInstruction())
+  {
+    fprintf(stderr, "%s is missing or out of date; run '%s index %s'\n",
+            indexPath, argv[0], args[0]);
+    return 1;
+  }
+
+  setvbuf(stdout, 0, _IOFBF, OUTPUT_BUFFER_SIZE);
+  if (strcmp(args[1], "pc") == 0)
+    result = QueryList(TRACE_INDEX_PC, args[2], limit);
+  else if (strcmp(args[1], "writes") == 0)
+    result = QueryList(TRACE_INDEX_WRITE, args[2], limit);
+  else if (strcmp(args[1], "at") == 0)
+    result = QueryCycle(args[2]);
+  else if (strcmp(args[1], "first") == 0)
+    result = QueryFirst(args[2]);
+  else
+  {
+    PrintUsage(argv[0]);
+    result = 1;
+  }
+
+  TraceIndex_Close();
+  TraceFile_Close();
+  return result;
+}